@@ -92,8 +92,8 @@ static int modeset_create_fb(int fd, struct buffer_object *bo) {
     drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
 
     ///< Y buffer
-    bo->vaddr[0] =
-        (uint8_t *)mmap(0, bo->size[0], PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
+    bo->vaddr[0] = (uint8_t *)mmap(0, bo->size[0], PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, map.offset);
     printf("vaddress 0 fd : %d, handle : %d, vaddr: %p\n", fd, bo->handle[0], bo->vaddr[0]);
 
     memcpy(bo->vaddr[0], mem_buffer, bo->width * bo->height);
@@ -101,8 +101,8 @@ static int modeset_create_fb(int fd, struct buffer_object *bo) {
     struct drm_mode_map_dumb map2 = {};
     map2.handle = bo->handle[1];
     drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map2);
-    bo->vaddr[1] =
-        (uint8_t *)mmap(0, bo->size[1], PROT_READ | PROT_WRITE, MAP_SHARED, fd, map2.offset);
+    bo->vaddr[1] = (uint8_t *)mmap(0, bo->size[1], PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, map2.offset);
     printf("vaddress 0 fd : %d, handle : %d, vaddr: %p\n", fd, bo->handle[1], bo->vaddr[1]);
     memcpy(bo->vaddr[1], mem_buffer + bo->width * bo->height, bo->width * bo->height / 2);
 
@@ -151,6 +151,26 @@ static void log_drm_version(int fd) {
     }
 }
 
+/* first plane of crtc 0 that scans out nv12 natively */
+static uint32_t find_nv12_plane(int fd, drmModePlaneRes *plane_res) {
+    for (uint32_t i = 0; i < plane_res->count_planes; i++) {
+        drmModePlane *plane = drmModeGetPlane(fd, plane_res->planes[i]);
+        if (plane == NULL) {
+            continue;
+        }
+        bool nv12 = false;
+        for (uint32_t j = 0; j < plane->count_formats; j++) {
+            nv12 |= plane->formats[j] == DRM_FORMAT_NV12;
+        }
+        bool crtc0 = plane->possible_crtcs & 1;
+        drmModeFreePlane(plane);
+        if (nv12 && crtc0) {
+            return plane_res->planes[i];
+        }
+    }
+    return plane_res->planes[0];
+}
+
 int main(int argc, char **argv) {
     int fd;
     drmModeConnector *conn;
@@ -185,7 +205,7 @@ int main(int argc, char **argv) {
 
     drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
     plane_res = drmModeGetPlaneResources(fd);
-    plane_id = plane_res->planes[0];
+    plane_id = find_nv12_plane(fd, plane_res);
     printf("plane id is %d\n", plane_id);
 
     conn = drmModeGetConnector(fd, conn_id);
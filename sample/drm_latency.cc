@@ -0,0 +1,310 @@
+/**
+* frame timing analyzer: presents timestamped frames through DrmWrapper and correlates the
+* submit time, the vblank of the page flip and the time the flip event was read, in
+* microseconds. reports latency percentiles, flip jitter and missed frames
+* drm_latency [-d driver] [-n frames] [-f fps] [-o trace.txt]
+* drm_latency -i trace.txt [-d driver] [-o trace.txt]
+* -i replays the submit times of a recorded trace, by default through the vkms software
+* backend, and reports the recorded and the replayed timing side by side
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "src/drm_wrapper.h"
+
+static volatile sig_atomic_t quit = 0;
+
+/**
+ * one presented frame, CLOCK_MONOTONIC nanoseconds
+ */
+struct frame_timing {
+    uint64_t frame;
+    uint64_t target_ns;  ///< time the frame was meant to be on screen
+    uint64_t submit_ns;
+    uint64_t flip_ns;   ///< vblank of the page flip, 0 if the event never came
+    uint64_t event_ns;  ///< flip event read by the application
+};
+
+static void handle_signal(int) {
+    quit = 1;
+}
+
+static void usage(const char *name) {
+    printf("usage: %s [-d driver] [-n frames] [-f fps] [-o trace.txt]\n", name);
+    printf("       %s -i trace.txt [-d driver] [-o trace.txt]\n", name);
+    printf("  -f content rate, the refresh rate by default, -o writes the measured trace,\n");
+    printf("  -i replays a trace, through vkms unless -d names another driver\n");
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000ULL;
+    deadline.tv_nsec = deadline_ns % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
+
+/**
+ * nearest rank percentile of sorted values
+ */
+static int64_t percentile(const std::vector<int64_t> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(fraction * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_distribution(const char *name, std::vector<int64_t> values_ns) {
+    std::sort(values_ns.begin(), values_ns.end());
+    if (values_ns.empty()) {
+        printf("  %-16s no samples\n", name);
+        return;
+    }
+    printf("  %-16s p50 %8.1f us / p99 %8.1f us / max %8.1f us\n", name,
+           percentile(values_ns, 0.5) / 1000.0, percentile(values_ns, 0.99) / 1000.0,
+           values_ns.back() / 1000.0);
+}
+
+/**
+ * @param period_ns time between frames the content asks for
+ */
+static void report(const char *title, const std::vector<frame_timing> &timings,
+                   uint64_t period_ns) {
+    std::vector<int64_t> latency;
+    std::vector<int64_t> event_delay;
+    std::vector<int64_t> lateness;
+    std::vector<int64_t> intervals;
+    uint64_t lost = 0;
+    uint64_t missed = 0;
+    uint64_t last_flip_ns = 0;
+    for (const frame_timing &timing : timings) {
+        if (timing.flip_ns == 0) {
+            // the interval over a lost event says nothing about missed vblanks
+            lost++;
+            last_flip_ns = 0;
+            continue;
+        }
+        latency.push_back((int64_t)(timing.flip_ns - timing.submit_ns));
+        event_delay.push_back((int64_t)(timing.event_ns - timing.flip_ns));
+        lateness.push_back((int64_t)(timing.flip_ns - timing.target_ns));
+        if (last_flip_ns > 0) {
+            int64_t interval = (int64_t)(timing.flip_ns - last_flip_ns);
+            intervals.push_back(interval);
+            // a frame that stayed on screen for n periods hid n - 1 frames
+            int64_t periods = llround((double)interval / period_ns);
+            if (periods > 1) {
+                missed += periods - 1;
+            }
+        }
+        last_flip_ns = timing.flip_ns;
+    }
+
+    double mean = 0.0;
+    for (int64_t interval : intervals) {
+        mean += interval;
+    }
+    mean = intervals.empty() ? 0.0 : mean / intervals.size();
+    double variance = 0.0;
+    for (int64_t interval : intervals) {
+        variance += (interval - mean) * (interval - mean);
+    }
+    double jitter = intervals.empty() ? 0.0 : sqrt(variance / intervals.size());
+
+    printf("%s: %zu frames / %llu missed / %llu flip events lost\n", title, timings.size(),
+           (unsigned long long)missed, (unsigned long long)lost);
+    print_distribution("submit to flip", latency);
+    print_distribution("flip to event", event_delay);
+    print_distribution("flip vs target", lateness);
+    printf("  %-16s mean %8.1f us / jitter %6.1f us (expected %.1f us)\n", "flip interval",
+           mean / 1000.0, jitter / 1000.0, period_ns / 1000.0);
+}
+
+static bool write_trace(const char *path, const std::vector<frame_timing> &timings,
+                        uint64_t period_ns) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(fp, "# period_ns %llu\n", (unsigned long long)period_ns);
+    fprintf(fp, "# frame target_ns submit_ns flip_ns event_ns\n");
+    for (const frame_timing &timing : timings) {
+        fprintf(fp, "%llu %llu %llu %llu %llu\n", (unsigned long long)timing.frame,
+                (unsigned long long)timing.target_ns, (unsigned long long)timing.submit_ns,
+                (unsigned long long)timing.flip_ns, (unsigned long long)timing.event_ns);
+    }
+    return fclose(fp) == 0;
+}
+
+static bool read_trace(const char *path, std::vector<frame_timing> *timings,
+                       uint64_t *period_ns) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long value[5];
+        if (sscanf(line, "# period_ns %llu", &value[0]) == 1) {
+            *period_ns = value[0];
+            continue;
+        }
+        if (line[0] == '#' ||
+            sscanf(line, "%llu %llu %llu %llu %llu", &value[0], &value[1], &value[2], &value[3],
+                   &value[4]) != 5) {
+            continue;
+        }
+        frame_timing timing = {value[0], value[1], value[2], value[3], value[4]};
+        timings->push_back(timing);
+    }
+    fclose(fp);
+    return !timings->empty();
+}
+
+/**
+ * submit a swapchain buffer at submit_ns and wait for its flip event
+ */
+static bool present(DrmWrapper *drm_wrapper, uint64_t submit_ns, frame_timing *timing) {
+    int index = drm_wrapper->acquire_frame_buffer(1000);
+    if (index < 0) {
+        printf("no swapchain buffer was released\n");
+        return false;
+    }
+    sleep_until_ns(submit_ns);
+    uint64_t flip_count = drm_wrapper->get_flip_count();
+    timing->submit_ns = monotonic_ns();
+    if (!drm_wrapper->submit(index)) {
+        return false;
+    }
+    timing->flip_ns = 0;
+    while (drm_wrapper->get_flip_count() == flip_count && !quit) {
+        if (!drm_wrapper->handle_events(1000)) {
+            break;
+        }
+    }
+    timing->event_ns = monotonic_ns();
+    if (drm_wrapper->get_flip_count() != flip_count) {
+        timing->flip_ns = drm_wrapper->get_last_flip_time_us() * 1000;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const char *driver_name = nullptr;
+    const char *trace_path = nullptr;
+    const char *replay_path = nullptr;
+    uint64_t frame_count = 600;
+    double fps = 0.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:f:o:i:")) != -1) {
+        switch (opt) {
+            case 'd':
+                driver_name = optarg;
+                break;
+            case 'n':
+                frame_count = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                fps = atof(optarg);
+                break;
+            case 'o':
+                trace_path = optarg;
+                break;
+            case 'i':
+                replay_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<frame_timing> recorded;
+    uint64_t recorded_period_ns = 0;
+    if (replay_path != nullptr) {
+        if (!read_trace(replay_path, &recorded, &recorded_period_ns)) {
+            printf("%s holds no frames\n", replay_path);
+            return 1;
+        }
+        if (driver_name == nullptr) {
+            driver_name = "vkms";
+        }
+    }
+
+    DrmWrapper drm_wrapper;
+    if (!drm_wrapper.open(driver_name)) {
+        return 1;
+    }
+    const drmModeModeInfo &mode = drm_wrapper.get_display_mode();
+    if (mode.clock == 0) {
+        printf("display mode has no timings\n");
+        return 1;
+    }
+    uint64_t refresh_ns = (uint64_t)mode.htotal * mode.vtotal * 1000000 / mode.clock;
+    uint64_t period_ns = fps > 0.0 ? (uint64_t)(1000000000.0 / fps) : refresh_ns;
+    if (!recorded.empty()) {
+        period_ns = recorded_period_ns > 0 ? recorded_period_ns : refresh_ns;
+    }
+    printf("%s %dx%d refresh %.3f us / content period %.3f us\n", mode.name, mode.hdisplay,
+           mode.vdisplay, refresh_ns / 1000.0, period_ns / 1000.0);
+
+    if (!drm_wrapper.create_swapchain(mode.hdisplay, mode.vdisplay)) {
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    std::vector<frame_timing> measured;
+    uint64_t count = recorded.empty() ? frame_count : recorded.size();
+    uint64_t start_ns = monotonic_ns() + 100000000ULL;
+    for (uint64_t i = 0; i < count && !quit; i++) {
+        frame_timing timing = {};
+        timing.frame = i;
+        uint64_t submit_ns;
+        if (recorded.empty()) {
+            // commit during the refresh before the target, the flip lands on it
+            timing.target_ns = start_ns + i * period_ns;
+            submit_ns = timing.target_ns - refresh_ns;
+        } else {
+            // keep the recorded spacing of submits and targets
+            timing.target_ns = start_ns + (recorded[i].target_ns - recorded[0].submit_ns);
+            submit_ns = start_ns + (recorded[i].submit_ns - recorded[0].submit_ns);
+        }
+        if (!present(&drm_wrapper, submit_ns, &timing)) {
+            break;
+        }
+        measured.push_back(timing);
+    }
+
+    if (!recorded.empty()) {
+        report("recorded", recorded, period_ns);
+    }
+    report(recorded.empty() ? "measured" : "replayed", measured, period_ns);
+    if (trace_path != nullptr && !write_trace(trace_path, measured, period_ns)) {
+        return 1;
+    }
+
+    drm_wrapper.close();
+    return 0;
+}
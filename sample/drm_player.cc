@@ -0,0 +1,267 @@
+/**
+* play raw nv12 captures of any size through DrmWrapper
+* regular files are mmapped, pipes and block devices are read with io_uring
+* drm_player -w 1920 -h 1080 -f 60 [-l] [-u] [-q depth] [-D] [-d driver] capture.yuv|-
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+#include "src/drm_wrapper.h"
+#include "src/uring_frame_reader.h"
+
+// frames prefetched ahead of the display position
+static const uint64_t kReadaheadFrames = 8;
+
+static volatile sig_atomic_t quit = 0;
+
+struct player_stats {
+    uint64_t shown;
+    uint64_t late;
+};
+
+static void handle_signal(int) {
+    quit = 1;
+}
+
+static void usage(const char *name) {
+    printf("usage: %s -w width -h height [-f fps] [-l] [-u] [-q depth] [-D] [-d driver] "
+           "file.yuv|-\n",
+           name);
+    printf("  -l loop, -u force io_uring, -q io_uring reads in flight, -D open with O_DIRECT\n");
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+}
+
+static int64_t timespec_diff_ns(const struct timespec &a, const struct timespec &b) {
+    return (int64_t)(a.tv_sec - b.tv_sec) * 1000000000LL + (a.tv_nsec - b.tv_nsec);
+}
+
+/**
+ * sleep until the next frame deadline, a late frame restarts the schedule
+ * instead of trying to catch up a backlog
+ */
+static void wait_next_frame(struct timespec *deadline, uint64_t period_ns, player_stats *stats) {
+    timespec_add_ns(deadline, period_ns);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_diff_ns(now, *deadline) > 0) {
+        stats->late++;
+        *deadline = now;
+    } else {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+    }
+}
+
+static bool play_mmap(DrmWrapper *drm_wrapper, int fd, uint64_t file_size, int width, int height,
+                      uint64_t period_ns, bool loop, player_stats *stats) {
+    uint64_t frame_size = (uint64_t)width * height * 3 / 2;
+    uint64_t frame_count = file_size / frame_size;
+    if (frame_count == 0) {
+        printf("input is smaller than one %dx%d frame\n", width, height);
+        return false;
+    }
+
+    uint8_t *file_base = (uint8_t *)mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (file_base == MAP_FAILED) {
+        printf("mmap input failed: %s\n", strerror(errno));
+        return false;
+    }
+    madvise(file_base, file_size, MADV_SEQUENTIAL);
+
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t window_size = kReadaheadFrames * frame_size;
+    uint64_t prefetched_end = 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (uint64_t index = 0; !quit; index++) {
+        if (index == frame_count) {
+            if (!loop) {
+                break;
+            }
+            index = 0;
+            prefetched_end = 0;
+        }
+        uint64_t offset = index * frame_size;
+
+        // keep one to two windows read ahead, refill once the display reaches the middle so
+        // the reads land before the frames are due
+        if (offset + window_size > prefetched_end) {
+            uint64_t begin = (prefetched_end > offset ? prefetched_end : offset) & ~(page_size - 1);
+            uint64_t end = offset + 2 * window_size;
+            if (end > file_size) {
+                end = file_size;
+            }
+            if (end > begin) {
+                madvise(file_base + begin, end - begin, MADV_WILLNEED);
+            }
+            prefetched_end = end;
+        }
+
+        if (!drm_wrapper->draw_nv12_frame(file_base + offset, width, height, width)) {
+            break;
+        }
+        stats->shown++;
+
+        // drop the frame that just left the window behind the display position so memory
+        // use stays flat. a page it shares with the next frame goes with that one
+        if (offset >= window_size) {
+            uint64_t begin = (offset - window_size) & ~(page_size - 1);
+            uint64_t end = (offset - window_size + frame_size) & ~(page_size - 1);
+            if (end > begin) {
+                madvise(file_base + begin, end - begin, MADV_DONTNEED);
+                posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+            }
+        }
+
+        wait_next_frame(&deadline, period_ns, stats);
+    }
+
+    munmap(file_base, file_size);
+    return true;
+}
+
+static bool play_uring(DrmWrapper *drm_wrapper, int fd, int width, int height, uint32_t depth,
+                       uint64_t period_ns, player_stats *stats) {
+    UringFrameReader reader;
+    if (!reader.open(fd, width * height * 3 / 2, depth)) {
+        return false;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (!quit) {
+        uint8_t *frame = reader.acquire_frame();
+        if (frame == nullptr) {
+            break;
+        }
+        bool ret = drm_wrapper->draw_nv12_frame(frame, width, height, width);
+        // the frame was copied into scanout memory, let the reader refill it
+        reader.release_frame();
+        if (!ret) {
+            break;
+        }
+        stats->shown++;
+
+        wait_next_frame(&deadline, period_ns, stats);
+    }
+
+    reader.close();
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int width = 0;
+    int height = 0;
+    double fps = 30.0;
+    bool loop = false;
+    bool use_uring = false;
+    bool direct_io = false;
+    uint32_t depth = 4;
+    const char *driver_name = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:h:f:luq:Dd:")) != -1) {
+        switch (opt) {
+            case 'w':
+                width = atoi(optarg);
+                break;
+            case 'h':
+                height = atoi(optarg);
+                break;
+            case 'f':
+                fps = atof(optarg);
+                break;
+            case 'l':
+                loop = true;
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'q':
+                depth = atoi(optarg);
+                break;
+            case 'D':
+                direct_io = true;
+                break;
+            case 'd':
+                driver_name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || width <= 0 || height <= 0 || fps <= 0 || depth == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    int fd = STDIN_FILENO;
+    if (strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY | O_CLOEXEC | (direct_io ? O_DIRECT : 0));
+        if (fd < 0) {
+            printf("cannot open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+    struct stat st = {};
+    fstat(fd, &st);
+    // only regular files can be mapped, O_DIRECT asks to bypass the page cache
+    use_uring |= !S_ISREG(st.st_mode) || direct_io;
+
+    DrmWrapper drm_wrapper;
+    if (!drm_wrapper.open(driver_name)) {
+        close(fd);
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    uint64_t period_ns = (uint64_t)(1000000000.0 / fps);
+    player_stats stats = {};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool ret;
+    if (use_uring) {
+        if (loop) {
+            printf("loop is ignored for io_uring input\n");
+        }
+        ret = play_uring(&drm_wrapper, fd, width, height, depth, period_ns, &stats);
+    } else {
+        ret = play_mmap(&drm_wrapper, fd, st.st_size, width, height, period_ns, loop, &stats);
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = timespec_diff_ns(end, start) / 1e9;
+    printf("shown %llu frames in %.2fs (%.2f fps), %llu late\n", (unsigned long long)stats.shown,
+           seconds, seconds > 0 ? stats.shown / seconds : 0.0, (unsigned long long)stats.late);
+
+    drm_wrapper.close();
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return ret ? 0 : 1;
+}
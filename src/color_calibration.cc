@@ -0,0 +1,139 @@
+#include "color_calibration.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base/log.h"
+
+static uint16_t lut_value(double value) {
+    if (value < 0.0) {
+        value = 0.0;
+    } else if (value > 1.0) {
+        value = 1.0;
+    }
+    return (uint16_t)lround(value * 0xffff);
+}
+
+/**
+ * next line that is not empty or a comment, without the comment
+ */
+static bool read_line(FILE *fp, char *line, size_t size, uint32_t *line_number) {
+    while (fgets(line, size, fp) != NULL) {
+        (*line_number)++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        for (char *c = line; *c != '\0'; c++) {
+            if (*c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool read_lut(FILE *fp, uint32_t entries, uint32_t *line_number,
+                     std::vector<drm_color_lut> *lut) {
+    char line[256];
+    lut->clear();
+    for (uint32_t i = 0; i < entries; i++) {
+        double r, g, b;
+        if (!read_line(fp, line, sizeof(line), line_number) ||
+            sscanf(line, "%lf %lf %lf", &r, &g, &b) != 3) {
+            base::LogError() << "color calibration line " << *line_number
+                             << ": expected lut entry " << i << " of " << entries;
+            return false;
+        }
+        drm_color_lut entry = {};
+        entry.red = lut_value(r);
+        entry.green = lut_value(g);
+        entry.blue = lut_value(b);
+        lut->push_back(entry);
+    }
+    return true;
+}
+
+bool load_color_calibration(const char *path, color_calibration *calibration) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        base::LogError() << "open color calibration " << path << " failed reason:"
+                         << strerror(errno);
+        return false;
+    }
+
+    calibration->degamma_lut.clear();
+    calibration->gamma_lut.clear();
+    calibration->has_ctm = false;
+
+    bool ret = true;
+    char line[256];
+    uint32_t line_number = 0;
+    while (ret && read_line(fp, line, sizeof(line), &line_number)) {
+        char keyword[16] = {};
+        uint32_t entries = 0;
+        int fields = sscanf(line, "%15s %u", keyword, &entries);
+        if (strcmp(keyword, "degamma") == 0 && fields == 2 && entries >= 2) {
+            ret = read_lut(fp, entries, &line_number, &calibration->degamma_lut);
+        } else if (strcmp(keyword, "gamma") == 0 && fields == 2 && entries >= 2) {
+            ret = read_lut(fp, entries, &line_number, &calibration->gamma_lut);
+        } else if (strcmp(keyword, "ctm") == 0) {
+            for (uint32_t row = 0; ret && row < 3; row++) {
+                double *m = &calibration->ctm[row * 3];
+                ret = read_line(fp, line, sizeof(line), &line_number) &&
+                      sscanf(line, "%lf %lf %lf", &m[0], &m[1], &m[2]) == 3;
+            }
+            if (!ret) {
+                base::LogError() << "color calibration line " << line_number
+                                 << ": expected 3 ctm coefficients";
+            }
+            calibration->has_ctm = ret;
+        } else {
+            base::LogError() << "color calibration line " << line_number << ": unknown section "
+                             << line;
+            ret = false;
+        }
+    }
+    fclose(fp);
+
+    if (ret) {
+        base::LogDebug() << "color calibration " << path << ": degamma "
+                         << calibration->degamma_lut.size() << " / gamma "
+                         << calibration->gamma_lut.size() << " / ctm ("
+                         << (calibration->has_ctm ? "✓" : "✗") << ")";
+    }
+    return ret;
+}
+
+std::vector<drm_color_lut> resample_color_lut(const std::vector<drm_color_lut> &lut,
+                                              uint32_t size) {
+    if (lut.size() == size || lut.size() < 2 || size < 2) {
+        return lut;
+    }
+    std::vector<drm_color_lut> resampled(size);
+    for (uint32_t i = 0; i < size; i++) {
+        double position = (double)i * (lut.size() - 1) / (size - 1);
+        uint32_t index = (uint32_t)position;
+        if (index >= lut.size() - 1) {
+            index = lut.size() - 2;
+        }
+        double t = position - index;
+        const drm_color_lut &a = lut[index];
+        const drm_color_lut &b = lut[index + 1];
+        resampled[i].red = (uint16_t)lround(a.red + (b.red - a.red) * t);
+        resampled[i].green = (uint16_t)lround(a.green + (b.green - a.green) * t);
+        resampled[i].blue = (uint16_t)lround(a.blue + (b.blue - a.blue) * t);
+        resampled[i].reserved = 0;
+    }
+    return resampled;
+}
+
+void fill_color_ctm(const double matrix[9], drm_color_ctm *ctm) {
+    for (uint32_t i = 0; i < 9; i++) {
+        double value = matrix[i];
+        uint64_t magnitude = (uint64_t)llround(fabs(value) * 4294967296.0);
+        ctm->matrix[i] = (magnitude & ~(1ULL << 63)) | (value < 0 ? 1ULL << 63 : 0);
+    }
+}
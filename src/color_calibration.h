@@ -0,0 +1,39 @@
+#pragma once
+
+#include <drm_mode.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * per panel color correction the crtc applies while scanning out:
+ * degamma lut -> color transform matrix -> gamma lut
+ */
+struct color_calibration {
+    std::vector<drm_color_lut> degamma_lut;  ///< empty bypasses degamma
+    std::vector<drm_color_lut> gamma_lut;    ///< empty bypasses gamma
+    bool has_ctm;
+    double ctm[9];  ///< row major, out = ctm * (r, g, b)
+};
+
+/**
+ * @brief read a calibration file
+ *
+ * text, one keyword per section, # starts a comment:
+ *   degamma <entries>   followed by <entries> lines of "r g b", 0.0 - 1.0
+ *   gamma <entries>     same layout as degamma
+ *   ctm                 followed by 3 lines of 3 coefficients
+ * every section is optional.
+ */
+bool load_color_calibration(const char *path, color_calibration *calibration);
+
+/**
+ * @brief linearly resample a lut to the size the crtc expects
+ */
+std::vector<drm_color_lut> resample_color_lut(const std::vector<drm_color_lut> &lut,
+                                              uint32_t size);
+
+/**
+ * @brief convert a matrix into the S31.32 sign-magnitude layout of the CTM property
+ */
+void fill_color_ctm(const double matrix[9], drm_color_ctm *ctm);
@@ -0,0 +1,721 @@
+#include "drm_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include <map>
+
+#include "base/log.h"
+
+// a flip that takes longer than this is lost, not late
+static const int kFlipTimeoutMs = 1000;
+
+static pthread_mutex_t g_devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, DrmDevice *> g_devices;
+
+DrmDevice *DrmDevice::acquire(const char *driver_name) {
+    std::string name = driver_name != NULL ? driver_name : "";
+    pthread_mutex_lock(&g_devices_mutex);
+    DrmDevice *device = NULL;
+    auto iter = g_devices.find(name);
+    if (iter != g_devices.end()) {
+        device = iter->second;
+        device->_references++;
+    } else {
+        device = new DrmDevice();
+        if (device->open(driver_name)) {
+            device->_registry_key = name;
+            device->_references = 1;
+            g_devices[name] = device;
+        } else {
+            delete device;
+            device = NULL;
+        }
+    }
+    pthread_mutex_unlock(&g_devices_mutex);
+    return device;
+}
+
+DrmDevice *DrmDevice::acquire_lease(int lease_fd) {
+    // every lease fd is a device of its own, it only shows the leased objects
+    DrmDevice *device = new DrmDevice();
+    device->_fd = lease_fd;
+    if (!device->init()) {
+        delete device;
+        return NULL;
+    }
+    device->_registry_key = "lease-" + std::to_string(lease_fd);
+    device->_references = 1;
+    pthread_mutex_lock(&g_devices_mutex);
+    g_devices[device->_registry_key] = device;
+    pthread_mutex_unlock(&g_devices_mutex);
+    base::LogDebug() << "attached to drm lease fd " << lease_fd;
+    return device;
+}
+
+void DrmDevice::release() {
+    pthread_mutex_lock(&g_devices_mutex);
+    if (--_references > 0) {
+        pthread_mutex_unlock(&g_devices_mutex);
+        return;
+    }
+    g_devices.erase(_registry_key);
+    pthread_mutex_unlock(&g_devices_mutex);
+    delete this;
+}
+
+const plane_capability *DrmDevice::find_plane_capability(uint32_t plane_id) const {
+    for (const plane_capability &capability : _plane_capabilities) {
+        if (capability.plane_id == plane_id) {
+            return &capability;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * look an object up in a cache of the device. the ioctl runs without the device lock, a
+ * slow connector probe must not hold up the flip events of the other wrappers
+ */
+template <typename T>
+static std::shared_ptr<T> get_cached_object(pthread_mutex_t *mutex, const uint64_t *generation,
+                                            std::map<uint32_t, std::shared_ptr<T>> *cache,
+                                            int fd, uint32_t object_id,
+                                            T *(*get_object)(int, uint32_t),
+                                            void (*free_object)(T *)) {
+    pthread_mutex_lock(mutex);
+    auto iter = cache->find(object_id);
+    if (iter != cache->end()) {
+        std::shared_ptr<T> handle = iter->second;
+        pthread_mutex_unlock(mutex);
+        return handle;
+    }
+    uint64_t read_generation = *generation;
+    pthread_mutex_unlock(mutex);
+
+    T *object = get_object(fd, object_id);
+    if (object == NULL) {
+        return std::shared_ptr<T>();
+    }
+    std::shared_ptr<T> handle(object, free_object);
+    pthread_mutex_lock(mutex);
+    // read before an invalidation, it may already be stale and is not kept
+    if (*generation == read_generation) {
+        handle = cache->insert(std::make_pair(object_id, handle)).first->second;
+    }
+    pthread_mutex_unlock(mutex);
+    return handle;
+}
+
+drm_connector_handle DrmDevice::get_connector(uint32_t connector_id) {
+    return get_cached_object(&_mutex, &_object_generation, &_connectors, _fd, connector_id,
+                             drmModeGetConnector, drmModeFreeConnector);
+}
+
+drm_encoder_handle DrmDevice::get_encoder(uint32_t encoder_id) {
+    return get_cached_object(&_mutex, &_object_generation, &_encoders, _fd, encoder_id,
+                             drmModeGetEncoder, drmModeFreeEncoder);
+}
+
+drm_crtc_handle DrmDevice::get_crtc(uint32_t crtc_id) {
+    return get_cached_object(&_mutex, &_object_generation, &_crtcs, _fd, crtc_id,
+                             drmModeGetCrtc, drmModeFreeCrtc);
+}
+
+drm_plane_handle DrmDevice::get_plane(uint32_t plane_id) {
+    return get_cached_object(&_mutex, &_object_generation, &_planes, _fd, plane_id,
+                             drmModeGetPlane, drmModeFreePlane);
+}
+
+void DrmDevice::invalidate_objects() {
+    pthread_mutex_lock(&_mutex);
+    // handles given out keep their objects alive
+    _connectors.clear();
+    _encoders.clear();
+    _crtcs.clear();
+    _planes.clear();
+    _object_generation++;
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool DrmDevice::reserve_plane(uint32_t plane_id) {
+    pthread_mutex_lock(&_mutex);
+    bool reserved = is_plane_reserved(plane_id);
+    if (!reserved) {
+        _reserved_planes.push_back(plane_id);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return !reserved;
+}
+
+void DrmDevice::release_plane(uint32_t plane_id) {
+    pthread_mutex_lock(&_mutex);
+    for (auto iter = _reserved_planes.begin(); iter != _reserved_planes.end(); ++iter) {
+        if (*iter == plane_id) {
+            _reserved_planes.erase(iter);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool DrmDevice::is_plane_reserved(uint32_t plane_id) {
+    pthread_mutex_lock(&_mutex);
+    bool reserved = false;
+    for (uint32_t reserved_id : _reserved_planes) {
+        reserved |= reserved_id == plane_id;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return reserved;
+}
+
+void DrmDevice::attach_crtc(uint32_t crtc_id) {
+    pthread_mutex_lock(&_mutex);
+    crtc_user &user = _crtc_users[crtc_id];
+    if (user.wrappers == 0) {
+        memset(&user, 0, sizeof(user));
+    }
+    user.wrappers++;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void DrmDevice::detach_crtc(uint32_t crtc_id, bool crtc_disabled) {
+    pthread_mutex_lock(&_mutex);
+    auto iter = _crtc_users.find(crtc_id);
+    if (iter != _crtc_users.end() && --iter->second.wrappers == 0) {
+        // the last wrapper removed its frame buffers, the crtc is off
+        _crtc_users.erase(iter);
+    } else if (iter != _crtc_users.end() && crtc_disabled) {
+        iter->second.mode_set = false;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void DrmDevice::set_crtc_mode(uint32_t crtc_id, const drmModeModeInfo &mode) {
+    pthread_mutex_lock(&_mutex);
+    auto iter = _crtc_users.find(crtc_id);
+    if (iter != _crtc_users.end()) {
+        iter->second.mode_set = true;
+        iter->second.mode = mode;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool DrmDevice::get_crtc_mode(uint32_t crtc_id, drmModeModeInfo *mode) {
+    pthread_mutex_lock(&_mutex);
+    auto iter = _crtc_users.find(crtc_id);
+    bool mode_set = iter != _crtc_users.end() && iter->second.mode_set;
+    if (mode_set) {
+        *mode = iter->second.mode;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return mode_set;
+}
+
+uint32_t DrmDevice::get_used_crtcs() {
+    pthread_mutex_lock(&_mutex);
+    uint32_t used_crtcs = 0;
+    for (int i = 0; i < _mode_res->count_crtcs; i++) {
+        if (is_crtc_used(_mode_res->crtcs[i])) {
+            used_crtcs |= 1 << i;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+    return used_crtcs;
+}
+
+bool DrmDevice::is_crtc_used(uint32_t crtc_id) {
+    pthread_mutex_lock(&_mutex);
+    bool used = _crtc_users.count(crtc_id) > 0;
+    for (const auto &iter : _leases) {
+        for (uint32_t leased_id : iter.second.crtcs) {
+            used |= leased_id == crtc_id;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+    return used;
+}
+
+bool DrmDevice::get_lease_objects(uint32_t connector_id, std::vector<uint32_t> *object_ids) {
+    drm_connector_handle connector = get_connector(connector_id);
+    if (connector == NULL) {
+        base::LogError() << "drmModeGetConnector " << connector_id
+                         << " failed reason:" << strerror(errno);
+        return false;
+    }
+    // keep the crtc already driving the connector, the lessee avoids a full mode set
+    uint32_t possible_crtcs = 0;
+    int current = -1;
+    for (int i = 0; i < connector->count_encoders; i++) {
+        drm_encoder_handle encoder = get_encoder(connector->encoders[i]);
+        if (encoder == NULL) {
+            continue;
+        }
+        possible_crtcs |= encoder->possible_crtcs;
+        for (int c = 0; encoder->encoder_id == connector->encoder_id && c < _mode_res->count_crtcs;
+             c++) {
+            if (_mode_res->crtcs[c] == encoder->crtc_id) {
+                current = c;
+            }
+        }
+    }
+    possible_crtcs &= ~get_used_crtcs();
+    int pipe = -1;
+    if (current >= 0 && (possible_crtcs & (1 << current)) != 0) {
+        pipe = current;
+    } else if (possible_crtcs != 0) {
+        pipe = ffs(possible_crtcs) - 1;
+    }
+    if (pipe < 0 || pipe >= _mode_res->count_crtcs) {
+        base::LogError() << "no free crtc for connector " << connector_id;
+        return false;
+    }
+
+    object_ids->clear();
+    object_ids->push_back(connector_id);
+    object_ids->push_back(_mode_res->crtcs[pipe]);
+    // an atomic lessee needs the primary plane, overlays come on top, cursors are left out
+    for (uint64_t type : {DRM_PLANE_TYPE_PRIMARY, DRM_PLANE_TYPE_OVERLAY}) {
+        for (const plane_capability &capability : _plane_capabilities) {
+            if (capability.type == type && (capability.possible_crtcs & (1 << pipe)) != 0 &&
+                !is_plane_reserved(capability.plane_id)) {
+                object_ids->push_back(capability.plane_id);
+            }
+        }
+    }
+    if (object_ids->size() < 3) {
+        base::LogError() << "no free plane for crtc " << _mode_res->crtcs[pipe];
+        return false;
+    }
+    return true;
+}
+
+int DrmDevice::create_lease(const std::vector<uint32_t> &object_ids, uint32_t *lessee_id) {
+    pthread_mutex_lock(&_mutex);
+    lease objects;
+    bool ret = true;
+    for (uint32_t object_id : object_ids) {
+        bool is_crtc = false;
+        for (int i = 0; i < _mode_res->count_crtcs; i++) {
+            is_crtc |= _mode_res->crtcs[i] == object_id;
+        }
+        if (is_crtc) {
+            if (is_crtc_used(object_id)) {
+                base::LogError() << "crtc " << object_id << " is in use and cannot be leased";
+                ret = false;
+                break;
+            }
+            objects.crtcs.push_back(object_id);
+        } else if (find_plane_capability(object_id) != NULL) {
+            if (!reserve_plane(object_id)) {
+                base::LogError() << "plane " << object_id << " is in use and cannot be leased";
+                ret = false;
+                break;
+            }
+            objects.planes.push_back(object_id);
+        }
+    }
+    int lease_fd = -1;
+    if (ret) {
+        lease_fd = drmModeCreateLease(_fd, object_ids.data(), object_ids.size(), O_CLOEXEC,
+                                      lessee_id);
+        if (lease_fd < 0) {
+            base::LogError() << "drmModeCreateLease failed reason:" << strerror(errno);
+        }
+    }
+    if (lease_fd < 0) {
+        for (uint32_t plane_id : objects.planes) {
+            release_plane(plane_id);
+        }
+    } else {
+        _leases[*lessee_id] = objects;
+        base::LogDebug() << "leased " << object_ids.size() << " objects to lessee " << *lessee_id;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return lease_fd;
+}
+
+bool DrmDevice::revoke_lease(uint32_t lessee_id) {
+    pthread_mutex_lock(&_mutex);
+    bool ret = drmModeRevokeLease(_fd, lessee_id) == 0;
+    int error = errno;
+    if (!ret) {
+        base::LogError() << "drmModeRevokeLease " << lessee_id << " failed reason:"
+                         << strerror(error);
+    }
+    // a lease the kernel no longer knows has ended with its lessee, its objects are free
+    auto iter = _leases.find(lessee_id);
+    if (iter != _leases.end() && (ret || error == ENOENT)) {
+        for (uint32_t plane_id : iter->second.planes) {
+            release_plane(plane_id);
+        }
+        _leases.erase(iter);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return ret;
+}
+
+void DrmDevice::set_commit_batching(bool enable) {
+    if (!enable) {
+        flush_commits();
+    }
+    pthread_mutex_lock(&_mutex);
+    _commit_batching = enable && _has_atomic;
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool DrmDevice::queue_commit(drmModeAtomicReq *request, uint32_t crtc_id,
+                             drm_flip_callback *callback) {
+    pthread_mutex_lock(&_mutex);
+    if (_batch_request == NULL) {
+        _batch_request = drmModeAtomicAlloc();
+    }
+    if (_batch_request == NULL || drmModeAtomicMerge(_batch_request, request) != 0) {
+        base::LogError() << "merging commit into batch failed";
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    batch_entry entry = {crtc_id, callback};
+    _batch_entries.push_back(entry);
+    // every wrapper of the last batch has its frame for the next vblank, no reason to wait
+    // any longer. wrappers that never commit, like lease or layer only ones, are not waited
+    // for, a wrapper that stopped committing drops out after one batch
+    bool flush = true;
+    for (drm_flip_callback *submitter : _batch_submitters) {
+        bool queued = false;
+        for (const batch_entry &queued_entry : _batch_entries) {
+            queued |= queued_entry.callback == submitter;
+        }
+        flush &= queued;
+    }
+    pthread_mutex_unlock(&_mutex);
+    // the flush waits for the last batch with the lock released, it must not be held here
+    return !flush || flush_commits();
+}
+
+bool DrmDevice::flush_commits() {
+    // a second nonblocking commit before the flip would fail with EBUSY. the wait runs
+    // without the lock, the other wrappers keep queueing into the batch meanwhile
+    pthread_mutex_lock(&_mutex);
+    struct timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (_batch_request != NULL && !_batch_entries.empty() && !_flipping_entries.empty()) {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t waited_ms =
+            (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (waited_ms >= kFlipTimeoutMs) {
+            base::LogWarn() << "page flip event of the last batch did not arrive";
+            // handled as flipped, the same as a wrapper committing on its own
+            while (!_flipping_entries.empty()) {
+                batch_flipped(this, _flipping_entries.front().crtc_id, true, 0);
+            }
+            break;
+        }
+        if (_event_readers > 0) {
+            // another thread reads the events, batch_flipped or its return wakes us up
+            struct timespec deadline = start;
+            deadline.tv_sec += kFlipTimeoutMs / 1000;
+            deadline.tv_nsec += kFlipTimeoutMs % 1000 * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&_flip_cond, &_mutex, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(&_mutex);
+        handle_events(kFlipTimeoutMs - waited_ms);
+        pthread_mutex_lock(&_mutex);
+    }
+    if (_batch_request == NULL || _batch_entries.empty()) {
+        // nothing queued, or a concurrent flush took the batch while we waited
+        pthread_mutex_unlock(&_mutex);
+        return true;
+    }
+
+    drmModeAtomicReq *request = _batch_request;
+    _batch_request = NULL;
+    _flipping_entries.swap(_batch_entries);
+    _batch_entries.clear();
+    _batch_submitters.clear();
+    for (const batch_entry &entry : _flipping_entries) {
+        _batch_submitters.push_back(entry.callback);
+    }
+
+    bool ret = true;
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    if (drmModeAtomicCommit(_fd, request, flags, &_batch_callback) != 0) {
+        base::LogError() << "batched drmModeAtomicCommit of " << _flipping_entries.size()
+                         << " commits failed reason:" << strerror(errno);
+        batch_flipped(this, 0, false, 0);
+        ret = false;
+    }
+    drmModeAtomicFree(request);
+    pthread_mutex_unlock(&_mutex);
+    return ret;
+}
+
+void DrmDevice::remove_submitter(drm_flip_callback *callback) {
+    pthread_mutex_lock(&_mutex);
+    for (auto iter = _batch_submitters.begin(); iter != _batch_submitters.end(); ++iter) {
+        if (*iter == callback) {
+            _batch_submitters.erase(iter);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool DrmDevice::handle_events(int timeout_ms) {
+    struct pollfd pfd = {};
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pthread_mutex_lock(&_mutex);
+    _event_readers++;
+    pthread_mutex_unlock(&_mutex);
+    int ret = poll(&pfd, 1, timeout_ms);
+    int error = errno;
+    pthread_mutex_lock(&_mutex);
+    bool dispatched = ret > 0 && dispatch_event();
+    _event_readers--;
+    // a flush waiting for this thread to read its flip event reads on its own from now on
+    pthread_cond_broadcast(&_flip_cond);
+    pthread_mutex_unlock(&_mutex);
+    if (ret < 0) {
+        base::LogError() << "poll drm fd failed reason:" << strerror(error);
+    }
+    return dispatched;
+}
+
+bool DrmDevice::dispatch_event() {
+    // another thread may have read the event between poll and lock, reading again would block
+    struct pollfd pfd = {};
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) {
+        return false;
+    }
+    drmEventContext context = {};
+    context.version = 3;
+    context.page_flip_handler2 = page_flip_handler;
+    if (drmHandleEvent(_fd, &context) != 0) {
+        base::LogError() << "drmHandleEvent failed reason:" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void DrmDevice::page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                  unsigned int tv_usec, unsigned int crtc_id, void *user_data) {
+    drm_flip_callback *callback = (drm_flip_callback *)user_data;
+    if (callback != NULL) {
+        callback->handler(callback->context, crtc_id, true,
+                          (uint64_t)tv_sec * 1000000 + tv_usec);
+    }
+}
+
+void DrmDevice::batch_flipped(void *context, uint32_t crtc_id, bool flipped,
+                              uint64_t timestamp_us) {
+    // a commit over several crtcs sends an event for each of them
+    DrmDevice *device = (DrmDevice *)context;
+    std::vector<batch_entry> entries;
+    for (auto iter = device->_flipping_entries.begin(); iter != device->_flipping_entries.end();) {
+        if (!flipped || iter->crtc_id == crtc_id) {
+            entries.push_back(*iter);
+            iter = device->_flipping_entries.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    for (const batch_entry &entry : entries) {
+        entry.callback->handler(entry.callback->context, entry.crtc_id, flipped, timestamp_us);
+    }
+    pthread_cond_broadcast(&device->_flip_cond);
+}
+
+bool DrmDevice::open(const char *driver_name) {
+    _fd = drmOpen(driver_name, NULL);
+    if (_fd < 0) {
+        base::LogError() << "Could not open DRM module " << (driver_name != NULL ? driver_name : "")
+                         << " reason:" << strerror(errno);
+        return false;
+    }
+    return init();
+}
+
+bool DrmDevice::init() {
+    log_drm_version();
+    if (!get_drm_capability()) {
+        close();
+        return false;
+    }
+    // every wrapper picks its planes from the full list, primary and cursor included
+    if (drmSetClientCap(_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0) {
+        base::LogError() << "Could not set universal planes capability bit";
+        close();
+        return false;
+    }
+
+    _mode_res = drmModeGetResources(_fd);
+    if (_mode_res == NULL) {
+        base::LogError() << "drmModeGetResources failed:" << strerror(errno);
+        close();
+        return false;
+    }
+    _mode_plane_res = drmModeGetPlaneResources(_fd);
+    if (_mode_plane_res == NULL) {
+        base::LogError() << "drmModeGetPlaneResources failed reason:" << strerror(errno);
+        close();
+        return false;
+    }
+    build_plane_capabilities();
+    return true;
+}
+
+void DrmDevice::close() {
+    flush_commits();
+    while (!_flipping_entries.empty() && handle_events(kFlipTimeoutMs)) {
+    }
+    invalidate_objects();
+    _plane_capabilities.clear();
+    _reserved_planes.clear();
+    _crtc_users.clear();
+    _leases.clear();
+    if (_mode_plane_res != NULL) {
+        drmModeFreePlaneResources(_mode_plane_res);
+        _mode_plane_res = NULL;
+    }
+    if (_mode_res != NULL) {
+        drmModeFreeResources(_mode_res);
+        _mode_res = NULL;
+    }
+    if (_fd >= 0) {
+        drmClose(_fd);
+        _fd = -1;
+    }
+}
+
+DrmDevice::DrmDevice() {
+    _references = 0;
+    _fd = -1;
+    _mode_res = NULL;
+    _mode_plane_res = NULL;
+    _has_prime_import = false;
+    _has_prime_export = false;
+    _has_async_page_flip = false;
+    _has_addfb2_modifiers = false;
+    _has_atomic = false;
+    _object_generation = 0;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_flip_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    _event_readers = 0;
+
+    _commit_batching = false;
+    _batch_request = NULL;
+    _batch_callback.handler = batch_flipped;
+    _batch_callback.context = this;
+}
+
+DrmDevice::~DrmDevice() {
+    close();
+    pthread_cond_destroy(&_flip_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void DrmDevice::log_drm_version() {
+    drmVersion *version = NULL;
+
+    version = drmGetVersion(_fd);
+    if (version != NULL) {
+        base::LogInfo() << "DRM v" << version->version_major << "." << version->version_minor << "."
+                        << version->version_patchlevel << " [" << version->name << " - "
+                        << version->desc << " - " << version->date << "]";
+        drmFreeVersion(version);
+    } else {
+        base::LogError() << "could not get driver information";
+    }
+}
+
+bool DrmDevice::get_drm_capability() {
+    uint64_t has_dumb_buffer = 0;
+    int ret = drmGetCap(_fd, DRM_CAP_DUMB_BUFFER, &has_dumb_buffer);
+    if (ret != 0) {
+        base::LogWarn() << "could not get dumb buffer capability";
+    }
+    if (has_dumb_buffer == 0) {
+        base::LogError() << "driver cannot handle dumb buffers";
+        return false;
+    }
+
+    uint64_t has_prime = 0;
+    ret = drmGetCap(_fd, DRM_CAP_PRIME, &has_prime);
+    if (ret != 0) {
+        base::LogWarn() << "could not get prime capability";
+    } else {
+        _has_prime_import = (has_prime & DRM_PRIME_CAP_IMPORT);
+        _has_prime_export = (has_prime & DRM_PRIME_CAP_EXPORT);
+    }
+
+    uint64_t has_addfb2_modifiers = 0;
+    ret = drmGetCap(_fd, DRM_CAP_ADDFB2_MODIFIERS, &has_addfb2_modifiers);
+    if (ret != 0) {
+        base::LogWarn() << "could not get addfb2 modifiers capability";
+    } else {
+        _has_addfb2_modifiers = has_addfb2_modifiers;
+    }
+
+    uint64_t has_async_page_flip = 0;
+    ret = drmGetCap(_fd, DRM_CAP_ASYNC_PAGE_FLIP, &has_async_page_flip);
+    if (ret != 0) {
+        base::LogWarn() << "could not get async page flip capability";
+    } else {
+        _has_async_page_flip = has_async_page_flip;
+    }
+
+    // explicit fences need atomic commits, without it frames are presented with SetCrtc
+    _has_atomic = drmSetClientCap(_fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+
+    // clang-format off
+    base::LogDebug() << "prime import ("  << (_has_prime_import ? "✓" : "✗")
+                     << ") / prime export (" << (_has_prime_export ? "✓": "✗")
+                     << ") / async page flip (" << (_has_async_page_flip ? "✓" : "✗")
+                     << ") / addfb2 modifiers (" << (_has_addfb2_modifiers ? "✓" : "✗")
+                     << ") / atomic (" << (_has_atomic ? "✓" : "✗")
+                     << ")";
+    // clang-format on
+    return true;
+}
+
+void DrmDevice::build_plane_capabilities() {
+    _plane_capabilities.clear();
+    for (uint32_t i = 0; i < _mode_plane_res->count_planes; i++) {
+        plane_capability capability;
+        if (!drm_get_plane_capability(_fd, _mode_plane_res->planes[i], &capability)) {
+            base::LogWarn() << "could not read capabilities of plane "
+                            << _mode_plane_res->planes[i];
+            continue;
+        }
+        base::LogDebug() << "plane " << capability.plane_id << ": type " << capability.type
+                         << " / formats " << capability.formats.size() << " / zpos "
+                         << capability.zpos_min << "-" << capability.zpos_max << " / rotations 0x"
+                         << std::hex << capability.rotations << std::dec << " / scale "
+                         << (capability.can_scale ? "✓" : "✗");
+        _plane_capabilities.push_back(capability);
+    }
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "drm_utils.h"
+
+/**
+ * handles to kms objects of the device cache, the object is freed with the last handle,
+ * so it stays readable after the cache dropped it. the fields are a snapshot of the
+ * object at the time it was read
+ */
+typedef std::shared_ptr<drmModeConnector> drm_connector_handle;
+typedef std::shared_ptr<drmModeEncoder> drm_encoder_handle;
+typedef std::shared_ptr<drmModeCrtc> drm_crtc_handle;
+typedef std::shared_ptr<drmModePlane> drm_plane_handle;
+
+/**
+ * @brief receives the page flip event of a commit
+ * @param flipped false when the batch the commit was queued in could not be committed
+ */
+struct drm_flip_callback {
+    void (*handler)(void *context, uint32_t crtc_id, bool flipped, uint64_t timestamp_us);
+    void *context;
+};
+
+/**
+ * one opened drm device shared by every DrmWrapper of the process that uses the same
+ * driver. it owns the fd, the client capabilities, the kms resources and the plane
+ * capabilities, which are read once, keeps track of the planes the wrappers reserved
+ * and dispatches the page flip events of all of them, each commit carries a
+ * drm_flip_callback as its user data.
+ *
+ * with commit batching the nonblocking commits of the wrappers are merged into one
+ * atomic commit per vblank, so streams on several planes never fail each other with
+ * EBUSY. the batch goes out once every wrapper that was in the last batch queued a
+ * commit or when flush_commits is called, whichever comes first.
+ *
+ * a master can lease a connector, a crtc and planes to another process, which attaches
+ * to the lease fd with acquire_lease and commits to its outputs directly.
+ */
+class DrmDevice {
+public:
+    /**
+     * @brief open the device of a driver or attach to it when it is already open
+     * @return NULL when the device cannot be opened
+     */
+    static DrmDevice *acquire(const char *driver_name);
+    /**
+     * @brief attach to a drm lease received from the master process
+     * @param lease_fd owned by the device from now on, also when attaching fails
+     */
+    static DrmDevice *acquire_lease(int lease_fd);
+    /**
+     * @brief detach, the last release closes the device
+     */
+    void release();
+
+    int get_fd() const {
+        return _fd;
+    }
+    drmModeRes *get_resources() const {
+        return _mode_res;
+    }
+    drmModePlaneRes *get_plane_resources() const {
+        return _mode_plane_res;
+    }
+    bool has_prime_import() const {
+        return _has_prime_import;
+    }
+    bool has_prime_export() const {
+        return _has_prime_export;
+    }
+    bool has_async_page_flip() const {
+        return _has_async_page_flip;
+    }
+    bool has_addfb2_modifiers() const {
+        return _has_addfb2_modifiers;
+    }
+    bool has_atomic() const {
+        return _has_atomic;
+    }
+    const std::vector<plane_capability> &get_plane_capabilities() const {
+        return _plane_capabilities;
+    }
+    const plane_capability *find_plane_capability(uint32_t plane_id) const;
+
+    /**
+     * @brief connector, encoder, crtc or plane from the object cache, read from the kernel
+     *        the first time it is asked for
+     * @return empty handle when the object cannot be read
+     */
+    drm_connector_handle get_connector(uint32_t connector_id);
+    drm_encoder_handle get_encoder(uint32_t encoder_id);
+    drm_crtc_handle get_crtc(uint32_t crtc_id);
+    drm_plane_handle get_plane(uint32_t plane_id);
+    /**
+     * @brief drop the cached objects, the next query reads them again. call it after a
+     *        mode set, or a hotplug, changed which crtc drives which connector
+     */
+    void invalidate_objects();
+
+    /**
+     * @brief reserve a plane for one wrapper
+     * @return false when it is already reserved
+     */
+    bool reserve_plane(uint32_t plane_id);
+    void release_plane(uint32_t plane_id);
+    bool is_plane_reserved(uint32_t plane_id);
+
+    /**
+     * @brief a wrapper shows its planes on the crtc. wrappers sharing a crtc keep the mode
+     *        the first of them set and only add their planes
+     */
+    void attach_crtc(uint32_t crtc_id);
+    /**
+     * @param crtc_disabled the wrapper turned the crtc off, the wrappers left on it have to set
+     *        the mode again
+     */
+    void detach_crtc(uint32_t crtc_id, bool crtc_disabled = false);
+    /**
+     * @brief remember the mode a wrapper committed on an attached crtc
+     */
+    void set_crtc_mode(uint32_t crtc_id, const drmModeModeInfo &mode);
+    /**
+     * @return false while no wrapper has set a mode on the crtc
+     */
+    bool get_crtc_mode(uint32_t crtc_id, drmModeModeInfo *mode);
+    /**
+     * @return bit mask of the crtc indices a wrapper is attached to or that are leased
+     */
+    uint32_t get_used_crtcs();
+
+    /**
+     * @brief connector, a crtc no wrapper or lease uses that can drive it and the free
+     *        planes of that crtc, primary first, everything a lessee needs to light up
+     *        the output on its own
+     */
+    bool get_lease_objects(uint32_t connector_id, std::vector<uint32_t> *object_ids);
+    /**
+     * @brief lease objects to another process, the crtcs and planes among them stay
+     *        reserved until the lease is revoked
+     * @param lessee_id receives the id revoke_lease takes
+     * @return lease fd for the client, -1 on failure
+     */
+    int create_lease(const std::vector<uint32_t> &object_ids, uint32_t *lessee_id);
+    /**
+     * @brief take the objects back, the lessee loses access to them immediately
+     */
+    bool revoke_lease(uint32_t lessee_id);
+
+    /**
+     * @brief merge the nonblocking commits of the attached wrappers, one per vblank
+     */
+    void set_commit_batching(bool enable);
+    bool is_commit_batching() const {
+        return _commit_batching;
+    }
+    /**
+     * @brief add the properties of a request to the next batch
+     * @param crtc_id crtc the request flips, its page flip event goes to callback
+     * @param callback must stay valid until it was called
+     * @return false when the batch was flushed and its commit failed
+     */
+    bool queue_commit(drmModeAtomicReq *request, uint32_t crtc_id, drm_flip_callback *callback);
+    /**
+     * @brief commit the queued requests once the previous batch has flipped, the wait
+     *        does not hold the device lock. must not be called with it held
+     */
+    bool flush_commits();
+    /**
+     * @brief a wrapper stops committing, the next batch does not wait for it
+     */
+    void remove_submitter(drm_flip_callback *callback);
+
+    /**
+     * @brief dispatch the page flip events of every commit on the device
+     * @param timeout_ms 0 only drains queued events, -1 waits for the next one
+     * @return true if an event was dispatched
+     */
+    bool handle_events(int timeout_ms);
+private:
+    struct batch_entry {
+        uint32_t crtc_id;
+        drm_flip_callback *callback;
+    };
+    struct crtc_user {
+        uint32_t wrappers;  ///< attached wrappers
+        bool mode_set;
+        drmModeModeInfo mode;
+    };
+    struct lease {
+        std::vector<uint32_t> crtcs;
+        std::vector<uint32_t> planes;
+    };
+    DrmDevice();
+    ~DrmDevice();
+    bool open(const char *driver_name);
+    /**
+     * read capabilities and resources of the opened fd
+    */
+    bool init();
+    void close();
+    void log_drm_version();
+    bool get_drm_capability();
+    /**
+     * read the capabilities of every plane into the cache
+    */
+    void build_plane_capabilities();
+    /**
+     * a wrapper is attached to the crtc or it is leased
+    */
+    bool is_crtc_used(uint32_t crtc_id);
+    bool dispatch_event();
+    static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                  unsigned int tv_usec, unsigned int crtc_id, void *user_data);
+    /**
+     * hand the flip of one crtc of the committed batch to the wrappers on it
+    */
+    static void batch_flipped(void *context, uint32_t crtc_id, bool flipped,
+                              uint64_t timestamp_us);
+private:
+    std::string _registry_key;  ///< driver name, or lease-<fd> for a lease
+    uint32_t _references;
+    int _fd;
+    drmModeRes *_mode_res;
+    drmModePlaneRes *_mode_plane_res;
+    bool _has_prime_import;
+    bool _has_prime_export;
+    bool _has_async_page_flip;
+    bool _has_addfb2_modifiers;
+    bool _has_atomic;
+    std::vector<plane_capability> _plane_capabilities;
+    std::map<uint32_t, drm_connector_handle> _connectors;
+    std::map<uint32_t, drm_encoder_handle> _encoders;
+    std::map<uint32_t, drm_crtc_handle> _crtcs;
+    std::map<uint32_t, drm_plane_handle> _planes;
+    uint64_t _object_generation;  ///< counts invalidations
+    std::vector<uint32_t> _reserved_planes;
+    std::map<uint32_t, crtc_user> _crtc_users;  ///< by crtc id
+    std::map<uint32_t, lease> _leases;  ///< by lessee id
+    pthread_mutex_t _mutex;  ///< recursive, callbacks run with it held
+    pthread_cond_t _flip_cond;  ///< a batch flipped or a thread stopped reading events
+    uint32_t _event_readers;    ///< threads in handle_events
+
+    bool _commit_batching;
+    drmModeAtomicReq *_batch_request;  ///< NULL while nothing is queued
+    std::vector<batch_entry> _batch_entries;     ///< queued for the next batch
+    std::vector<batch_entry> _flipping_entries;  ///< committed, waiting for their flip
+    std::vector<drm_flip_callback *> _batch_submitters;  ///< wrappers in the last batch
+    drm_flip_callback _batch_callback;
+};
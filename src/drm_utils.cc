@@ -1,6 +1,14 @@
 #include "drm_utils.h"
 
+#include <drm.h>
 #include <drm_fourcc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <algorithm>
+#include <string>
 
 uint32_t drm_bpp_from_drm_format(uint32_t drm_format) {
     uint32_t bpp = 0;
@@ -66,3 +74,330 @@ uint32_t drm_height_from_drm_format(uint32_t drm_format, uint32_t height) {
 
     return ret;
 }
+
+drmModePropertyRes *drm_get_property(int fd, uint32_t object_id, uint32_t object_type,
+                                     const char *name, uint64_t *value) {
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object_id, object_type);
+    if (props == NULL) {
+        return NULL;
+    }
+
+    drmModePropertyRes *found = NULL;
+    for (uint32_t i = 0; i < props->count_props && found == NULL; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (prop == NULL) {
+            continue;
+        }
+        if (strcmp(prop->name, name) == 0) {
+            found = prop;
+            if (value != nullptr) {
+                *value = props->prop_values[i];
+            }
+        } else {
+            drmModeFreeProperty(prop);
+        }
+    }
+    drmModeFreeObjectProperties(props);
+    return found;
+}
+
+uint32_t drm_get_property_id(int fd, uint32_t object_id, uint32_t object_type, const char *name) {
+    drmModePropertyRes *prop = drm_get_property(fd, object_id, object_type, name, nullptr);
+    if (prop == NULL) {
+        return 0;
+    }
+    uint32_t prop_id = prop->prop_id;
+    drmModeFreeProperty(prop);
+    return prop_id;
+}
+
+bool drm_get_property_value(int fd, uint32_t object_id, uint32_t object_type, const char *name,
+                            uint64_t *value) {
+    drmModePropertyRes *prop = drm_get_property(fd, object_id, object_type, name, value);
+    if (prop == NULL) {
+        return false;
+    }
+    drmModeFreeProperty(prop);
+    return true;
+}
+
+bool drm_get_plane_in_formats(int fd, uint32_t plane_id,
+                              std::map<uint32_t, std::vector<uint64_t>> *formats) {
+    formats->clear();
+
+    uint64_t blob_id = 0;
+    if (!drm_get_property_value(fd, plane_id, DRM_MODE_OBJECT_PLANE, "IN_FORMATS", &blob_id) ||
+        blob_id == 0) {
+        // no modifier support, only the implicit layout of each format
+        drmModePlane *plane = drmModeGetPlane(fd, plane_id);
+        if (plane == NULL) {
+            return false;
+        }
+        for (uint32_t i = 0; i < plane->count_formats; i++) {
+            (*formats)[plane->formats[i]];
+        }
+        drmModeFreePlane(plane);
+        return true;
+    }
+
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+    if (blob == NULL) {
+        return false;
+    }
+
+    const uint8_t *data = (const uint8_t *)blob->data;
+    const struct drm_format_modifier_blob *header = (const struct drm_format_modifier_blob *)data;
+    const uint32_t *format_list = (const uint32_t *)(data + header->formats_offset);
+    const struct drm_format_modifier *modifier_list =
+        (const struct drm_format_modifier *)(data + header->modifiers_offset);
+
+    for (uint32_t i = 0; i < header->count_modifiers; i++) {
+        const struct drm_format_modifier &modifier = modifier_list[i];
+        // bit n of formats refers to format_list[offset + n]
+        for (uint32_t bit = 0; bit < 64; bit++) {
+            uint32_t index = modifier.offset + bit;
+            if ((modifier.formats & (1ULL << bit)) && index < header->count_formats) {
+                (*formats)[format_list[index]].push_back(modifier.modifier);
+            }
+        }
+    }
+    drmModeFreePropertyBlob(blob);
+    return true;
+}
+
+/**
+ * scan out bandwidth rank of a modifier, higher is cheaper
+ */
+static int modifier_rank(uint64_t modifier) {
+    if (modifier == DRM_FORMAT_MOD_INVALID) {
+        return -1;
+    }
+    if (modifier == DRM_FORMAT_MOD_LINEAR) {
+        return 0;
+    }
+    if (modifier == DRM_FORMAT_MOD_QCOM_COMPRESSED) {
+        return 2;
+    }
+    // ARM framebuffer compression
+    if ((modifier >> 56) == 0x08 && ((modifier >> 52) & 0xf) == 0) {
+        return 2;
+    }
+    // any other vendor layout is tiled at least
+    return 1;
+}
+
+uint64_t drm_pick_modifier(const std::vector<uint64_t> &modifiers) {
+    uint64_t best = DRM_FORMAT_MOD_INVALID;
+    for (uint64_t modifier : modifiers) {
+        if (modifier_rank(modifier) > modifier_rank(best)) {
+            best = modifier;
+        }
+    }
+    return best;
+}
+
+/**
+ * msm sde planes publish "key=value" lines in a capabilities blob
+ */
+static void parse_plane_capabilities_blob(int fd, uint32_t plane_id,
+                                          plane_capability *capability) {
+    uint64_t blob_id = 0;
+    if (!drm_get_property_value(fd, plane_id, DRM_MODE_OBJECT_PLANE, "capabilities", &blob_id) ||
+        blob_id == 0) {
+        return;
+    }
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+    if (blob == NULL) {
+        return;
+    }
+
+    std::string text((const char *)blob->data, blob->length);
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(begin, end - begin);
+        size_t equal = line.find('=');
+        if (equal != std::string::npos) {
+            std::string key = line.substr(0, equal);
+            uint32_t value = strtoul(line.c_str() + equal + 1, NULL, 10);
+            if (key == "max_upscale") {
+                capability->max_upscale = value;
+            } else if (key == "max_downscale") {
+                capability->max_downscale = value;
+            } else if (key == "max_linewidth") {
+                capability->max_line_width = value;
+            }
+        }
+        begin = end + 1;
+    }
+    drmModeFreePropertyBlob(blob);
+}
+
+bool drm_get_plane_capability(int fd, uint32_t plane_id, plane_capability *capability) {
+    drmModePlane *plane = drmModeGetPlane(fd, plane_id);
+    if (plane == NULL) {
+        return false;
+    }
+    capability->plane_id = plane_id;
+    capability->possible_crtcs = plane->possible_crtcs;
+    drmModeFreePlane(plane);
+
+    if (!drm_get_plane_in_formats(fd, plane_id, &capability->formats)) {
+        return false;
+    }
+
+    capability->type = DRM_PLANE_TYPE_OVERLAY;
+    drm_get_property_value(fd, plane_id, DRM_MODE_OBJECT_PLANE, "type", &capability->type);
+
+    capability->has_zpos = false;
+    capability->zpos_immutable = false;
+    capability->zpos_min = 0;
+    capability->zpos_max = 0;
+    drmModePropertyRes *zpos = drm_get_property(fd, plane_id, DRM_MODE_OBJECT_PLANE, "zpos", NULL);
+    if (zpos != NULL) {
+        capability->has_zpos = true;
+        capability->zpos_immutable = zpos->flags & DRM_MODE_PROP_IMMUTABLE;
+        if (zpos->count_values >= 2) {
+            capability->zpos_min = zpos->values[0];
+            capability->zpos_max = zpos->values[1];
+        }
+        drmModeFreeProperty(zpos);
+    }
+
+    // bitmask enum values are bit positions
+    capability->rotations = DRM_MODE_ROTATE_0;
+    drmModePropertyRes *rotation =
+        drm_get_property(fd, plane_id, DRM_MODE_OBJECT_PLANE, "rotation", NULL);
+    if (rotation != NULL) {
+        for (int i = 0; i < rotation->count_enums; i++) {
+            capability->rotations |= 1ULL << rotation->enums[i].value;
+        }
+        drmModeFreeProperty(rotation);
+    }
+
+    // cursor planes are never scaled, other planes do not expose generic limits
+    capability->can_scale = capability->type != DRM_PLANE_TYPE_CURSOR;
+    capability->max_upscale = 0;
+    capability->max_downscale = 0;
+    capability->max_line_width = 0;
+    parse_plane_capabilities_blob(fd, plane_id, capability);
+    return true;
+}
+
+uint32_t drm_mode_refresh_mhz(const drmModeModeInfo &mode) {
+    if (mode.htotal == 0 || mode.vtotal == 0) {
+        return mode.vrefresh * 1000;
+    }
+    return (uint32_t)((uint64_t)mode.clock * 1000000 / ((uint64_t)mode.htotal * mode.vtotal));
+}
+
+/**
+ * how far the refresh rate is from a whole multiple of the frame rate, 0 means
+ * every frame is shown for the same number of refreshes
+ */
+static double cadence_error(const drmModeModeInfo &mode, double frame_rate) {
+    if (frame_rate <= 0) {
+        return 0;
+    }
+    double refresh = drm_mode_refresh_mhz(mode) / 1000.0;
+    double ratio = refresh / frame_rate;
+    if (ratio < 0.99) {
+        // frames would have to be dropped
+        return 1000 + frame_rate - refresh;
+    }
+    double multiple = ratio + 0.5 < 1 ? 1 : (double)(int)(ratio + 0.5);
+    return ratio > multiple ? ratio - multiple : multiple - ratio;
+}
+
+void drm_rank_modes(const drmModeModeInfo *modes, int count, uint32_t width, uint32_t height,
+                    double frame_rate, std::vector<int> *order) {
+    order->clear();
+    for (int i = 0; i < count; i++) {
+        if (modes[i].flags & (DRM_MODE_FLAG_INTERLACE | DRM_MODE_FLAG_DBLSCAN)) {
+            continue;
+        }
+        order->push_back(i);
+    }
+
+    auto fits = [&](const drmModeModeInfo &mode) {
+        return mode.hdisplay >= width && mode.vdisplay >= height;
+    };
+    std::stable_sort(order->begin(), order->end(), [&](int a, int b) {
+        const drmModeModeInfo &ma = modes[a];
+        const drmModeModeInfo &mb = modes[b];
+        if (fits(ma) != fits(mb)) {
+            return fits(ma);
+        }
+        // 23.976 on 59.94 and 24 on 60 are both judder free, tolerate clock rounding
+        double ca = cadence_error(ma, frame_rate);
+        double cb = cadence_error(mb, frame_rate);
+        if (ca > cb + 0.001 || cb > ca + 0.001) {
+            return ca < cb;
+        }
+        uint64_t area_a = (uint64_t)ma.hdisplay * ma.vdisplay;
+        uint64_t area_b = (uint64_t)mb.hdisplay * mb.vdisplay;
+        if (area_a != area_b) {
+            // without a fit the biggest mode loses the least
+            return fits(ma) ? area_a < area_b : area_a > area_b;
+        }
+        bool preferred_a = ma.type & DRM_MODE_TYPE_PREFERRED;
+        bool preferred_b = mb.type & DRM_MODE_TYPE_PREFERRED;
+        if (preferred_a != preferred_b) {
+            return preferred_a;
+        }
+        // equally judder free, the faster mode shows each frame with less latency and
+        // low rate modes are the ones sinks handle badly
+        return drm_mode_refresh_mhz(ma) > drm_mode_refresh_mhz(mb);
+    });
+}
+
+bool drm_get_connector_edid(int fd, uint32_t connector_id, std::vector<uint8_t> *edid) {
+    edid->clear();
+    uint64_t blob_id = 0;
+    if (!drm_get_property_value(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, "EDID", &blob_id) ||
+        blob_id == 0) {
+        return false;
+    }
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+    if (blob == NULL) {
+        return false;
+    }
+    const uint8_t *data = (const uint8_t *)blob->data;
+    edid->assign(data, data + blob->length);
+    drmModeFreePropertyBlob(blob);
+    return !edid->empty();
+}
+
+bool drm_edid_refresh_range(const std::vector<uint8_t> &edid, uint32_t *min_hz,
+                            uint32_t *max_hz) {
+    // the base block holds four 18 byte descriptors, range limits are tagged 0xfd
+    for (size_t offset = 54; offset + 18 <= 126 && offset + 18 <= edid.size(); offset += 18) {
+        const uint8_t *descriptor = &edid[offset];
+        if (descriptor[0] != 0 || descriptor[1] != 0 || descriptor[3] != 0xfd) {
+            continue;
+        }
+        // edid 1.4 adds 255 to a rate whose offset flag is set
+        *min_hz = descriptor[5] + ((descriptor[4] & 0x01) ? 255 : 0);
+        *max_hz = descriptor[6] + ((descriptor[4] & 0x02) ? 255 : 0);
+        return *min_hz > 0 && *max_hz >= *min_hz;
+    }
+    return false;
+}
+
+void drm_close_gem_handles(int fd, const uint32_t *handles, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        // planes sharing one dma-buf share one handle, so only close the first occurrence
+        bool duplicated = false;
+        for (uint32_t j = 0; j < i; j++) {
+            duplicated |= handles[j] == handles[i];
+        }
+        if (handles[i] > 0 && !duplicated) {
+            struct drm_gem_close gem_close = {};
+            gem_close.handle = handles[i];
+            drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+        }
+    }
+}
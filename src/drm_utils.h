@@ -1,10 +1,103 @@
 #pragma once
 
 #include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <map>
+#include <vector>
+
+/**
+ * what one hardware plane can do, read once from its properties
+ */
+struct plane_capability {
+    uint32_t plane_id;
+    uint32_t possible_crtcs;
+    uint64_t type;  ///< DRM_PLANE_TYPE_*
+    std::map<uint32_t, std::vector<uint64_t>> formats;  ///< format -> modifiers
+    bool has_zpos;
+    bool zpos_immutable;
+    uint64_t zpos_min;
+    uint64_t zpos_max;
+    uint64_t rotations;  ///< supported DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* bits
+    bool can_scale;
+    uint32_t max_upscale;    ///< 0 when the driver does not report a limit
+    uint32_t max_downscale;  ///< 0 when the driver does not report a limit
+    uint32_t max_line_width; ///< 0 when the driver does not report a limit
+};
 
 /**
  * @brief calc drm bpp from drm pixformat
 */
 uint32_t drm_bpp_from_drm_format(uint32_t drm_format);
 
-uint32_t drm_height_from_drm_format(uint32_t drm_format, uint32_t height);
\ No newline at end of file
+uint32_t drm_height_from_drm_format(uint32_t drm_format, uint32_t height);
+
+/**
+ * @brief find a property of a kms object by name
+ * @return property id, 0 if the object has no such property
+*/
+uint32_t drm_get_property_id(int fd, uint32_t object_id, uint32_t object_type, const char *name);
+
+/**
+ * @brief find a property of a kms object by name
+ * @param value current value, may be nullptr
+ * @return property, free with drmModeFreeProperty, nullptr if the object has no such property
+*/
+drmModePropertyRes *drm_get_property(int fd, uint32_t object_id, uint32_t object_type,
+                                     const char *name, uint64_t *value);
+
+/**
+ * @brief read the current value of a kms object property
+*/
+bool drm_get_property_value(int fd, uint32_t object_id, uint32_t object_type, const char *name,
+                            uint64_t *value);
+
+/**
+ * @brief parse the IN_FORMATS blob of a plane
+ * @param formats format -> supported modifiers, the plane format list with an empty
+ *                modifier list when the driver has no IN_FORMATS property
+*/
+bool drm_get_plane_in_formats(int fd, uint32_t plane_id,
+                              std::map<uint32_t, std::vector<uint64_t>> *formats);
+
+/**
+ * @brief pick the modifier that is cheapest to scan out
+ * compressed layouts first, then tiled, then linear
+ * @return DRM_FORMAT_MOD_INVALID when modifiers is empty
+*/
+uint64_t drm_pick_modifier(const std::vector<uint64_t> &modifiers);
+
+/**
+ * @brief read type, formats, zpos, rotation and scaling limits of a plane
+*/
+bool drm_get_plane_capability(int fd, uint32_t plane_id, plane_capability *capability);
+
+/**
+ * @brief exact refresh rate of a mode in millihertz, vrefresh is rounded to whole hertz
+*/
+uint32_t drm_mode_refresh_mhz(const drmModeModeInfo &mode);
+
+/**
+ * @brief order the modes of a connector by how well they show content natively
+ * no downscaling first, then frame rate cadence, then the least upscaling,
+ * interlaced and double scan modes are left out
+ * @param frame_rate content frames per second, 0 when unknown
+ * @param order indices into modes, best first
+*/
+void drm_rank_modes(const drmModeModeInfo *modes, int count, uint32_t width, uint32_t height,
+                    double frame_rate, std::vector<int> *order);
+
+/**
+ * @brief read the EDID blob of a connector
+*/
+bool drm_get_connector_edid(int fd, uint32_t connector_id, std::vector<uint8_t> *edid);
+
+/**
+ * @brief vertical refresh range from the display range limits descriptor of an EDID
+*/
+bool drm_edid_refresh_range(const std::vector<uint8_t> &edid, uint32_t *min_hz, uint32_t *max_hz);
+
+/**
+ * @brief close gem handles of the planes of a frame buffer, shared handles once
+*/
+void drm_close_gem_handles(int fd, const uint32_t *handles, uint32_t count);
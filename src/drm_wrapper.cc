@@ -2,283 +2,2318 @@
 
 #include <drm.h>
 #include <drm_fourcc.h>
+#include <errno.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 
+#include <algorithm>
 #include <string>
 
 #include "base/log.h"
+#include "drm_utils.h"
+#include "staging_pool.h"
 
-static drmModeConnector *find_main_monitor(int fd, drmModeRes *res);
-static drmModeConnector *find_used_connector_by_type(int fd, drmModeRes *res, int type);
-static drmModeConnector *find_first_used_connector(int fd, drmModeRes *res);
-static drmModeCrtc *find_crtc_for_connector(int fd, drmModeRes *res, drmModeConnector *conn,
-                                            uint32_t *pipe);
-static drmModePlane *find_plane_for_crtc(int fd, drmModeRes *res, drmModePlaneRes *pres,
-                                         int crtc_id);
+static const char *kColorProperties[3] = {"DEGAMMA_LUT", "CTM", "GAMMA_LUT"};
+
+// rows converted at a time before the software rotation, the strip stays in cache
+static const int32_t kRotationStripRows = 16;
+
+static const char *kModeCachePath = "/var/tmp/drm_wrapper_modes.cache";
+
+// a flip that takes longer than this is lost, not late
+static const uint64_t kFlipTimeoutNs = 1000000000ULL;
+static const int kFlipPollMs = 10;
+
+// holds a pthread mutex for the scope it is declared in
+class mutex_guard {
+public:
+    explicit mutex_guard(pthread_mutex_t *mutex) : _mutex(mutex) {
+        pthread_mutex_lock(_mutex);
+    }
+    ~mutex_guard() {
+        pthread_mutex_unlock(_mutex);
+    }
+private:
+    pthread_mutex_t *_mutex;
+};
+
+static drm_connector_handle find_main_monitor(DrmDevice *device);
+static drm_connector_handle find_used_connector_by_type(DrmDevice *device, int type);
+static drm_connector_handle find_first_used_connector(DrmDevice *device);
+static drm_crtc_handle find_crtc_for_connector(DrmDevice *device, const drmModeConnector *conn,
+                                               uint32_t *pipe);
+static drm_plane_handle find_plane_for_crtc(DrmDevice *device, uint32_t crtc_id);
+static bool wait_fence(int fence_fd, int timeout_ms);
+static void copy_nv12_planes(frame_buffer_object *buffer_object, const uint8_t *y_address,
+                             int32_t y_stride, const uint8_t *uv_address, int32_t uv_stride);
+static uint64_t monotonic_ns();
+static void sleep_until_ns(uint64_t wake_ns);
+static uint32_t scanout_line(uint64_t now_ns, uint64_t vblank_ns, uint64_t line_ns,
+                             uint64_t frame_ns);
 
 bool DrmWrapper::open(const char *driver_name /*= nullptr*/) {
-    bool ret = true;
     std::string str_driver_name = "msm_drm";
 
-    bool universal_planes = false;
+    if (driver_name != nullptr) {
+        str_driver_name = driver_name;
+    }
+    // wrappers on the same driver share the fd, the resources and the event loop
+    _device = DrmDevice::acquire(str_driver_name.c_str());
+    return open_output();
+}
+
+bool DrmWrapper::open_lease(int lease_fd) {
+    // the lease only shows the leased objects, the monitor search picks among them
+    _device = DrmDevice::acquire_lease(lease_fd);
+    return open_output();
+}
+
+int DrmWrapper::create_lease(uint32_t connector_id, uint32_t *lessee_id) {
+    if (_device == NULL || !_has_atomic) {
+        base::LogError() << "leases need an open device with atomic support";
+        return -1;
+    }
+    if (connector_id == _conn_id) {
+        base::LogError() << "connector " << connector_id << " is driven by this wrapper";
+        return -1;
+    }
+    // the device knows the crtcs of every wrapper, video wall and lease on it
+    std::vector<uint32_t> object_ids;
+    if (!_device->get_lease_objects(connector_id, &object_ids)) {
+        return -1;
+    }
+    return _device->create_lease(object_ids, lessee_id);
+}
+
+bool DrmWrapper::revoke_lease(uint32_t lessee_id) {
+    return _device != NULL && _device->revoke_lease(lessee_id);
+}
+
+bool DrmWrapper::open_output() {
+    bool ret = true;
+    if (_device == NULL) {
+        ret = false;
+        goto bail;
+    }
+    _fd = _device->get_fd();
+    _has_prime_import = _device->has_prime_import();
+    _has_prime_export = _device->has_prime_export();
+    _has_addfb2_modifiers = _device->has_addfb2_modifiers();
+    _has_atomic = _device->has_atomic();
+
+    if (_conn_id == -1) {
+        _conn = find_main_monitor(_device);
+    } else {
+        _conn = _device->get_connector(_conn_id);
+    }
+    if (_conn == NULL) {
+        ret = false;
+        base::LogError() << "Could not find a valid monitor connector";
+        goto bail;
+    }
+
+    _mode_crtc = find_crtc_for_connector(_device, _conn.get(), &_pipe);
+    if (_mode_crtc == NULL) {
+        ret = false;
+        base::LogError() << "Could not find a crtc for connector";
+        goto bail;
+    }
+
+    if (!_mode_crtc->mode_valid || _modesetting_enabled) {
+        base::LogDebug() << "enabling modesetting";
+        _modesetting_enabled = true;
+    }
+
+    if (_plane_id == -1) {
+        uint32_t plane_id = find_best_plane(_pipe, DRM_FORMAT_NV12, 0, 0, 0, 0,
+                                            DRM_MODE_ROTATE_0);
+        if (plane_id != 0) {
+            _mode_plane = _device->get_plane(plane_id);
+        } else {
+            base::LogWarn() << "no plane supports nv12 natively, taking the first plane of crtc";
+            _mode_plane = find_plane_for_crtc(_device, _mode_crtc->crtc_id);
+        }
+    } else {
+        _mode_plane = _device->get_plane(_plane_id);
+    }
+    if (_mode_plane == NULL) {
+        ret = false;
+        base::LogError() << "Could not find a plane for crtc";
+        goto bail;
+    }
+
+    _conn_id = _conn->connector_id;
+    _crtc_id = _mode_crtc->crtc_id;
+    _plane_id = _mode_plane->plane_id;
+
+    if (!reserve_plane(_plane_id)) {
+        ret = false;
+        base::LogError() << "plane " << _plane_id << " is used by another wrapper";
+        goto bail;
+    }
+
+    base::LogDebug() << "connector id = " << _conn_id << " / crtc id = " << _crtc_id
+                     << " / plane id = " << _plane_id;
+
+    if (_mode_crtc->mode_valid) {
+        _display_mode = _mode_crtc->mode;
+    } else if (_conn->count_modes > 0) {
+        _display_mode = _conn->modes[0];
+    } else {
+        ret = false;
+        base::LogError() << "connector " << _conn_id << " has no modes";
+        goto bail;
+    }
+    _hdisplay = _display_mode.hdisplay;
+    _vdisplay = _display_mode.vdisplay;
+
+    detect_variable_refresh();
+
+    _buffer_id = _mode_crtc->buffer_id;
+
+    _mm_width = _conn->mmWidth;
+    _mm_height = _conn->mmHeight;
+
+    base::LogDebug() << "display size: pixels = " << _hdisplay << "x" << _vdisplay
+                     << " / millimeters = " << _mm_width << "x" << _mm_height;
+    _device->attach_crtc(_crtc_id);
+    ret = true;
+    return ret;
+bail:
+    _mode_plane.reset();
+    _mode_crtc.reset();
+    _conn.reset();
+
+    if (_device != NULL) {
+        for (uint32_t plane_id : _assigned_planes) {
+            _device->release_plane(plane_id);
+        }
+        _assigned_planes.clear();
+        _device->release();
+        _device = NULL;
+    }
+    _fd = -1;
+
+    return ret;
+}
+
+bool DrmWrapper::draw_nv12_frame(const uint8_t *address, int32_t width, int32_t height,
+                                 int32_t stride) {
+    return draw_nv12_planes(address, stride, address + stride * height, stride, width, height);
+}
+
+bool DrmWrapper::draw_nv12_planes(const uint8_t *y_address, int32_t y_stride,
+                                  const uint8_t *uv_address, int32_t uv_stride, int32_t width,
+                                  int32_t height) {
+    if (_beam_racing_slices > 0 &&
+        race_nv12_planes(y_address, y_stride, uv_address, uv_stride, width, height)) {
+        return true;
+    }
+    frame_buffer_object *buffer_object = get_back_buffer(width, height);
+    if (buffer_object == NULL) {
+        return false;
+    }
+
+    upload_nv12(buffer_object, y_address, y_stride, uv_address, uv_stride);
+    return present_back_buffer();
+}
+
+bool DrmWrapper::draw_i420_frame(const uint8_t *y_address, int32_t y_stride,
+                                 const uint8_t *u_address, int32_t u_stride,
+                                 const uint8_t *v_address, int32_t v_stride, int32_t width,
+                                 int32_t height) {
+    if (_upload_rotation != DRM_MODE_ROTATE_0) {
+        return draw_rotated_strips(width, height, [&](int32_t row, int32_t rows, uint8_t *y,
+                                                      uint8_t *uv, int32_t pitch) {
+            convert_i420_to_nv12(y_address + (size_t)row * y_stride, y_stride,
+                                 u_address + (size_t)row / 2 * u_stride, u_stride,
+                                 v_address + (size_t)row / 2 * v_stride, v_stride, y, pitch, uv,
+                                 pitch, width, rows);
+        });
+    }
+    frame_buffer_object *buffer_object = get_back_buffer(width, height);
+    if (buffer_object == NULL) {
+        return false;
+    }
+
+    convert_i420_to_nv12(y_address, y_stride, u_address, u_stride, v_address, v_stride,
+                         buffer_object->vaddr[0], buffer_object->pitch[0], buffer_object->vaddr[1],
+                         buffer_object->pitch[1], buffer_object->width, buffer_object->height);
+    return present_back_buffer();
+}
+
+bool DrmWrapper::draw_yuyv_frame(const uint8_t *address, int32_t width, int32_t height,
+                                 int32_t stride) {
+    if (_upload_rotation != DRM_MODE_ROTATE_0) {
+        return draw_rotated_strips(width, height, [&](int32_t row, int32_t rows, uint8_t *y,
+                                                      uint8_t *uv, int32_t pitch) {
+            convert_yuyv_to_nv12(address + (size_t)row * stride, stride, y, pitch, uv, pitch,
+                                 width, rows);
+        });
+    }
+    frame_buffer_object *buffer_object = get_back_buffer(width, height);
+    if (buffer_object == NULL) {
+        return false;
+    }
+
+    convert_yuyv_to_nv12(address, stride, buffer_object->vaddr[0], buffer_object->pitch[0],
+                         buffer_object->vaddr[1], buffer_object->pitch[1], buffer_object->width,
+                         buffer_object->height);
+    return present_back_buffer();
+}
+
+bool DrmWrapper::draw_rgba_frame(const uint8_t *address, int32_t width, int32_t height,
+                                 int32_t stride, color_matrix matrix /*= color_matrix::BT709*/) {
+    if (_upload_rotation != DRM_MODE_ROTATE_0) {
+        return draw_rotated_strips(width, height, [&](int32_t row, int32_t rows, uint8_t *y,
+                                                      uint8_t *uv, int32_t pitch) {
+            convert_rgba_to_nv12(address + (size_t)row * stride, stride, y, pitch, uv, pitch,
+                                 width, rows, matrix);
+        });
+    }
+    frame_buffer_object *buffer_object = get_back_buffer(width, height);
+    if (buffer_object == NULL) {
+        return false;
+    }
+
+    convert_rgba_to_nv12(address, stride, buffer_object->vaddr[0], buffer_object->pitch[0],
+                         buffer_object->vaddr[1], buffer_object->pitch[1], buffer_object->width,
+                         buffer_object->height, matrix);
+    return present_back_buffer();
+}
+
+bool DrmWrapper::set_rotation(uint64_t rotation) {
+    mutex_guard guard(&_draw_mutex);
+    uint64_t angle = rotation & DRM_MODE_ROTATE_MASK;
+    if (angle == 0 || (angle & (angle - 1)) != 0 ||
+        (rotation & ~(uint64_t)(DRM_MODE_ROTATE_MASK | DRM_MODE_REFLECT_MASK)) != 0) {
+        base::LogError() << "invalid rotation 0x" << std::hex << rotation;
+        return false;
+    }
+
+    const plane_capability *capability = find_plane_capability(_plane_id);
+    bool hardware =
+        _has_atomic && capability != NULL && (capability->rotations & rotation) == rotation;
+    uint64_t upload_rotation = hardware ? (uint64_t)DRM_MODE_ROTATE_0 : rotation;
+    if (rotation_swaps_axes(upload_rotation) != rotation_swaps_axes(_upload_rotation)) {
+        // the swapchain is allocated in the rotated size, recreate it on the next frame
+        free_frame_buffer_object();
+    }
+    _rotation = hardware ? rotation : (uint64_t)DRM_MODE_ROTATE_0;
+    _upload_rotation = upload_rotation;
+    base::LogDebug() << "rotation 0x" << std::hex << rotation << " applied by "
+                     << (hardware ? "plane" : "upload");
+    return true;
+}
+
+bool DrmWrapper::set_video_position(int32_t x, int32_t y, uint32_t width, uint32_t height,
+                                    int64_t zpos /*= -1*/) {
+    mutex_guard guard(&_draw_mutex);
+    if (_fd < 0 || !_has_atomic) {
+        base::LogError() << "video position needs an open device with atomic modesetting";
+        return false;
+    }
+    _video_dst_x = x;
+    _video_dst_y = y;
+    _video_dst_width = height > 0 ? width : 0;
+    _video_dst_height = width > 0 ? height : 0;
+    _video_zpos = zpos;
+    const plane_capability *capability = find_plane_capability(_plane_id);
+    if (zpos >= 0 && capability != NULL && capability->has_zpos) {
+        // the osd plane takes the top
+        uint64_t zpos_max = capability->zpos_max;
+        if (zpos_max > capability->zpos_min) {
+            zpos_max--;
+        }
+        _video_zpos = (int64_t)std::min(std::max((uint64_t)zpos, capability->zpos_min), zpos_max);
+    }
+    return true;
+}
+
+bool DrmWrapper::set_osd(const uint8_t *address, int32_t width, int32_t height, int32_t stride,
+                         int32_t x, int32_t y, color_matrix matrix /*= color_matrix::BT709*/) {
+    mutex_guard guard(&_draw_mutex);
+    if (width <= 0 || height <= 0 || (width & 1) != 0 || (height & 1) != 0) {
+        base::LogError() << "invalid osd size " << width << "x" << height;
+        return false;
+    }
+    _osd_x = x & ~1;
+    _osd_y = y & ~1;
+
+    // a rotated video keeps the osd in the frame so both turn together
+    bool rotated = _rotation != DRM_MODE_ROTATE_0 || _upload_rotation != DRM_MODE_ROTATE_0;
+    if (_osd_plane_id == 0 && _has_atomic && !_osd_plane_failed && !rotated) {
+        _osd_plane_id = assign_plane(DRM_FORMAT_ARGB8888, width, height, width, height);
+    }
+    if (_osd_plane_id != 0) {
+        if (show_osd_plane(address, width, height, stride)) {
+            _osd_visible = true;
+            return true;
+        }
+        base::LogWarn() << "osd plane " << _osd_plane_id
+                        << " rejected the layer, blending it into the video instead";
+        clear_osd();
+        _osd_plane_failed = true;
+    }
+
+    convert_argb_to_nv12a(address, stride, width, height, matrix, &_osd_image);
+    _osd_image_rotation = 0;
+    _osd_visible = true;
+    return true;
+}
+
+void DrmWrapper::clear_osd() {
+    mutex_guard guard(&_draw_mutex);
+    _osd_visible = false;
+    if (_osd_plane_id == 0) {
+        return;
+    }
+    _osd_buffer_index = -1;
+    commit_properties(&DrmWrapper::add_osd_plane_properties, "disable osd plane");
+    destroy_buffer_object(&_osd_buffers[0]);
+    destroy_buffer_object(&_osd_buffers[1]);
+    release_plane(_osd_plane_id);
+    _osd_plane_id = 0;
+}
+
+bool DrmWrapper::set_color_calibration(const color_calibration &calibration) {
+    mutex_guard guard(&_draw_mutex);
+    if (get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT") == 0) {
+        return set_legacy_gamma(calibration);
+    }
+
+    release_color_blobs();
+    uint64_t degamma_size = 0;
+    uint64_t gamma_size = 0;
+    drm_get_property_value(_fd, _crtc_id, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT_SIZE", &degamma_size);
+    drm_get_property_value(_fd, _crtc_id, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT_SIZE", &gamma_size);
+
+    std::vector<drm_color_lut> luts[3];
+    drm_color_ctm ctm = {};
+    const void *data[3] = {NULL, NULL, NULL};
+    size_t sizes[3] = {0, 0, 0};
+    if (!calibration.degamma_lut.empty()) {
+        if (degamma_size > 0 && get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT")) {
+            luts[0] = resample_color_lut(calibration.degamma_lut, degamma_size);
+            data[0] = luts[0].data();
+            sizes[0] = luts[0].size() * sizeof(drm_color_lut);
+        } else {
+            base::LogWarn() << "crtc " << _crtc_id << " has no degamma lut, skipping it";
+        }
+    }
+    if (calibration.has_ctm) {
+        if (get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC, "CTM") != 0) {
+            fill_color_ctm(calibration.ctm, &ctm);
+            data[1] = &ctm;
+            sizes[1] = sizeof(ctm);
+        } else {
+            base::LogWarn() << "crtc " << _crtc_id << " has no color transform, skipping it";
+        }
+    }
+    if (!calibration.gamma_lut.empty()) {
+        if (gamma_size > 0) {
+            luts[2] = resample_color_lut(calibration.gamma_lut, gamma_size);
+            data[2] = luts[2].data();
+            sizes[2] = luts[2].size() * sizeof(drm_color_lut);
+        } else {
+            base::LogWarn() << "crtc " << _crtc_id << " reports no gamma lut size, skipping it";
+        }
+    }
+    for (uint32_t i = 0; i < 3; i++) {
+        if (data[i] != NULL &&
+            drmModeCreatePropertyBlob(_fd, data[i], sizes[i], &_color_blob_ids[i]) != 0) {
+            base::LogError() << "create " << kColorProperties[i]
+                             << " blob failed reason:" << strerror(errno);
+            release_color_blobs();
+            return false;
+        }
+    }
+
+    if (!_has_atomic) {
+        bool ret = true;
+        for (uint32_t i = 0; i < 3; i++) {
+            uint32_t property_id = get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC,
+                                                   kColorProperties[i]);
+            if (property_id != 0 && drmModeObjectSetProperty(_fd, _crtc_id, DRM_MODE_OBJECT_CRTC,
+                                                             property_id, _color_blob_ids[i])) {
+                base::LogError() << "set " << kColorProperties[i]
+                                 << " failed reason:" << strerror(errno);
+                ret = false;
+            }
+        }
+        release_color_blobs();
+        return ret;
+    }
+
+    _color_dirty = true;
+    if (!_mode_set) {
+        // the blobs stay until the first frame carries them
+        return true;
+    }
+    bool ret = commit_properties(&DrmWrapper::add_color_properties, "color calibration");
+    release_color_blobs();
+    return ret;
+}
+
+bool DrmWrapper::load_color_calibration(const char *path) {
+    color_calibration calibration;
+    if (!::load_color_calibration(path, &calibration)) {
+        return false;
+    }
+    return set_color_calibration(calibration);
+}
+
+void DrmWrapper::set_mode_cache_path(const char *path) {
+    _mode_cache_path = path != NULL ? path : "";
+    // loaded again by the next set_content_format
+    _display_key.clear();
+}
+
+bool DrmWrapper::set_content_format(uint32_t width, uint32_t height, double frame_rate) {
+    if (_conn == NULL) {
+        base::LogError() << "drm device is not open";
+        return false;
+    }
+    if (_display_key.empty()) {
+        _display_key = ModeCache::display_key(_fd, _conn.get());
+        if (!_mode_cache_path.empty()) {
+            _mode_cache.load(_mode_cache_path.c_str());
+        }
+    }
+
+    std::vector<int> order;
+    drm_rank_modes(_conn->modes, _conn->count_modes, width, height, frame_rate, &order);
+    _mode_candidates.clear();
+    for (int index : order) {
+        bool accepted = true;
+        if (_mode_cache.lookup(_display_key, _conn->modes[index], &accepted) && !accepted) {
+            base::LogDebug() << "skip mode " << _conn->modes[index].name
+                             << ", it failed on this display before";
+            continue;
+        }
+        _mode_candidates.push_back(_conn->modes[index]);
+    }
+    if (_mode_candidates.empty()) {
+        base::LogError() << "connector " << _conn_id << " has no usable mode for " << width << "x"
+                         << height << "@" << frame_rate;
+        return false;
+    }
+    select_display_mode(_mode_candidates.front());
+    _mode_candidates.erase(_mode_candidates.begin());
+    return true;
+}
+
+void DrmWrapper::select_display_mode(const drmModeModeInfo &mode) {
+    if (_mode_set && memcmp(&mode, &_display_mode, sizeof(mode)) == 0) {
+        return;
+    }
+    uint32_t refresh_mhz = drm_mode_refresh_mhz(mode);
+    base::LogDebug() << "display mode " << mode.hdisplay << "x" << mode.vdisplay << "@"
+                     << refresh_mhz / 1000 << "." << refresh_mhz % 1000 / 10;
+    _display_mode = mode;
+    _hdisplay = mode.hdisplay;
+    _vdisplay = mode.vdisplay;
+    // the next frame carries the modeset
+    wait_pending_flip();
+    if (_mode_blob_id != 0) {
+        drmModeDestroyPropertyBlob(_fd, _mode_blob_id);
+        _mode_blob_id = 0;
+    }
+    _mode_set = false;
+}
+
+void DrmWrapper::detect_variable_refresh() {
+    uint64_t vrr_capable = 0;
+    _vrr_capable = _has_atomic &&
+                   drm_get_property_value(_fd, _conn_id, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable",
+                                          &vrr_capable) &&
+                   vrr_capable != 0 &&
+                   get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED") != 0;
+    _vrr_min_hz = 0;
+    _vrr_max_hz = 0;
+    if (!_vrr_capable) {
+        base::LogDebug() << "variable refresh (✗)";
+        return;
+    }
+    std::vector<uint8_t> edid;
+    if (!drm_get_connector_edid(_fd, _conn_id, &edid) ||
+        !drm_edid_refresh_range(edid, &_vrr_min_hz, &_vrr_max_hz)) {
+        // the kernel found a range, it just is not in the base block
+        _vrr_min_hz = 0;
+        _vrr_max_hz = drm_mode_refresh_mhz(_display_mode) / 1000;
+    }
+    base::LogDebug() << "variable refresh (✓) " << _vrr_min_hz << " - " << _vrr_max_hz << " Hz";
+}
+
+bool DrmWrapper::set_variable_refresh(bool enable) {
+    mutex_guard guard(&_draw_mutex);
+    if (enable && !_vrr_capable) {
+        base::LogError() << "display is not variable refresh capable";
+        return false;
+    }
+    if (enable == _vrr_enabled) {
+        return true;
+    }
+    // the render thread reads the setting with each frame
+    pthread_mutex_lock(&_render_mutex);
+    _vrr_enabled = enable;
+    pthread_mutex_unlock(&_render_mutex);
+    _vrr_dirty = true;
+    if (!_mode_set) {
+        // goes out with the first frame
+        return true;
+    }
+    bool ret = commit_properties(&DrmWrapper::add_vrr_properties, "VRR_ENABLED");
+    if (ret) {
+        _vrr_dirty = false;
+    } else {
+        pthread_mutex_lock(&_render_mutex);
+        _vrr_enabled = !enable;
+        pthread_mutex_unlock(&_render_mutex);
+    }
+    return ret;
+}
+
+bool DrmWrapper::set_beam_racing(uint32_t slices) {
+    if (slices > 0 && (_display_mode.clock == 0 || _display_mode.htotal == 0 ||
+                       (_display_mode.flags & DRM_MODE_FLAG_INTERLACE) != 0)) {
+        base::LogError() << "beam racing needs progressive mode timings";
+        return false;
+    }
+    _beam_racing_slices = slices;
+    _beam_racing_late_slices = 0;
+    base::LogDebug() << "beam racing " << (slices > 0 ? "on" : "off") << " / " << slices
+                     << " slices";
+    return true;
+}
+
+bool DrmWrapper::race_nv12_planes(const uint8_t *y_address, int32_t y_stride,
+                                  const uint8_t *uv_address, int32_t uv_stride, int32_t width,
+                                  int32_t height) {
+    // anything a commit still has to carry, or an osd blended into the frame, needs the flip
+    if (_front_buffer_index < 0 || !_mode_set || _upload_rotation != DRM_MODE_ROTATE_0 ||
+        _rotation != DRM_MODE_ROTATE_0 || _vrr_enabled || _vrr_dirty || _color_dirty ||
+        (_osd_visible && _osd_plane_id == 0) || _video_crtc_height == 0) {
+        return false;
+    }
+    frame_buffer_object *buffer_object = &_buffer_objects[_front_buffer_index];
+    if (buffer_object->width != (uint32_t)width || buffer_object->height != (uint32_t)height) {
+        return false;
+    }
+    uint64_t vblank_ns = 0;
+    if (!get_vblank_time(&vblank_ns)) {
+        return false;
+    }
+
+    // the vblank timestamp is the start of the first active line, each line takes htotal
+    // pixel clocks and a frame vtotal lines
+    uint64_t line_ns = (uint64_t)_display_mode.htotal * 1000000 / _display_mode.clock;
+    uint32_t vtotal = _display_mode.vtotal;
+    uint64_t frame_ns = line_ns * vtotal;
+    if (line_ns == 0 || _video_crtc_y < 0 || vtotal <= _video_crtc_y + _video_crtc_height) {
+        return false;
+    }
+    // whole chroma rows per slice, rows map to lines through the plane scaling
+    uint32_t slice_rows = ((height + _beam_racing_slices - 1) / _beam_racing_slices + 1) & ~1u;
+    uint32_t slice_count = (height + slice_rows - 1) / slice_rows;
+    // one slice is copied while the beam scans about one slice
+    uint32_t lead_lines = slice_rows * _video_crtc_height / height;
+
+    // start with the first slice the beam is not about to reach, the slices above it show
+    // in the next refresh
+    uint64_t now_ns = monotonic_ns();
+    uint32_t beam = scanout_line(now_ns, vblank_ns, line_ns, frame_ns);
+    uint32_t first = 0;
+    while (first < slice_count &&
+           _video_crtc_y + first * slice_rows * _video_crtc_height / height < beam + lead_lines) {
+        first++;
+    }
+    if (first == slice_count) {
+        first = 0;
+    }
+
+    for (uint32_t i = 0; i < slice_count; i++) {
+        uint32_t slice = (first + i) % slice_count;
+        uint32_t row = slice * slice_rows;
+        uint32_t rows = std::min(slice_rows, (uint32_t)height - row);
+        uint32_t start_line = _video_crtc_y + row * _video_crtc_height / height;
+        uint32_t end_line = _video_crtc_y + (row + rows) * _video_crtc_height / height;
+
+        now_ns = monotonic_ns();
+        beam = scanout_line(now_ns, vblank_ns, line_ns, frame_ns);
+        if (beam >= start_line && beam < end_line) {
+            // the beam is scanning the slice, writing it now would tear, let it pass
+            uint64_t wake_ns = now_ns + (uint64_t)(end_line - beam) * line_ns;
+            struct timespec wake = {};
+            wake.tv_sec = wake_ns / 1000000000ULL;
+            wake.tv_nsec = wake_ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+            now_ns = monotonic_ns();
+            beam = scanout_line(now_ns, vblank_ns, line_ns, frame_ns);
+        }
+        uint32_t ahead = (start_line + vtotal - beam) % vtotal;
+
+        nv12_upload_generic(y_address + (size_t)row * y_stride, y_stride,
+                            uv_address + (size_t)row / 2 * uv_stride, uv_stride,
+                            buffer_object->vaddr[0] + (size_t)row * buffer_object->pitch[0],
+                            buffer_object->pitch[0],
+                            buffer_object->vaddr[1] + (size_t)row / 2 * buffer_object->pitch[1],
+                            buffer_object->pitch[1], width, rows);
+
+        // the beam got into the slice before the copy was done
+        if ((monotonic_ns() - now_ns) / line_ns >= ahead) {
+            _beam_racing_late_slices++;
+        }
+    }
+    return true;
+}
+
+bool DrmWrapper::get_vblank_time(uint64_t *vblank_ns) {
+    drmVBlank vblank = {};
+    // a relative wait for 0 vblanks returns the last one right away
+    vblank.request.type = (drmVBlankSeqType)(
+        DRM_VBLANK_RELATIVE | ((_pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+    vblank.request.sequence = 0;
+    if (drmWaitVBlank(_fd, &vblank) != 0) {
+        base::LogError() << "drmWaitVBlank failed reason:" << strerror(errno);
+        return false;
+    }
+    *vblank_ns = (uint64_t)vblank.reply.tval_sec * 1000000000ULL +
+                 (uint64_t)vblank.reply.tval_usec * 1000ULL;
+    return true;
+}
+
+uint64_t DrmWrapper::get_variable_refresh_time(uint64_t target_ns) {
+    if (_vrr_max_hz == 0 || _last_flip_us == 0) {
+        return target_ns;
+    }
+    // flip event timestamps are CLOCK_MONOTONIC
+    uint64_t last_flip_ns = _last_flip_us * 1000;
+    uint64_t min_interval_ns = 1000000000ULL / _vrr_max_hz;
+    if (target_ns < last_flip_ns + min_interval_ns) {
+        // the display still scans out the last frame
+        return last_flip_ns + min_interval_ns;
+    }
+    if (_vrr_min_hz == 0 || 1000000000ULL / _vrr_min_hz <= min_interval_ns) {
+        return target_ns;
+    }
+    // past the window the display repeats the last frame every 1 / min_hz, a flip during the
+    // scanout of the repeat waits for its end. commit at the end of the window before it
+    uint64_t max_interval_ns = 1000000000ULL / _vrr_min_hz;
+    uint64_t offset_ns = (target_ns - last_flip_ns) % max_interval_ns;
+    if (offset_ns < min_interval_ns) {
+        target_ns -= offset_ns;
+    }
+    return target_ns;
+}
+
+bool DrmWrapper::finish_mode_switch(bool accepted) {
+    if (_display_key.empty()) {
+        // the mode was not chosen by set_content_format, there is nothing to fall back to
+        return false;
+    }
+    _mode_cache.record(_display_key, _display_mode, accepted);
+    if (accepted) {
+        _mode_candidates.clear();
+        return false;
+    }
+    base::LogWarn() << "display mode " << _display_mode.name << " rejected";
+    if (_mode_candidates.empty()) {
+        return false;
+    }
+    select_display_mode(_mode_candidates.front());
+    _mode_candidates.erase(_mode_candidates.begin());
+    return true;
+}
+
+bool DrmWrapper::adopt_crtc_mode() {
+    drmModeModeInfo mode;
+    if (!_device->get_crtc_mode(_crtc_id, &mode)) {
+        return false;
+    }
+    if (memcmp(&mode, &_display_mode, sizeof(mode)) != 0) {
+        if (!_display_key.empty()) {
+            return false;
+        }
+        base::LogDebug() << "crtc " << _crtc_id << " already shows " << mode.name;
+        _display_mode = mode;
+        _hdisplay = mode.hdisplay;
+        _vdisplay = mode.vdisplay;
+    }
+    _mode_set = true;
+    return true;
+}
+
+bool DrmWrapper::create_swapchain(int32_t width, int32_t height) {
+    if (_fd < 0) {
+        base::LogError() << "swapchain needs an open device";
+        return false;
+    }
+    if (_init_nv12_frame_buffer_object) {
+        return true;
+    }
+    return create_nv12_frame_buffer_object(width, height);
+}
+
+bool DrmWrapper::export_nv12_frame_buffers(int32_t width, int32_t height,
+                                           std::vector<dma_buf_frame> *frames) {
+    if (!_has_prime_export) {
+        base::LogError() << "driver cannot export prime buffers";
+        return false;
+    }
+    if (!create_swapchain(width, height)) {
+        return false;
+    }
+
+    frames->clear();
+    for (uint32_t i = 0; i < kSwapchainSize; i++) {
+        const frame_buffer_object &buffer_object = _buffer_objects[i];
+        dma_buf_frame frame = {};
+        frame.index = i;
+        frame.width = buffer_object.width;
+        frame.height = buffer_object.height;
+        frame.format = DRM_FORMAT_NV12;
+        frame.modifier = DRM_FORMAT_MOD_LINEAR;
+        frame.num_planes = 2;
+        for (uint32_t plane = 0; plane < kBufferObjectSize; plane++) {
+            frame.fd[plane] = -1;
+        }
+        for (uint32_t plane = 0; plane < frame.num_planes; plane++) {
+            int ret = drmPrimeHandleToFD(_fd, buffer_object.handle[plane], DRM_CLOEXEC | DRM_RDWR,
+                                         &frame.fd[plane]);
+            if (ret != 0) {
+                base::LogError() << "drmPrimeHandleToFD failed for buffer " << i << " plane "
+                                 << plane << " reason:" << strerror(errno);
+                for (uint32_t j = 0; j < plane; j++) {
+                    ::close(frame.fd[j]);
+                }
+                for (const dma_buf_frame &exported : *frames) {
+                    for (uint32_t j = 0; j < exported.num_planes; j++) {
+                        ::close(exported.fd[j]);
+                    }
+                }
+                frames->clear();
+                return false;
+            }
+            frame.pitch[plane] = buffer_object.pitch[plane];
+            frame.offset[plane] = 0;
+        }
+        frames->push_back(frame);
+    }
+    base::LogDebug() << "exported " << frames->size() << " swapchain buffers as dma-buf";
+    return true;
+}
+
+bool DrmWrapper::present_frame_buffer(uint32_t index) {
+    if (!_init_nv12_frame_buffer_object || index >= kSwapchainSize) {
+        base::LogError() << "invalid swapchain buffer index " << index;
+        return false;
+    }
+    if (!show_frame_buffer(_buffer_objects[index])) {
+        _buffer_acquired[index] = false;
+        return false;
+    }
+    retire_front_buffer(index, -1);
+    return true;
+}
+
+int DrmWrapper::acquire_frame_buffer(int timeout_ms) {
+    if (!_init_nv12_frame_buffer_object) {
+        base::LogError() << "swapchain is not created";
+        return -1;
+    }
+
+    struct pollfd fds[kSwapchainSize];
+    for (int pass = 0; pass < 2; pass++) {
+        nfds_t count = 0;
+        for (uint32_t i = 0; i < kSwapchainSize; i++) {
+            uint32_t index = (_back_buffer_index + i) % kSwapchainSize;
+            if (_buffer_acquired[index] || (int)index == _front_buffer_index) {
+                continue;
+            }
+            if (_release_fences[index] >= 0 && !wait_fence(_release_fences[index], 0)) {
+                fds[count].fd = _release_fences[index];
+                fds[count].events = POLLIN;
+                fds[count].revents = 0;
+                count++;
+                continue;
+            }
+            if (_release_fences[index] >= 0) {
+                ::close(_release_fences[index]);
+                _release_fences[index] = -1;
+            }
+            _buffer_acquired[index] = true;
+            _back_buffer_index = index;
+            return index;
+        }
+        if (count == 0) {
+            base::LogError() << "every swapchain buffer is acquired or on screen";
+            return -1;
+        }
+        if (pass == 0 && poll(fds, count, timeout_ms) <= 0) {
+            break;
+        }
+    }
+    return -1;
+}
+
+bool DrmWrapper::submit(uint32_t index, int in_fence_fd /*= -1*/, int *out_fence_fd /*= nullptr*/) {
+    if (out_fence_fd != nullptr) {
+        *out_fence_fd = -1;
+    }
+    if (!_init_nv12_frame_buffer_object || index >= kSwapchainSize) {
+        base::LogError() << "invalid swapchain buffer index " << index;
+        return false;
+    }
+
+    if (!_has_atomic) {
+        // legacy kms cannot wait on the fence itself
+        if (in_fence_fd >= 0 && !wait_fence(in_fence_fd, -1)) {
+            base::LogError() << "waiting for in fence failed reason:" << strerror(errno);
+            return false;
+        }
+        return present_frame_buffer(index);
+    }
+
+    int release_fence_fd = -1;
+    // the last frame flips first, then a commit queued in a batch is retired by flip_done
+    wait_pending_flip();
+    if (_vrr_enabled) {
+        sleep_until_ns(get_variable_refresh_time(0));
+    }
+    // a batched commit has no out fence before the batch goes out, a caller asking for one
+    // commits on its own
+    _batched_index = out_fence_fd == nullptr ? (int)index : -1;
+    if (!commit_frame_buffer(_buffer_objects[index], in_fence_fd, &release_fence_fd, true)) {
+        _batched_index = -1;
+        _buffer_acquired[index] = false;
+        return false;
+    }
+    if (_batched_index >= 0) {
+        return true;
+    }
+    if (out_fence_fd != nullptr && release_fence_fd >= 0) {
+        *out_fence_fd = dup(release_fence_fd);
+    }
+    // the out fence of this frame is the release fence of the frame it replaces
+    retire_front_buffer(index, release_fence_fd);
+    return true;
+}
+
+bool DrmWrapper::handle_events(int timeout_ms) {
+    return _device != NULL && _device->handle_events(timeout_ms);
+}
+
+bool DrmWrapper::import_dma_buf_frame(const dma_buf_frame &frame, uint32_t *fb_id,
+                                      uint32_t plane_id /*= 0*/) {
+    if (!_has_prime_import) {
+        base::LogError() << "driver cannot import prime buffers";
+        return false;
+    }
+    if (frame.num_planes == 0 || frame.num_planes > kBufferObjectSize) {
+        base::LogError() << "invalid dma-buf plane count " << frame.num_planes;
+        return false;
+    }
+    if (_has_addfb2_modifiers && frame.modifier != DRM_FORMAT_MOD_INVALID) {
+        std::vector<uint64_t> modifiers;
+        get_supported_modifiers(frame.format, &modifiers, plane_id);
+        bool supported = false;
+        for (uint64_t modifier : modifiers) {
+            supported |= modifier == frame.modifier;
+        }
+        if (!supported) {
+            base::LogError() << "plane " << (plane_id != 0 ? plane_id : (uint32_t)_plane_id)
+                             << " cannot scan out modifier 0x" << std::hex << frame.modifier
+                             << " for format 0x" << frame.format;
+            return false;
+        }
+    }
+
+    frame_buffer_object buffer_object = {};
+    buffer_object.width = frame.width;
+    buffer_object.height = frame.height;
+    uint32_t offsets[4] = {
+        0,
+    };
+    for (uint32_t plane = 0; plane < frame.num_planes; plane++) {
+        int ret = drmPrimeFDToHandle(_fd, frame.fd[plane], &buffer_object.handle[plane]);
+        if (ret != 0) {
+            base::LogError() << "drmPrimeFDToHandle failed for plane " << plane
+                             << " reason:" << strerror(errno);
+            drm_close_gem_handles(_fd, buffer_object.handle, plane);
+            return false;
+        }
+        buffer_object.pitch[plane] = frame.pitch[plane];
+        offsets[plane] = frame.offset[plane];
+    }
+
+    int ret = add_frame_buffer(buffer_object.width, buffer_object.height, frame.format,
+                               frame.modifier, buffer_object.handle, buffer_object.pitch, offsets,
+                               &buffer_object.fb_id);
+    if (ret != 0) {
+        base::LogError() << "drmModeAddFB2 for imported frame failed reason:" << strerror(errno);
+        drm_close_gem_handles(_fd, buffer_object.handle, frame.num_planes);
+        return false;
+    }
+
+    _imported_frames[buffer_object.fb_id] = buffer_object;
+    *fb_id = buffer_object.fb_id;
+    base::LogDebug() << "imported dma-buf frame " << frame.width << "x" << frame.height
+                     << " as fb_id:" << buffer_object.fb_id;
+    return true;
+}
+
+bool DrmWrapper::get_supported_modifiers(uint32_t format, std::vector<uint64_t> *modifiers,
+                                         uint32_t plane_id /*= 0*/) {
+    modifiers->clear();
+    if (plane_id != 0 && _layers.find(plane_id) == _layers.end()) {
+        base::LogError() << "no layer " << plane_id;
+        return false;
+    }
+    const plane_capability *capability =
+        find_plane_capability(plane_id != 0 ? plane_id : (uint32_t)_plane_id);
+    if (capability == NULL) {
+        return false;
+    }
+    auto iter = capability->formats.find(format);
+    if (iter == capability->formats.end()) {
+        return false;
+    }
+    *modifiers = iter->second;
+    return true;
+}
+
+uint64_t DrmWrapper::get_preferred_modifier(uint32_t format, uint32_t plane_id /*= 0*/) {
+    std::vector<uint64_t> modifiers;
+    if (!get_supported_modifiers(format, &modifiers, plane_id)) {
+        return DRM_FORMAT_MOD_INVALID;
+    }
+    return drm_pick_modifier(modifiers);
+}
+
+uint32_t DrmWrapper::assign_plane(uint32_t format, uint32_t src_width, uint32_t src_height,
+                                  uint32_t dst_width, uint32_t dst_height,
+                                  uint64_t rotation /*= DRM_MODE_ROTATE_0*/) {
+    uint32_t plane_id = find_best_plane(_pipe, format, src_width, src_height, dst_width,
+                                        dst_height, rotation);
+    if (plane_id == 0 || !reserve_plane(plane_id)) {
+        return 0;
+    }
+    base::LogDebug() << "assigned plane " << plane_id << " to " << src_width << "x" << src_height
+                     << " format 0x" << std::hex << format;
+    return plane_id;
+}
+
+void DrmWrapper::release_plane(uint32_t plane_id) {
+    for (auto iter = _assigned_planes.begin(); iter != _assigned_planes.end(); ++iter) {
+        if (*iter == plane_id) {
+            _assigned_planes.erase(iter);
+            _device->release_plane(plane_id);
+            return;
+        }
+    }
+}
+
+bool DrmWrapper::present_imported_frame(uint32_t fb_id) {
+    auto iter = _imported_frames.find(fb_id);
+    if (iter == _imported_frames.end()) {
+        base::LogError() << "fb_id " << fb_id << " is not an imported frame";
+        return false;
+    }
+    if (!show_frame_buffer(iter->second)) {
+        return false;
+    }
+    retire_front_buffer(-1, -1);
+    set_displayed_import(fb_id);
+    return true;
+}
+
+void DrmWrapper::release_imported_frame(uint32_t fb_id) {
+    auto iter = _imported_frames.find(fb_id);
+    if (iter == _imported_frames.end()) {
+        return;
+    }
+    if (fb_id == _displayed_import_fb_id) {
+        _displayed_import_released = true;
+        return;
+    }
+
+    const frame_buffer_object &buffer_object = iter->second;
+    if (buffer_object.fb_id > 0) {
+        drmModeRmFB(_fd, buffer_object.fb_id);
+        __atomic_add_fetch(&_removed_frame_buffers, 1, __ATOMIC_RELEASE);
+    }
+    drm_close_gem_handles(_fd, buffer_object.handle, kBufferObjectSize);
+    _imported_frames.erase(iter);
+}
+
+uint32_t DrmWrapper::create_layer(uint32_t src_width, uint32_t src_height, int32_t x, int32_t y,
+                                  uint32_t width, uint32_t height, uint32_t zpos) {
+    if (!_has_atomic) {
+        base::LogError() << "layers need atomic modesetting";
+        return 0;
+    }
+    uint32_t plane_id = assign_plane(DRM_FORMAT_NV12, src_width, src_height, width, height);
+    if (plane_id == 0) {
+        base::LogError() << "no free plane for a " << src_width << "x" << src_height
+                         << " layer shown at " << width << "x" << height;
+        return 0;
+    }
+    video_layer &layer = _layers[plane_id];
+    memset(&layer, 0, sizeof(layer));
+    layer.plane_id = plane_id;
+    set_layer_position(plane_id, x, y, width, height, zpos);
+    return plane_id;
+}
+
+bool DrmWrapper::set_layer_position(uint32_t layer_id, int32_t x, int32_t y, uint32_t width,
+                                    uint32_t height, uint32_t zpos) {
+    auto iter = _layers.find(layer_id);
+    if (iter == _layers.end() || iter->second.destroyed) {
+        base::LogError() << "no layer " << layer_id;
+        return false;
+    }
+    video_layer &layer = iter->second;
+    layer.x = x;
+    layer.y = y;
+    layer.width = width;
+    layer.height = height;
+    layer.zpos = zpos;
+    const plane_capability *capability = find_plane_capability(layer_id);
+    if (capability != NULL && capability->has_zpos) {
+        // the osd plane takes the top
+        uint64_t zpos_max = capability->zpos_max;
+        if (zpos_max > capability->zpos_min) {
+            zpos_max--;
+        }
+        layer.zpos = std::min(std::max((uint64_t)zpos, capability->zpos_min), zpos_max);
+    }
+    layer.dirty = true;
+    return true;
+}
+
+bool DrmWrapper::draw_layer_nv12_frame(uint32_t layer_id, const uint8_t *address, int32_t width,
+                                       int32_t height, int32_t stride) {
+    auto iter = _layers.find(layer_id);
+    if (iter == _layers.end() || iter->second.destroyed) {
+        base::LogError() << "no layer " << layer_id;
+        return false;
+    }
+    video_layer &layer = iter->second;
+    // write the buffer that is not on screen, a flip still pending may show the other
+    wait_pending_flip();
+    int index = 0;
+    if (layer.buffers[0].fb_id != 0 && layer.buffers[0].fb_id == layer.screen_fb_id) {
+        index = 1;
+    }
+    frame_buffer_object *buffer_object = &layer.buffers[index];
+    if (buffer_object->width != (uint32_t)width || buffer_object->height != (uint32_t)height) {
+        destroy_buffer_object(buffer_object);
+        if (!create_nv12_buffer_object(buffer_object, width, height)) {
+            destroy_buffer_object(buffer_object);
+            return false;
+        }
+    }
+    copy_nv12_planes(buffer_object, address, stride, address + stride * height, stride);
+    layer.fb_id = buffer_object->fb_id;
+    layer.src_width = width;
+    layer.src_height = height;
+    layer.dirty = true;
+    return true;
+}
+
+bool DrmWrapper::set_layer_frame(uint32_t layer_id, uint32_t fb_id) {
+    auto iter = _layers.find(layer_id);
+    auto frame = _imported_frames.find(fb_id);
+    if (iter == _layers.end() || iter->second.destroyed || frame == _imported_frames.end()) {
+        base::LogError() << "no layer " << layer_id << " or imported frame " << fb_id;
+        return false;
+    }
+    video_layer &layer = iter->second;
+    layer.fb_id = fb_id;
+    layer.src_width = frame->second.width;
+    layer.src_height = frame->second.height;
+    layer.dirty = true;
+    return true;
+}
+
+bool DrmWrapper::commit_layers() {
+    if (!_mode_set) {
+        // goes out with the first frame
+        return true;
+    }
+    bool ret = commit_properties(&DrmWrapper::add_layer_properties, "layer");
+    if (ret) {
+        finish_layer_commit();
+    }
+    return ret;
+}
+
+void DrmWrapper::destroy_layer(uint32_t layer_id) {
+    auto iter = _layers.find(layer_id);
+    if (iter == _layers.end()) {
+        return;
+    }
+    iter->second.destroyed = true;
+    iter->second.dirty = true;
+    if (_mode_set && commit_layers()) {
+        return;
+    }
+    // never shown, or removing its frame buffers turns the plane off
+    for (uint32_t i = 0; i < 2; i++) {
+        destroy_buffer_object(&iter->second.buffers[i]);
+    }
+    release_plane(layer_id);
+    _layers.erase(iter);
+}
+
+bool DrmWrapper::add_layer_properties(drmModeAtomicReq *request) {
+    bool ret = true;
+    for (auto iter = _layers.begin(); ret && iter != _layers.end(); ++iter) {
+        const video_layer &layer = iter->second;
+        uint32_t plane_id = layer.plane_id;
+        if (!layer.dirty) {
+            continue;
+        }
+        if (layer.destroyed || layer.fb_id == 0) {
+            ret = add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", 0) &&
+                  add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0);
+            continue;
+        }
+        // clang-format off
+        ret = add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", layer.fb_id) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", _crtc_id) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W", (uint64_t)layer.src_width << 16) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H", (uint64_t)layer.src_height << 16) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X", (uint64_t)(int64_t)layer.x) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", (uint64_t)(int64_t)layer.y) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W", layer.width) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H", layer.height);
+        // clang-format on
+        const plane_capability *capability = find_plane_capability(plane_id);
+        if (ret && capability != NULL && capability->has_zpos && !capability->zpos_immutable) {
+            ret = add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "zpos",
+                                      layer.zpos);
+        }
+    }
+    return ret;
+}
+
+void DrmWrapper::finish_layer_commit() {
+    for (auto iter = _layers.begin(); iter != _layers.end();) {
+        video_layer &layer = iter->second;
+        if (!layer.destroyed) {
+            layer.screen_fb_id = layer.fb_id;
+            layer.dirty = false;
+            ++iter;
+            continue;
+        }
+        for (uint32_t i = 0; i < 2; i++) {
+            destroy_buffer_object(&layer.buffers[i]);
+        }
+        release_plane(layer.plane_id);
+        iter = _layers.erase(iter);
+    }
+}
+
+const std::vector<plane_capability> &DrmWrapper::get_plane_capabilities() const {
+    static const std::vector<plane_capability> kNoPlanes;
+    return _device != NULL ? _device->get_plane_capabilities() : kNoPlanes;
+}
+
+const plane_capability *DrmWrapper::find_plane_capability(uint32_t plane_id) const {
+    return _device != NULL ? _device->find_plane_capability(plane_id) : NULL;
+}
+
+bool DrmWrapper::reserve_plane(uint32_t plane_id) {
+    if (!_device->reserve_plane(plane_id)) {
+        return false;
+    }
+    _assigned_planes.push_back(plane_id);
+    return true;
+}
+
+uint32_t DrmWrapper::find_best_plane(uint32_t pipe, uint32_t format, uint32_t src_width,
+                                     uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+                                     uint64_t rotation) const {
+    bool need_scale = src_width != dst_width || src_height != dst_height;
+    bool need_rotation = (rotation & ~(uint64_t)DRM_MODE_ROTATE_0) != 0;
+
+    uint32_t best_plane_id = 0;
+    uint32_t best_cost = UINT32_MAX;
+    for (const plane_capability &capability : get_plane_capabilities()) {
+        if ((capability.possible_crtcs & (1 << pipe)) == 0 ||
+            capability.formats.find(format) == capability.formats.end()) {
+            continue;
+        }
+        // planes of other wrappers on the device are taken as well
+        if (_device->is_plane_reserved(capability.plane_id) ||
+            (capability.rotations & rotation) != rotation) {
+            continue;
+        }
+        if (capability.max_line_width > 0 && src_width > capability.max_line_width) {
+            continue;
+        }
+        if (need_scale) {
+            if (!capability.can_scale) {
+                continue;
+            }
+            uint32_t up = capability.max_upscale;
+            uint32_t down = capability.max_downscale;
+            if ((up > 0 && (dst_width > src_width * up || dst_height > src_height * up)) ||
+                (down > 0 && (src_width > dst_width * down || src_height > dst_height * down))) {
+                continue;
+            }
+        }
+
+        // the primary plane costs no extra pipe, after that prefer the plane with
+        // the fewest features this stream leaves unused
+        uint32_t cost = 0;
+        if (capability.type == DRM_PLANE_TYPE_OVERLAY) {
+            cost += 8;
+        } else if (capability.type == DRM_PLANE_TYPE_CURSOR) {
+            cost += 16;
+        }
+        if (capability.can_scale && !need_scale) {
+            cost += 4;
+        }
+        if ((capability.rotations & ~(uint64_t)DRM_MODE_ROTATE_0) != 0 && !need_rotation) {
+            cost += 2;
+        }
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_plane_id = capability.plane_id;
+        }
+    }
+    return best_plane_id;
+}
+
+int DrmWrapper::add_frame_buffer(uint32_t width, uint32_t height, uint32_t format,
+                                 uint64_t modifier, const uint32_t handles[4],
+                                 const uint32_t pitches[4], const uint32_t offsets[4],
+                                 uint32_t *fb_id) {
+    if (!_has_addfb2_modifiers || modifier == DRM_FORMAT_MOD_INVALID) {
+        return drmModeAddFB2(_fd, width, height, format, handles, pitches, offsets, fb_id, 0);
+    }
+
+    uint64_t modifiers[4] = {
+        0,
+    };
+    for (uint32_t i = 0; i < 4; i++) {
+        // unused planes must have a zero modifier
+        modifiers[i] = handles[i] != 0 ? modifier : 0;
+    }
+    return drmModeAddFB2WithModifiers(_fd, width, height, format, handles, pitches, offsets,
+                                      modifiers, fb_id, DRM_MODE_FB_MODIFIERS);
+}
+
+frame_buffer_object *DrmWrapper::get_back_buffer(int32_t width, int32_t height) {
+    if (!_init_nv12_frame_buffer_object) {
+        bool ret = rotation_swaps_axes(_upload_rotation)
+                       ? create_nv12_frame_buffer_object(height, width)
+                       : create_nv12_frame_buffer_object(width, height);
+        if (!ret) {
+            return NULL;
+        }
+    }
+    if (acquire_frame_buffer(-1) < 0) {
+        return NULL;
+    }
+    return &_buffer_objects[_back_buffer_index];
+}
+
+void DrmWrapper::upload_nv12(frame_buffer_object *buffer_object, const uint8_t *y_address,
+                             int32_t y_stride, const uint8_t *uv_address, int32_t uv_stride) {
+    if (_upload_rotation != DRM_MODE_ROTATE_0) {
+        bool swap = rotation_swaps_axes(_upload_rotation);
+        rotate_nv12(y_address, y_stride, uv_address, uv_stride, buffer_object->vaddr[0],
+                    buffer_object->pitch[0], buffer_object->vaddr[1], buffer_object->pitch[1],
+                    swap ? buffer_object->height : buffer_object->width,
+                    swap ? buffer_object->width : buffer_object->height, _upload_rotation);
+        return;
+    }
+
+    if (_upload_kernel == NULL || _upload_width != buffer_object->width ||
+        _upload_height != buffer_object->height || _upload_y_stride != y_stride ||
+        _upload_uv_stride != uv_stride || _upload_pitch != buffer_object->pitch[0]) {
+        // new stream geometry, the swapchain buffers all share one pitch
+        _upload_kernel = select_nv12_upload(buffer_object->width, buffer_object->height,
+                                            y_stride, uv_stride, buffer_object->pitch[0],
+                                            buffer_object->pitch[1]);
+        _upload_width = buffer_object->width;
+        _upload_height = buffer_object->height;
+        _upload_y_stride = y_stride;
+        _upload_uv_stride = uv_stride;
+        _upload_pitch = buffer_object->pitch[0];
+    }
+    _upload_kernel(y_address, y_stride, uv_address, uv_stride, buffer_object->vaddr[0],
+                   buffer_object->pitch[0], buffer_object->vaddr[1], buffer_object->pitch[1],
+                   buffer_object->width, buffer_object->height);
+}
+
+bool DrmWrapper::show_osd_plane(const uint8_t *address, int32_t width, int32_t height,
+                                int32_t stride) {
+    if (_osd_buffers[0].width != (uint32_t)width || _osd_buffers[0].height != (uint32_t)height) {
+        destroy_buffer_object(&_osd_buffers[0]);
+        destroy_buffer_object(&_osd_buffers[1]);
+        if (!create_argb_buffer_object(&_osd_buffers[0], width, height) ||
+            !create_argb_buffer_object(&_osd_buffers[1], width, height)) {
+            return false;
+        }
+        _osd_buffer_index = -1;
+    }
+
+    // write the buffer that is not on screen, then flip the plane to it
+    int index = _osd_buffer_index == 0 ? 1 : 0;
+    frame_buffer_object &buffer_object = _osd_buffers[index];
+    for (int32_t i = 0; i < height; i++) {
+        memcpy(buffer_object.vaddr[0] + i * buffer_object.pitch[0], address + i * stride,
+               width * 4);
+    }
+    int previous_index = _osd_buffer_index;
+    _osd_buffer_index = index;
+    bool ret = commit_properties(&DrmWrapper::add_osd_plane_properties, "osd plane");
+    if (!ret) {
+        _osd_buffer_index = previous_index;
+    }
+    return ret;
+}
+
+bool DrmWrapper::add_osd_plane_properties(drmModeAtomicReq *request) {
+    if (_osd_buffer_index < 0) {
+        return add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", 0) &&
+               add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0);
+    }
+
+    // place the osd where the video plane shows its frame pixels
+    const frame_buffer_object &buffer_object = _osd_buffers[_osd_buffer_index];
+    uint64_t crtc_x = _osd_x;
+    uint64_t crtc_y = _osd_y;
+    uint64_t crtc_width = buffer_object.width;
+    uint64_t crtc_height = buffer_object.height;
+    const plane_capability *capability = find_plane_capability(_osd_plane_id);
+    if (_video_width > 0 && _video_height > 0) {
+        crtc_x = _video_crtc_x + (int64_t)crtc_x * _video_crtc_width / _video_width;
+        crtc_y = _video_crtc_y + (int64_t)crtc_y * _video_crtc_height / _video_height;
+        if (capability != NULL && capability->can_scale) {
+            crtc_width = crtc_width * _video_crtc_width / _video_width;
+            crtc_height = crtc_height * _video_crtc_height / _video_height;
+        }
+    }
+
+    // clang-format off
+    bool ret =
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer_object.fb_id) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", _crtc_id) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W", (uint64_t)buffer_object.width << 16) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H", (uint64_t)buffer_object.height << 16) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X", crtc_x) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", crtc_y) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W", crtc_width) &&
+        add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H", crtc_height);
+    // clang-format on
+    if (ret && capability != NULL && capability->has_zpos && !capability->zpos_immutable) {
+        ret = add_atomic_property(request, _osd_plane_id, DRM_MODE_OBJECT_PLANE, "zpos",
+                                  capability->zpos_max);
+    }
+    return ret;
+}
+
+void DrmWrapper::blend_osd(frame_buffer_object *buffer_object) {
+    if (!_osd_visible || _osd_plane_id != 0) {
+        return;
+    }
+
+    const nv12a_image *image = &_osd_image;
+    int32_t x = _osd_x;
+    int32_t y = _osd_y;
+    int32_t width = image->width;
+    int32_t height = image->height;
+    if (_upload_rotation != DRM_MODE_ROTATE_0) {
+        if (_osd_image_rotation != _upload_rotation) {
+            bool swap = rotation_swaps_axes(_upload_rotation);
+            nv12a_image &rotated = _osd_rotated_image;
+            rotated.width = swap ? image->height : image->width;
+            rotated.height = swap ? image->width : image->height;
+            rotated.y.resize(image->y.size());
+            rotated.y_alpha.resize(image->y_alpha.size());
+            rotated.uv.resize(image->uv.size());
+            rotated.uv_alpha.resize(image->uv_alpha.size());
+            rotate_nv12(image->y.data(), image->width, image->uv.data(), image->width,
+                        rotated.y.data(), rotated.width, rotated.uv.data(), rotated.width,
+                        image->width, image->height, _upload_rotation);
+            rotate_nv12(image->y_alpha.data(), image->width, image->uv_alpha.data(),
+                        image->width, rotated.y_alpha.data(), rotated.width,
+                        rotated.uv_alpha.data(), rotated.width, image->width, image->height,
+                        _upload_rotation);
+            _osd_image_rotation = _upload_rotation;
+        }
+        bool swap = rotation_swaps_axes(_upload_rotation);
+        rotate_rect(swap ? buffer_object->height : buffer_object->width,
+                    swap ? buffer_object->width : buffer_object->height, _upload_rotation, &x, &y,
+                    &width, &height);
+        image = &_osd_rotated_image;
+    }
+
+    // clip to the frame, every edge stays even so chroma lines up
+    int32_t src_x = 0;
+    int32_t src_y = 0;
+    if (x < 0) {
+        src_x = -x;
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        src_y = -y;
+        height += y;
+        y = 0;
+    }
+    if (x + width > (int32_t)buffer_object->width) {
+        width = buffer_object->width - x;
+    }
+    if (y + height > (int32_t)buffer_object->height) {
+        height = buffer_object->height - y;
+    }
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    blend_nv12a_to_nv12(*image, src_x, src_y, width, height,
+                        buffer_object->vaddr[0] + y * buffer_object->pitch[0] + x,
+                        buffer_object->pitch[0],
+                        buffer_object->vaddr[1] + y / 2 * buffer_object->pitch[1] + x,
+                        buffer_object->pitch[1]);
+}
+
+bool DrmWrapper::add_color_properties(drmModeAtomicReq *request) {
+    for (uint32_t i = 0; i < 3; i++) {
+        if (get_property_id(_crtc_id, DRM_MODE_OBJECT_CRTC, kColorProperties[i]) != 0 &&
+            !add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, kColorProperties[i],
+                                 _color_blob_ids[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DrmWrapper::add_vrr_properties(drmModeAtomicReq *request) {
+    return add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED",
+                               _vrr_enabled);
+}
+
+bool DrmWrapper::commit_properties(bool (DrmWrapper::*add_properties)(drmModeAtomicReq *request),
+                                   const char *name) {
+    if (!_mode_set) {
+        // goes out with the first frame
+        return true;
+    }
+    wait_pending_flip();
+    uint64_t flip_count = _flip_count;
+    drmModeAtomicReq *request = drmModeAtomicAlloc();
+    bool ret = request != NULL && (this->*add_properties)(request);
+    bool batched = ret && _device->is_commit_batching();
+    if (batched) {
+        // a commit of its own could be overtaken by older values queued in the batch. the
+        // change rides along with the next batch, flushed right away
+        _flip_pending = true;
+        if (!_device->queue_commit(request, _crtc_id, &_flip_callback)) {
+            _flip_pending = false;
+            ret = false;
+        }
+    } else if (ret && drmModeAtomicCommit(_fd, request, 0, NULL) != 0) {
+        base::LogError() << name << " commit failed reason:" << strerror(errno);
+        ret = false;
+    }
+    if (request != NULL) {
+        drmModeAtomicFree(request);
+    }
+    if (ret) {
+        // blobs and buffers the caller frees next must be off the screen
+        wait_pending_flip();
+    }
+    if (batched && (!ret || _flip_count == flip_count)) {
+        base::LogError() << name << " commit failed in the batch";
+        ret = false;
+    }
+    return ret;
+}
+
+void DrmWrapper::release_color_blobs() {
+    // a committed blob is referenced by the crtc state, dropping our id is enough
+    for (uint32_t i = 0; i < 3; i++) {
+        if (_color_blob_ids[i] != 0) {
+            drmModeDestroyPropertyBlob(_fd, _color_blob_ids[i]);
+            _color_blob_ids[i] = 0;
+        }
+    }
+    _color_dirty = false;
+}
+
+bool DrmWrapper::set_legacy_gamma(const color_calibration &calibration) {
+    if (!calibration.degamma_lut.empty() || calibration.has_ctm) {
+        base::LogWarn() << "crtc " << _crtc_id
+                        << " has no color management, only gamma is applied";
+    }
+    uint32_t size = _mode_crtc->gamma_size;
+    if (size < 2) {
+        base::LogError() << "crtc " << _crtc_id << " has no gamma ramp";
+        return false;
+    }
+
+    std::vector<drm_color_lut> lut = calibration.gamma_lut;
+    if (lut.empty()) {
+        // identity ramp
+        lut.resize(2);
+        lut[0] = {0, 0, 0, 0};
+        lut[1] = {0xffff, 0xffff, 0xffff, 0};
+    }
+    lut = resample_color_lut(lut, size);
+    std::vector<uint16_t> red(size), green(size), blue(size);
+    for (uint32_t i = 0; i < size; i++) {
+        red[i] = lut[i].red;
+        green[i] = lut[i].green;
+        blue[i] = lut[i].blue;
+    }
+    if (drmModeCrtcSetGamma(_fd, _crtc_id, size, red.data(), green.data(), blue.data()) != 0) {
+        base::LogError() << "drmModeCrtcSetGamma failed reason:" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+uint8_t *DrmWrapper::get_rotation_scratch(int32_t width, int32_t height) {
+    size_t size = (size_t)width * height * 3 / 2;
+    if (_rotation_scratch.size() < size) {
+        _rotation_scratch.resize(size);
+    }
+    return _rotation_scratch.data();
+}
 
-    if (driver_name != nullptr) {
-        str_driver_name = driver_name;
+bool DrmWrapper::draw_rotated_strips(
+    int32_t width, int32_t height,
+    const std::function<void(int32_t row, int32_t rows, uint8_t *y, uint8_t *uv, int32_t pitch)>
+        &convert) {
+    frame_buffer_object *buffer_object = get_back_buffer(width, height);
+    if (buffer_object == NULL) {
+        return false;
     }
-    _fd = drmOpen(str_driver_name.c_str(), NULL);
-    // fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
-    if (_fd < 0) {
-        base::LogError() << "Could not open DRM module " << str_driver_name << "reason: ",
-            strerror(errno);
-        ret = false;
-        goto bail;
+    uint8_t *scratch = get_rotation_scratch(width, kRotationStripRows);
+    for (int32_t row = 0; row < height; row += kRotationStripRows) {
+        int32_t rows = std::min(kRotationStripRows, height - row);
+        convert(row, rows, scratch, scratch + (size_t)width * rows, width);
+        // the strip lands where rotate_nv12 of the whole frame would put its rows
+        int32_t x = 0;
+        int32_t y = row;
+        int32_t rect_width = width;
+        int32_t rect_height = rows;
+        rotate_rect(width, height, _upload_rotation, &x, &y, &rect_width, &rect_height);
+        rotate_nv12(scratch, width, scratch + (size_t)width * rows, width,
+                    buffer_object->vaddr[0] + (size_t)y * buffer_object->pitch[0] + x,
+                    buffer_object->pitch[0],
+                    buffer_object->vaddr[1] + (size_t)y / 2 * buffer_object->pitch[1] + x,
+                    buffer_object->pitch[1], width, rows, _upload_rotation);
     }
+    return present_back_buffer();
+}
 
-    log_drm_version();
-    if (!get_drm_capability()) {
-        ret = false;
-        goto bail;
+bool DrmWrapper::present_back_buffer() {
+    blend_osd(&_buffer_objects[_back_buffer_index]);
+    return present_frame_buffer(_back_buffer_index);
+}
+
+bool DrmWrapper::show_frame_buffer(const frame_buffer_object &buffer_object) {
+    if (_has_atomic) {
+        return commit_frame_buffer(buffer_object, -1, NULL, false);
     }
+    bool retry = false;
+    do {
+        int ret = drmModeSetCrtc(_fd, _crtc_id, buffer_object.fb_id, 0, 0, &_conn_id, 1,
+                                 &_display_mode);
+        int error = errno;
+        if (ret != 0) {
+            base::LogError() << "drmModeSetCrtc failed reason:" << strerror(error);
+        }
+        // only a rejected mode is remembered, not a busy or lost device
+        retry = !_mode_set && (ret == 0 || error == EINVAL || error == ERANGE) &&
+                finish_mode_switch(ret == 0);
+        if (ret == 0) {
+            if (!_mode_set) {
+                _device->invalidate_objects();
+                _device->set_crtc_mode(_crtc_id, _display_mode);
+            }
+            _mode_set = true;
+            return true;
+        }
+    } while (retry);
+    return false;
+}
 
-    _mode_res = drmModeGetResources(_fd);
-    if (_mode_res == NULL) {
-        base::LogError() << "drmModeGetResources failed:" << strerror(errno);
-        ret = false;
-        goto bail;
+uint32_t DrmWrapper::get_property_id(uint32_t object_id, uint32_t object_type, const char *name) {
+    std::pair<uint32_t, std::string> key(object_id, name);
+    auto iter = _property_ids.find(key);
+    if (iter != _property_ids.end()) {
+        return iter->second;
     }
+    uint32_t property_id = drm_get_property_id(_fd, object_id, object_type, name);
+    _property_ids[key] = property_id;
+    return property_id;
+}
 
-    if (_conn_id == -1) {
-        _conn = find_main_monitor(_fd, _mode_res);
-    } else {
-        _conn = drmModeGetConnector(_fd, _conn_id);
+bool DrmWrapper::add_atomic_property(drmModeAtomicReq *request, uint32_t object_id,
+                                     uint32_t object_type, const char *name, uint64_t value) {
+    uint32_t property_id = get_property_id(object_id, object_type, name);
+    if (property_id == 0) {
+        base::LogError() << "object " << object_id << " has no property " << name;
+        return false;
     }
-    if (_conn == NULL) {
-        ret = false;
-        base::LogError() << "Could not find a valid monitor connector";
-        goto bail;
+    if (drmModeAtomicAddProperty(request, object_id, property_id, value) < 0) {
+        base::LogError() << "drmModeAtomicAddProperty " << name << " failed";
+        return false;
     }
+    return true;
+}
 
-    _mode_crtc = find_crtc_for_connector(_fd, _mode_res, _conn, &_pipe);
-    if (_mode_crtc == NULL) {
-        ret = false;
-        base::LogError() << "Could not find a crtc for connector";
-        goto bail;
+bool DrmWrapper::commit_frame_buffer(const frame_buffer_object &buffer_object, int in_fence_fd,
+                                     int *out_fence_fd, bool nonblock) {
+    bool ret = false;
+    bool retry = false;
+    drmModeModeInfo crtc_mode;
+    if (_mode_set && !_device->get_crtc_mode(_crtc_id, &crtc_mode)) {
+        // a wrapper that left the crtc turned it off with the primary plane
+        base::LogWarn() << "crtc " << _crtc_id << " was turned off, setting the mode again";
+        _mode_set = false;
     }
+    do {
+        bool mode_switch = !_mode_set;
+        ret = try_commit_frame_buffer(buffer_object, in_fence_fd, out_fence_fd, nonblock);
+        int error = errno;
+        // only a rejected mode is remembered, not a busy or lost device
+        retry = mode_switch && (ret || error == EINVAL || error == ERANGE) &&
+                finish_mode_switch(ret);
+    } while (retry);
+    return ret;
+}
 
-    if (!_mode_crtc->mode_valid || _modesetting_enabled) {
-        base::LogDebug() << "enabling modesetting";
-        _modesetting_enabled = true;
-        universal_planes = true;
+bool DrmWrapper::try_commit_frame_buffer(const frame_buffer_object &buffer_object,
+                                         int in_fence_fd, int *out_fence_fd, bool nonblock) {
+    // a second nonblocking commit before the flip would fail with EBUSY
+    wait_pending_flip();
+    if (!_mode_set) {
+        adopt_crtc_mode();
     }
 
-retry_find_plane:
-    if (universal_planes && drmSetClientCap(_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)) {
-        base::LogError() << "Could not set universal planes capability bit";
-        ret = false;
-        goto bail;
+    // only plain frame updates join a batch, a mode set has to succeed before the next
+    // frame, blobs and buffers freed after the commit must not be used by a later one
+    // and a fence fd may be closed before the batch goes out. submit offers the commit to
+    // the batch with _batched_index
+    bool batched = nonblock && _batched_index >= 0 && _mode_set && in_fence_fd < 0 &&
+                   !_color_dirty && _device->is_commit_batching();
+    for (const auto &layer : _layers) {
+        batched &= !layer.second.destroyed;
+    }
+    if (!batched) {
+        _batched_index = -1;
     }
 
-    _mode_plane_res = drmModeGetPlaneResources(_fd);
-    if (_mode_plane_res == NULL) {
-        //TODO(anxs) need or not need set ret?
-        ret = false;
-        base::LogError() << "drmModeGetPlaneResources failed reason:" << strerror(errno);
-        goto bail;
+    uint32_t flags = 0;
+    if (!_mode_set && _mode_blob_id == 0) {
+        int ret = drmModeCreatePropertyBlob(_fd, &_display_mode, sizeof(_display_mode),
+                                            &_mode_blob_id);
+        if (ret != 0) {
+            base::LogError() << "drmModeCreatePropertyBlob failed reason:" << strerror(errno);
+            return false;
+        }
     }
 
-    if (_plane_id == -1) {
-        _mode_plane = find_plane_for_crtc(_fd, _mode_res, _mode_plane_res, _mode_crtc->crtc_id);
-    } else {
-        _mode_plane = drmModeGetPlane(_fd, _plane_id);
+    // scale to full screen, or the size set_video_position asked for, when the plane can,
+    // otherwise show the frame 1:1
+    uint32_t crtc_width = buffer_object.width;
+    uint32_t crtc_height = buffer_object.height;
+    if (rotation_swaps_axes(_rotation)) {
+        crtc_width = buffer_object.height;
+        crtc_height = buffer_object.width;
     }
-    if (_mode_plane == NULL) {
-        ret = false;
-        if (universal_planes) {
-            base::LogError() << "Could not find a plane for crtc";
-            goto bail;
-        } else {
-            universal_planes = true;
-            goto retry_find_plane;
+    int32_t crtc_x = 0;
+    int32_t crtc_y = 0;
+    const plane_capability *capability = find_plane_capability(_plane_id);
+    if (_video_dst_width > 0) {
+        crtc_x = _video_dst_x;
+        crtc_y = _video_dst_y;
+        if (capability != NULL && capability->can_scale) {
+            crtc_width = _video_dst_width;
+            crtc_height = _video_dst_height;
         }
+    } else if (capability != NULL && capability->can_scale) {
+        crtc_width = _hdisplay;
+        crtc_height = _vdisplay;
     }
 
-    _conn_id = _conn->connector_id;
-    _crtc_id = _mode_crtc->crtc_id;
-    _plane_id = _mode_plane->plane_id;
+    int32_t out_fence = -1;
+    drmModeAtomicReq *request = drmModeAtomicAlloc();
+    bool ret = request != NULL;
+    if (ret && !_mode_set) {
+        ret = add_atomic_property(request, _conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+                                  _crtc_id) &&
+              add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID",
+                                  _mode_blob_id) &&
+              add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    // clang-format off
+    ret = ret &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer_object.fb_id) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", _crtc_id) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W", (uint64_t)buffer_object.width << 16) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H", (uint64_t)buffer_object.height << 16) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X", (uint64_t)(int64_t)crtc_x) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", (uint64_t)(int64_t)crtc_y) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W", crtc_width) &&
+          add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H", crtc_height);
+    // clang-format on
+    if (ret && _video_zpos >= 0 && capability != NULL && capability->has_zpos &&
+        !capability->zpos_immutable) {
+        ret = add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "zpos",
+                                  (uint64_t)_video_zpos);
+    }
+    if (ret && _osd_plane_id != 0) {
+        ret = add_osd_plane_properties(request);
+    }
+    if (ret && !_layers.empty()) {
+        ret = add_layer_properties(request);
+    }
+    if (ret && _color_dirty) {
+        ret = add_color_properties(request);
+    }
+    if (ret && _vrr_dirty) {
+        ret = add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED",
+                                  _vrr_enabled);
+    }
+    if (ret && get_property_id(_plane_id, DRM_MODE_OBJECT_PLANE, "rotation") != 0) {
+        ret = add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "rotation",
+                                  _rotation);
+    }
+    if (ret && in_fence_fd >= 0) {
+        ret = add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD",
+                                  (uint64_t)in_fence_fd);
+    }
+    if (ret && out_fence_fd != NULL && !batched) {
+        ret = add_atomic_property(request, _crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR",
+                                  (uint64_t)(uintptr_t)&out_fence);
+    }
+    if (nonblock) {
+        flags |= DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    }
+    int error = 0;
+    if (ret && batched) {
+        // set before queueing, a failed flush reports back through flip_done right away
+        _flip_pending = true;
+        if (!_device->queue_commit(request, _crtc_id, &_flip_callback)) {
+            error = EIO;
+            _flip_pending = false;
+            ret = false;
+        }
+    } else if (ret && drmModeAtomicCommit(_fd, request, flags, &_flip_callback) != 0) {
+        error = errno;
+        base::LogError() << "drmModeAtomicCommit failed reason:" << strerror(error);
+        ret = false;
+    }
+    if (request != NULL) {
+        drmModeAtomicFree(request);
+    }
+    if (!ret) {
+        errno = error;
+        return false;
+    }
 
-    base::LogDebug() << "connector id = " << _conn_id << " / crtc id = " << _crtc_id
-                     << " / plane id = " << _plane_id;
+    if (!_mode_set) {
+        // the connector, encoder and crtc state the cache read is gone
+        _device->invalidate_objects();
+        _device->set_crtc_mode(_crtc_id, _display_mode);
+    }
+    _mode_set = true;
+    if (!batched) {
+        _flip_pending = nonblock;
+    }
+    _vrr_dirty = false;
+    finish_layer_commit();
+    if (_color_dirty) {
+        release_color_blobs();
+    }
+    _video_width = buffer_object.width;
+    _video_height = buffer_object.height;
+    _video_crtc_width = crtc_width;
+    _video_crtc_height = crtc_height;
+    _video_crtc_x = crtc_x;
+    _video_crtc_y = crtc_y;
+    if (out_fence_fd != NULL) {
+        *out_fence_fd = out_fence;
+    }
+    return true;
+}
 
-    _hdisplay = _mode_crtc->mode.hdisplay;
-    _vdisplay = _mode_crtc->mode.vdisplay;
+void DrmWrapper::retire_front_buffer(int index, int release_fence_fd) {
+    if (_front_buffer_index >= 0 && _front_buffer_index != index) {
+        if (_release_fences[_front_buffer_index] >= 0) {
+            ::close(_release_fences[_front_buffer_index]);
+        }
+        _release_fences[_front_buffer_index] = release_fence_fd;
+    } else if (release_fence_fd >= 0) {
+        ::close(release_fence_fd);
+    }
+    _front_buffer_index = index;
+    if (index >= 0) {
+        _buffer_acquired[index] = false;
+        set_displayed_import(0);
+    }
+}
 
-    _buffer_id = _mode_crtc->buffer_id;
+void DrmWrapper::set_displayed_import(uint32_t fb_id) {
+    uint32_t previous_fb_id = _displayed_import_fb_id;
+    bool released = _displayed_import_released;
+    _displayed_import_fb_id = fb_id;
+    _displayed_import_released = false;
+    if (previous_fb_id != 0 && previous_fb_id != fb_id && released) {
+        release_imported_frame(previous_fb_id);
+    } else if (previous_fb_id == fb_id) {
+        _displayed_import_released = released;
+    }
+}
 
-    _mm_width = _conn->mmWidth;
-    _mm_height = _conn->mmHeight;
+void DrmWrapper::wait_pending_flip() {
+    if (_flip_pending) {
+        // a queued commit only flips once its batch is committed
+        _device->flush_commits();
+    }
+    // the event may be read by another wrapper on the device, poll in short slices
+    uint64_t start_ns = monotonic_ns();
+    while (_flip_pending) {
+        if (!handle_events(kFlipPollMs) && _flip_pending &&
+            monotonic_ns() - start_ns > kFlipTimeoutNs) {
+            base::LogWarn() << "page flip event did not arrive";
+            _flip_pending = false;
+        }
+    }
+}
 
-    base::LogDebug() << "display size: pixels = " << _hdisplay << "x" << _vdisplay
-                     << " / millimeters = " << _mm_width << "x" << _mm_height;
-    ret = true;
+bool DrmWrapper::disable_planes() {
+    if (!_has_atomic) {
+        return false;
+    }
+    wait_pending_flip();
+    drmModeAtomicReq *request = drmModeAtomicAlloc();
+    bool ret = request != NULL &&
+               add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", 0) &&
+               add_atomic_property(request, _plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0);
+    for (const auto &layer : _layers) {
+        uint32_t plane_id = layer.second.plane_id;
+        ret = ret && add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", 0);
+    }
+    if (ret && drmModeAtomicCommit(_fd, request, 0, NULL) != 0) {
+        // some drivers need the primary plane while the crtc is on
+        base::LogWarn() << "disable planes failed reason:" << strerror(errno);
+        ret = false;
+    }
+    if (request != NULL) {
+        drmModeAtomicFree(request);
+    }
     return ret;
-bail:
-    if (_mode_plane != NULL) {
-        drmModeFreePlane(_mode_plane);
+}
+
+void DrmWrapper::flip_done(void *context, uint32_t crtc_id, bool flipped,
+                           uint64_t timestamp_us) {
+    DrmWrapper *wrapper = (DrmWrapper *)context;
+    wrapper->_flip_pending = false;
+    if (flipped) {
+        wrapper->_flip_count++;
+        wrapper->_last_flip_us = timestamp_us;
+    }
+    int index = wrapper->_batched_index;
+    if (index < 0) {
+        return;
     }
-    if (_mode_plane_res != NULL) {
-        drmModeFreePlaneResources(_mode_plane_res);
+    wrapper->_batched_index = -1;
+    if (flipped) {
+        wrapper->retire_front_buffer(index, -1);
+    } else {
+        wrapper->_buffer_acquired[index] = false;
     }
-    if (_mode_crtc != NULL) {
-        drmModeFreeCrtc(_mode_crtc);
+}
+
+bool DrmWrapper::start_render_thread(const render_thread_config &config) {
+    if (_fd < 0 || _render_thread_running) {
+        base::LogError() << "render thread needs an open device and must not be running";
+        return false;
     }
-    if (_conn != NULL) {
-        drmModeFreeConnector(_conn);
+    if (config.lock_memory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            base::LogWarn() << "mlockall failed reason:" << strerror(errno);
+        }
+        _lock_frame_buffers = true;
     }
-    if (_mode_res != NULL) {
-        drmModeFreeResources(_mode_res);
+
+    _render_config = config;
+    // queue_frame takes frames once this is set, the thread finds them when it starts
+    pthread_mutex_lock(&_render_mutex);
+    memset(&_render_stats, 0, sizeof(_render_stats));
+    _render_thread_quit = false;
+    _render_thread_running = true;
+    pthread_mutex_unlock(&_render_mutex);
+    int err = pthread_create(&_render_thread, NULL, render_thread_main, this);
+    if (err != 0) {
+        base::LogError() << "create render thread failed reason:" << strerror(err);
+        pthread_mutex_lock(&_render_mutex);
+        _render_thread_running = false;
+        for (const queued_frame &queued : _render_queue) {
+            if (queued.frame.pool != nullptr) {
+                queued.frame.pool->release((uint8_t *)queued.frame.address);
+            }
+        }
+        _render_queue.clear();
+        pthread_mutex_unlock(&_render_mutex);
+        return false;
     }
+    return true;
+}
 
-    if (!ret && _fd >= 0) {
-        drmClose(_fd);
-        _fd = -1;
+bool DrmWrapper::queue_frame(const render_frame &frame) {
+    queued_frame queued = {frame, monotonic_ns()};
+    pthread_mutex_lock(&_render_mutex);
+    bool ret = _render_thread_running && _render_queue.size() < kSwapchainSize;
+    if (ret) {
+        _render_queue.push_back(queued);
+        pthread_cond_signal(&_render_cond);
+    } else {
+        _render_stats.dropped++;
     }
+    pthread_mutex_unlock(&_render_mutex);
 
+    if (!ret && frame.pool != nullptr) {
+        frame.pool->release((uint8_t *)frame.address);
+    }
     return ret;
 }
 
-bool DrmWrapper::draw_nv12_frame(uint8_t *address, int32_t width, int32_t height, int32_t stride) {
-    if (!_init_nv12_frame_buffer_object) {
-        bool ret = create_nv12_frame_buffer_object(width, height);
-        if (!ret) {
-            return false;
+render_stats DrmWrapper::get_render_stats() {
+    pthread_mutex_lock(&_render_mutex);
+    render_stats stats = _render_stats;
+    pthread_mutex_unlock(&_render_mutex);
+    return stats;
+}
+
+void DrmWrapper::stop_render_thread() {
+    if (!_render_thread_running) {
+        return;
+    }
+    pthread_mutex_lock(&_render_mutex);
+    _render_thread_quit = true;
+    pthread_cond_signal(&_render_cond);
+    pthread_mutex_unlock(&_render_mutex);
+    pthread_join(_render_thread, NULL);
+
+    pthread_mutex_lock(&_render_mutex);
+    _render_thread_running = false;
+    for (const queued_frame &queued : _render_queue) {
+        if (queued.frame.pool != nullptr) {
+            queued.frame.pool->release((uint8_t *)queued.frame.address);
         }
     }
+    _render_queue.clear();
+    pthread_mutex_unlock(&_render_mutex);
+}
 
-    if (width == stride) {
-        memcpy(_buffer_object.vaddr[0], address, _buffer_object.width * _buffer_object.height);
-        memcpy(_buffer_object.vaddr[1], address + _buffer_object.width * _buffer_object.height,
-               _buffer_object.width * _buffer_object.height / 2);
-    } else {
-        // copy Y buffer
-        uint8_t *vaddr = _buffer_object.vaddr[0];
-        for (uint32_t i = 0; i < _buffer_object.height; i++) {
-            memcpy(vaddr, address + i * stride, _buffer_object.width);
-            vaddr += _buffer_object.pitch[0];
+void *DrmWrapper::render_thread_main(void *user_data) {
+    DrmWrapper *wrapper = (DrmWrapper *)user_data;
+    wrapper->render_loop();
+    return NULL;
+}
+
+void DrmWrapper::render_loop() {
+    uint64_t period_ns = 16666667;
+    if (_display_mode.clock > 0) {
+        period_ns = (uint64_t)_display_mode.htotal * _display_mode.vtotal * 1000000 /
+                    _display_mode.clock;
+    }
+    int policy = SCHED_OTHER;
+    int priority = 0;
+    apply_render_thread_config(_render_config, period_ns, &policy, &priority);
+
+    pthread_mutex_lock(&_render_mutex);
+    _render_stats.policy = policy;
+    _render_stats.priority = priority;
+    pthread_mutex_unlock(&_render_mutex);
+    base::LogDebug() << "render thread running with policy " << policy << " priority "
+                     << priority << " / refresh period " << period_ns << " ns";
+
+    uint64_t last_present_ns = 0;
+    for (;;) {
+        pthread_mutex_lock(&_render_mutex);
+        bool idle = false;
+        while (_render_queue.empty() && !_render_thread_quit) {
+            pthread_cond_wait(&_render_cond, &_render_mutex);
+            idle = true;
         }
-        // copy uv buffer
-        vaddr = _buffer_object.vaddr[1];
-        address = address + _buffer_object.width * _buffer_object.height;
-        for (uint32_t i = 0; i < _buffer_object.height / 2; i++) {
-            memcpy(vaddr, address + i * stride, _buffer_object.width);
-            vaddr += _buffer_object.pitch[1];
+        if (_render_thread_quit) {
+            pthread_mutex_unlock(&_render_mutex);
+            break;
         }
-    }
+        queued_frame queued = _render_queue.front();
+        _render_queue.pop_front();
+        if (idle) {
+            // the frame woke the thread, the time until it ran is scheduling delay
+            uint64_t wake_us = (monotonic_ns() - queued.queue_time_ns) / 1000;
+            if (wake_us > _render_stats.max_wake_us) {
+                _render_stats.max_wake_us = wake_us;
+            }
+        }
+        // a variable refresh display flips when the commit arrives, the period is only the
+        // shortest
+        bool variable_refresh = _vrr_enabled;
+        pthread_mutex_unlock(&_render_mutex);
+
+        const render_frame &frame = queued.frame;
+        uint64_t wake_ns = 0;
+        if (frame.present_time_ns > 0) {
+            // commit during the refresh before the target so the flip lands on it, with
+            // variable refresh commit at the target itself
+            wake_ns = frame.present_time_ns;
+            if (!variable_refresh) {
+                wake_ns = wake_ns > period_ns ? wake_ns - period_ns : 0;
+            }
+        }
+        if (variable_refresh) {
+            // the window of the next flip starts with the flip of the last frame
+            pthread_mutex_lock(&_draw_mutex);
+            wait_pending_flip();
+            wake_ns = get_variable_refresh_time(wake_ns);
+            pthread_mutex_unlock(&_draw_mutex);
+        }
+        if (wake_ns > 0) {
+            sleep_until_ns(wake_ns);
+        }
+        pthread_mutex_lock(&_draw_mutex);
+        bool shown = draw_nv12_frame(frame.address, frame.width, frame.height, frame.stride);
+        pthread_mutex_unlock(&_draw_mutex);
+        uint64_t present_ns = monotonic_ns();
+        if (frame.pool != nullptr) {
+            frame.pool->release((uint8_t *)frame.address);
+        }
+
+        // late against the requested time, or a vblank later than the frame was ready for
+        uint64_t late_ns = 0;
+        if (frame.present_time_ns > 0 && present_ns > frame.present_time_ns + period_ns / 2) {
+            late_ns = present_ns - frame.present_time_ns;
+        } else if (frame.present_time_ns == 0 && last_present_ns > 0 &&
+                   queued.queue_time_ns < last_present_ns &&
+                   present_ns > last_present_ns + period_ns * 3 / 2) {
+            late_ns = present_ns - last_present_ns - period_ns;
+        }
+        last_present_ns = present_ns;
 
-    drmModeSetCrtc(_fd, _crtc_id, _buffer_object.fb_id, 0, 0, &_conn_id, 1, &_conn->modes[0]);
+        struct rusage usage = {};
+        getrusage(RUSAGE_THREAD, &usage);
 
-    return true;
+        pthread_mutex_lock(&_render_mutex);
+        if (shown) {
+            _render_stats.frames++;
+        }
+        if (late_ns > 0) {
+            _render_stats.deadline_misses++;
+            if (late_ns / 1000 > _render_stats.max_late_us) {
+                _render_stats.max_late_us = late_ns / 1000;
+            }
+        }
+        _render_stats.preemptions = usage.ru_nivcsw;
+        pthread_mutex_unlock(&_render_mutex);
+    }
 }
 
 void DrmWrapper::close() {
     if (_fd < 0) {
         return;
     }
-    if (_mode_plane != NULL) {
-        drmModeFreePlane(_mode_plane);
-    }
-    if (_mode_plane_res != NULL) {
-        drmModeFreePlaneResources(_mode_plane_res);
+    stop_render_thread();
+    wait_pending_flip();
+    clear_osd();
+    _osd_plane_failed = false;
+    // removing a frame buffer the primary plane scans out turns the whole crtc off, take the
+    // planes of this wrapper off first so the other wrappers on the crtc keep showing theirs
+    const plane_capability *capability = find_plane_capability(_plane_id);
+    bool crtc_disabled = _mode_set && !disable_planes() && capability != NULL &&
+                         capability->type == DRM_PLANE_TYPE_PRIMARY;
+    for (auto &layer : _layers) {
+        for (uint32_t i = 0; i < 2; i++) {
+            destroy_buffer_object(&layer.second.buffers[i]);
+        }
     }
-    if (_mode_crtc != NULL) {
-        drmModeFreeCrtc(_mode_crtc);
+    _layers.clear();
+    release_color_blobs();
+    free_frame_buffer_object();
+    // the device is closed, nothing stays on screen
+    _displayed_import_fb_id = 0;
+    _displayed_import_released = false;
+    while (!_imported_frames.empty()) {
+        release_imported_frame(_imported_frames.begin()->first);
     }
-    if (_conn != NULL) {
-        drmModeFreeConnector(_conn);
+    if (_mode_blob_id != 0) {
+        drmModeDestroyPropertyBlob(_fd, _mode_blob_id);
+        _mode_blob_id = 0;
     }
-    if (_mode_res != NULL) {
-        drmModeFreeResources(_mode_res);
+    _mode_set = false;
+    _mode_candidates.clear();
+    _display_key.clear();
+    _vrr_capable = false;
+    _vrr_enabled = false;
+    _vrr_dirty = false;
+    _property_ids.clear();
+    for (uint32_t plane_id : _assigned_planes) {
+        _device->release_plane(plane_id);
     }
-    ::close(_fd);
+    _assigned_planes.clear();
+    _mode_plane.reset();
+    _mode_crtc.reset();
+    _conn.reset();
+    _device->invalidate_objects();
+    _device->detach_crtc(_crtc_id, crtc_disabled);
+    _device->remove_submitter(&_flip_callback);
+    _device->release();
+    _device = NULL;
     _fd = -1;
 }
 
 DrmWrapper::DrmWrapper() {
+    _device = NULL;
     _fd = -1;
-    _mode_res = NULL;
     _conn_id = -1;
-    _conn = NULL;
-    _mode_crtc = NULL;
-    _mode_plane_res = NULL;
-    _mode_plane = NULL;
 
     _plane_id = -1;
 
+    _has_prime_import = false;
+    _has_prime_export = false;
+    _has_addfb2_modifiers = false;
+    _has_atomic = false;
+    _modesetting_enabled = false;
+
+    memset(&_display_mode, 0, sizeof(_display_mode));
+    _mode_blob_id = 0;
+    _mode_set = false;
+    _flip_pending = false;
+    _flip_callback.handler = flip_done;
+    _flip_callback.context = this;
+    _flip_count = 0;
+    _removed_frame_buffers = 0;
+    _last_flip_us = 0;
+    _mode_cache_path = kModeCachePath;
+
+    _vrr_capable = false;
+    _vrr_enabled = false;
+    _vrr_dirty = false;
+    _vrr_min_hz = 0;
+    _vrr_max_hz = 0;
+
+    _beam_racing_slices = 0;
+    _beam_racing_late_slices = 0;
+
     _init_nv12_frame_buffer_object = false;
+    _lock_frame_buffers = false;
+    _rotation = DRM_MODE_ROTATE_0;
+    _upload_rotation = DRM_MODE_ROTATE_0;
+    _upload_kernel = NULL;
+    _upload_width = 0;
+    _upload_height = 0;
+    _upload_y_stride = 0;
+    _upload_uv_stride = 0;
+    _upload_pitch = 0;
+
+    _video_width = 0;
+    _video_height = 0;
+    _video_crtc_width = 0;
+    _video_crtc_height = 0;
+    _video_crtc_x = 0;
+    _video_crtc_y = 0;
+    _video_dst_x = 0;
+    _video_dst_y = 0;
+    _video_dst_width = 0;
+    _video_dst_height = 0;
+    _video_zpos = -1;
+    _osd_visible = false;
+    _osd_x = 0;
+    _osd_y = 0;
+    _osd_plane_id = 0;
+    _osd_plane_failed = false;
+    memset(_osd_buffers, 0, sizeof(_osd_buffers));
+    _osd_buffer_index = -1;
+    _osd_image_rotation = 0;
+
+    memset(_color_blob_ids, 0, sizeof(_color_blob_ids));
+    _color_dirty = false;
+
+    memset(_buffer_objects, 0, sizeof(_buffer_objects));
+    _back_buffer_index = 0;
+    _front_buffer_index = -1;
+    _batched_index = -1;
+    _displayed_import_fb_id = 0;
+    _displayed_import_released = false;
+    for (uint32_t i = 0; i < kSwapchainSize; i++) {
+        _release_fences[i] = -1;
+        _buffer_acquired[i] = false;
+    }
+
+    _render_thread_running = false;
+    _render_thread_quit = false;
+    render_thread_config_init(&_render_config);
+    memset(&_render_stats, 0, sizeof(_render_stats));
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&_render_mutex, &mutex_attr);
+    pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_draw_mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_cond_init(&_render_cond, NULL);
+
 }
 
 DrmWrapper::~DrmWrapper() {
     close();
+    pthread_cond_destroy(&_render_cond);
+    pthread_mutex_destroy(&_render_mutex);
+    pthread_mutex_destroy(&_draw_mutex);
 }
 
-void DrmWrapper::log_drm_version() {
-    drmVersion *version = NULL;
-
-    version = drmGetVersion(_fd);
-    if (version != NULL) {
-        base::LogInfo() << "DRM v" << version->version_major << "." << version->version_minor << "."
-                        << version->version_patchlevel << " [" << version->name << " - "
-                        << version->desc << " - " << version->date << "]";
-        drmFreeVersion(version);
-    } else {
-        base::LogError() << "could not get driver information";
-    }
-}
-
-bool DrmWrapper::get_drm_capability() {
-    uint64_t has_dumb_buffer = 0;
-    int ret = drmGetCap(_fd, DRM_CAP_DUMB_BUFFER, &has_dumb_buffer);
-    if (ret != 0) {
-        base::LogWarn() << "could not get dumb buffer capability";
-    }
-    if (has_dumb_buffer == 0) {
-        base::LogError() << "driver cannot handle dumb buffers";
-        return false;
-    }
-
-    uint64_t has_prime = 0;
-    ret = drmGetCap(_fd, DRM_CAP_PRIME, &has_prime);
-    if (ret != 0) {
-        base::LogWarn() << "could not get prime capability";
-    } else {
-        _has_prime_import = (has_prime & DRM_PRIME_CAP_IMPORT);
-        _has_prime_export = (has_prime & DRM_PRIME_CAP_EXPORT);
-    }
-
-    uint64_t has_async_page_flip = 0;
-    ret = drmGetCap(_fd, DRM_CAP_ASYNC_PAGE_FLIP, &has_async_page_flip);
-    if (ret != 0) {
-        base::LogWarn() << "could not get async page flip capability";
-    } else {
-        _has_async_page_flip = has_async_page_flip;
+bool DrmWrapper::create_nv12_frame_buffer_object(int32_t width, int32_t height) {
+    memset(_buffer_objects, 0, sizeof(_buffer_objects));
+    for (uint32_t i = 0; i < kSwapchainSize; i++) {
+        if (!create_nv12_buffer_object(&_buffer_objects[i], width, height)) {
+            // let free_frame_buffer_object release the buffers created so far
+            _init_nv12_frame_buffer_object = true;
+            free_frame_buffer_object();
+            return false;
+        }
     }
 
-    // clang-format off
-    base::LogDebug() << "prime import ("  << (_has_prime_import ? "✓" : "✗")
-                     << ") / prime export (" << (_has_prime_export ? "✓": "✗")
-                     << ") / async page flip (" << (_has_async_page_flip ? "✓" : "✗")
-                     << ")";
-    // clang-format on
+    _back_buffer_index = 0;
+    _front_buffer_index = -1;
+    _init_nv12_frame_buffer_object = true;
     return true;
 }
 
-bool DrmWrapper::create_nv12_frame_buffer_object(int32_t width, int32_t height) {
+bool DrmWrapper::create_nv12_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                                           int32_t height) {
     uint32_t pixel_format = DRM_FORMAT_NV12;
 
-    _buffer_object.width = width;
-    _buffer_object.height = height;
+    buffer_object->width = width;
+    buffer_object->height = height;
 
     struct drm_mode_create_dumb create = {};
     ///< Y buffer
@@ -292,9 +2327,9 @@ bool DrmWrapper::create_nv12_frame_buffer_object(int32_t width, int32_t height)
         return false;
     }
 
-    _buffer_object.pitch[0] = create.pitch;
-    _buffer_object.size[0] = create.size;
-    _buffer_object.handle[0] = create.handle;
+    buffer_object->pitch[0] = create.pitch;
+    buffer_object->size[0] = create.size;
+    buffer_object->handle[0] = create.handle;
     base::LogDebug() << "drm ioctl create Y dump pitch:" << create.pitch << ", size:" << create.size
                      << ",handle:" << create.handle;
 
@@ -309,9 +2344,9 @@ bool DrmWrapper::create_nv12_frame_buffer_object(int32_t width, int32_t height)
         return false;
     }
 
-    _buffer_object.pitch[1] = create.pitch;
-    _buffer_object.size[1] = create.size;
-    _buffer_object.handle[1] = create.handle;
+    buffer_object->pitch[1] = create.pitch;
+    buffer_object->size[1] = create.size;
+    buffer_object->handle[1] = create.handle;
 
     uint32_t bo_handles[4] = {
         0,
@@ -323,182 +2358,233 @@ bool DrmWrapper::create_nv12_frame_buffer_object(int32_t width, int32_t height)
         0,
     };
 
-    bo_handles[0] = _buffer_object.handle[0];
-    bo_handles[1] = _buffer_object.handle[1];
-    pitches[0] = _buffer_object.pitch[0];
-    pitches[1] = _buffer_object.pitch[1];
+    bo_handles[0] = buffer_object->handle[0];
+    bo_handles[1] = buffer_object->handle[1];
+    pitches[0] = buffer_object->pitch[0];
+    pitches[1] = buffer_object->pitch[1];
     offsets[0] = 0;
     offsets[1] = 0;
 
-    ret = drmModeAddFB2(_fd, create.width, create.height, pixel_format, bo_handles, pitches,
-                        offsets, &_buffer_object.fb_id, 0);
+    ret = add_frame_buffer(create.width, create.height, pixel_format, DRM_FORMAT_MOD_LINEAR,
+                           bo_handles, pitches, offsets, &buffer_object->fb_id);
 
     if (ret) {
         base::LogError() << "drmModeAddFB2 failed " << ret;
         return false;
     }
-    base::LogDebug() << "success add fb, fb_id:" << _buffer_object.fb_id;
+    base::LogDebug() << "success add fb, fb_id:" << buffer_object->fb_id;
+
+    ///< Y buffer
+    buffer_object->vaddr[0] = map_dumb_buffer(buffer_object->handle[0], buffer_object->size[0]);
+    ///< UV buffer
+    buffer_object->vaddr[1] = map_dumb_buffer(buffer_object->handle[1], buffer_object->size[1]);
+    if (buffer_object->vaddr[0] == NULL || buffer_object->vaddr[1] == NULL) {
+        return false;
+    }
+    return true;
+}
 
+uint8_t *DrmWrapper::map_dumb_buffer(uint32_t handle, uint32_t size) {
     struct drm_mode_map_dumb map = {};
-    map.handle = _buffer_object.handle[0];
-    drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+    map.handle = handle;
+    if (drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &map) != 0) {
+        base::LogError() << "drmIoctl DRM_IOCTL_MODE_MAP_DUMB failed reason:" << strerror(errno);
+        return NULL;
+    }
 
-    ///< Y buffer
-    _buffer_object.vaddr[0] = (uint8_t *)mmap(0, _buffer_object.size[0], PROT_READ | PROT_WRITE,
-                                              MAP_SHARED, _fd, map.offset);
+    // fault every page in now instead of on the first frames written into it
+    void *vaddr =
+        mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, map.offset);
+    if (vaddr == MAP_FAILED) {
+        base::LogError() << "mmap dumb buffer failed reason:" << strerror(errno);
+        return NULL;
+    }
+    if (_lock_frame_buffers && mlock(vaddr, size) != 0) {
+        base::LogWarn() << "mlock dumb buffer failed reason:" << strerror(errno);
+    }
+    return (uint8_t *)vaddr;
+}
 
-    ///< UV buffer
-    map.handle = _buffer_object.handle[1];
-    drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
-    _buffer_object.vaddr[1] = (uint8_t *)mmap(0, _buffer_object.size[1], PROT_READ | PROT_WRITE,
-                                              MAP_SHARED, _fd, map.offset);
+bool DrmWrapper::create_argb_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                                           int32_t height) {
+    memset(buffer_object, 0, sizeof(*buffer_object));
+    buffer_object->width = width;
+    buffer_object->height = height;
 
-    _init_nv12_frame_buffer_object = true;
+    struct drm_mode_create_dumb create = {};
+    create.width = width;
+    create.height = height;
+    create.bpp = 32;
+    int ret = drmIoctl(_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+    if (ret != 0) {
+        base::LogError() << "drmIoctl DRM_IOCTL_MODE_CREATE_DUMB create argb dumb failed " << ret;
+        return false;
+    }
+    buffer_object->pitch[0] = create.pitch;
+    buffer_object->size[0] = create.size;
+    buffer_object->handle[0] = create.handle;
+
+    uint32_t bo_handles[4] = {create.handle, 0, 0, 0};
+    uint32_t pitches[4] = {create.pitch, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    ret = add_frame_buffer(width, height, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR, bo_handles,
+                           pitches, offsets, &buffer_object->fb_id);
+    if (ret != 0) {
+        base::LogError() << "drmModeAddFB2 argb failed " << ret;
+        destroy_buffer_object(buffer_object);
+        return false;
+    }
+
+    buffer_object->vaddr[0] = map_dumb_buffer(create.handle, create.size);
+    if (buffer_object->vaddr[0] == NULL) {
+        destroy_buffer_object(buffer_object);
+        return false;
+    }
     return true;
 }
 
-void DrmWrapper::free_frame_buffer_object() {
-    if (!_init_nv12_frame_buffer_object) {
-        base::LogDebug() << "not need free frame buffer object";
-        return;
+void DrmWrapper::destroy_buffer_object(frame_buffer_object *buffer_object) {
+    if (buffer_object->fb_id > 0) {
+        drmModeRmFB(_fd, buffer_object->fb_id);
+        __atomic_add_fetch(&_removed_frame_buffers, 1, __ATOMIC_RELEASE);
     }
 
-    drmModeRmFB(_fd, _buffer_object.fb_id);
-
     for (uint32_t i = 0; i < kBufferObjectSize; i++) {
-        if (_buffer_object.vaddr[i] != NULL && _buffer_object.size[i] > 0) {
-            munmap(_buffer_object.vaddr[i], _buffer_object.size[i]);
+        if (buffer_object->vaddr[i] != NULL && buffer_object->vaddr[i] != MAP_FAILED &&
+            buffer_object->size[i] > 0) {
+            munmap(buffer_object->vaddr[i], buffer_object->size[i]);
         }
     }
 
     struct drm_mode_destroy_dumb destroy = {};
-    for (uint32_t i = 0; i < 4; i++) {
-        if (_buffer_object.handle[i] > 0) {
-            destroy.handle = _buffer_object.handle[i];
+    for (uint32_t i = 0; i < kBufferObjectSize; i++) {
+        if (buffer_object->handle[i] > 0) {
+            destroy.handle = buffer_object->handle[i];
             drmIoctl(_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
         }
     }
+    memset(buffer_object, 0, sizeof(*buffer_object));
+}
+
+void DrmWrapper::free_frame_buffer_object() {
+    if (!_init_nv12_frame_buffer_object) {
+        base::LogDebug() << "not need free frame buffer object";
+        return;
+    }
+
+    for (uint32_t index = 0; index < kSwapchainSize; index++) {
+        destroy_buffer_object(&_buffer_objects[index]);
+    }
+    for (uint32_t i = 0; i < kSwapchainSize; i++) {
+        if (_release_fences[i] >= 0) {
+            ::close(_release_fences[i]);
+            _release_fences[i] = -1;
+        }
+        _buffer_acquired[i] = false;
+    }
+    _front_buffer_index = -1;
 
     _init_nv12_frame_buffer_object = false;
 }
 
-static drmModeConnector *find_main_monitor(int fd, drmModeRes *res) {
+static drm_connector_handle find_main_monitor(DrmDevice *device) {
     /* Find the LVDS and eDP connectors: those are the main screens. */
     constexpr int priority_count = 2;
     static const int priority[priority_count] = {DRM_MODE_CONNECTOR_LVDS, DRM_MODE_CONNECTOR_eDP};
 
-    drmModeConnector *connector = NULL;
+    drm_connector_handle connector;
     for (int i = 0; connector == NULL && i < priority_count; i++) {
-        connector = find_used_connector_by_type(fd, res, priority[i]);
+        connector = find_used_connector_by_type(device, priority[i]);
     }
 
     /* if we didn't find a connector, grab the first one in use */
     if (connector == NULL) {
-        connector = find_first_used_connector(fd, res);
+        connector = find_first_used_connector(device);
     }
 
     /* if no connector is used, grab the first one */
-    if (connector != NULL) {
-        connector = drmModeGetConnector(fd, res->connectors[0]);
+    drmModeRes *res = device->get_resources();
+    if (connector == NULL && res->count_connectors > 0) {
+        connector = device->get_connector(res->connectors[0]);
     }
 
     return connector;
 }
 
-static drmModeCrtc *find_crtc_for_connector(int fd, drmModeRes *res, drmModeConnector *conn,
-                                            uint32_t *pipe) {
-    int crtc_id = -1;
-    drmModeEncoder *encoder = NULL;
-    drmModeCrtc *crtc = NULL;
+static drm_crtc_handle find_crtc_for_connector(DrmDevice *device, const drmModeConnector *conn,
+                                               uint32_t *pipe) {
+    drmModeRes *res = device->get_resources();
+    uint32_t crtc_id = 0;
     uint32_t crtcs_for_connector = 0;
 
-    for (int i = 0; i < res->count_encoders; i++) {
-        encoder = drmModeGetEncoder(fd, res->encoders[i]);
+    if (conn->encoder_id != 0) {
+        drm_encoder_handle encoder = device->get_encoder(conn->encoder_id);
         if (encoder != NULL) {
-            if (encoder->encoder_id == conn->encoder_id) {
-                crtc_id = encoder->crtc_id;
-                drmModeFreeEncoder(encoder);
-                break;
-            }
-            drmModeFreeEncoder(encoder);
+            crtc_id = encoder->crtc_id;
         }
     }
 
     /* If no active crtc was found, pick the first possible crtc */
-    if (crtc_id == -1) {
+    if (crtc_id == 0) {
         for (int i = 0; i < conn->count_encoders; i++) {
-            encoder = drmModeGetEncoder(fd, conn->encoders[i]);
-            crtcs_for_connector |= encoder->possible_crtcs;
-            drmModeFreeEncoder(encoder);
+            drm_encoder_handle encoder = device->get_encoder(conn->encoders[i]);
+            if (encoder != NULL) {
+                crtcs_for_connector |= encoder->possible_crtcs;
+            }
         }
 
         if (crtcs_for_connector != 0) crtc_id = res->crtcs[ffs(crtcs_for_connector) - 1];
     }
 
-    if (crtc_id == -1) {
-        return NULL;
+    if (crtc_id == 0) {
+        return drm_crtc_handle();
     }
 
     for (int i = 0; i < res->count_crtcs; i++) {
-        crtc = drmModeGetCrtc(fd, res->crtcs[i]);
-        if (crtc != NULL) {
-            if (crtc_id == crtc->crtc_id) {
-                if (pipe != NULL) {
-                    *pipe = i;
-                }
-                return crtc;
+        if (res->crtcs[i] == crtc_id) {
+            if (pipe != NULL) {
+                *pipe = i;
             }
-            drmModeFreeCrtc(crtc);
+            return device->get_crtc(crtc_id);
         }
     }
 
-    return NULL;
+    return drm_crtc_handle();
 }
 
-static bool connector_is_used(int fd, drmModeRes *res, drmModeConnector *conn) {
-    bool result = false;
-    drmModeCrtc *crtc = find_crtc_for_connector(fd, res, conn, NULL);
-    if (crtc != NULL) {
-        result = crtc->buffer_id != 0;
-        drmModeFreeCrtc(crtc);
-    }
-
-    return result;
+static bool connector_is_used(DrmDevice *device, const drmModeConnector *conn) {
+    drm_crtc_handle crtc = find_crtc_for_connector(device, conn, NULL);
+    return crtc != NULL && crtc->buffer_id != 0;
 }
 
-static drmModeConnector *find_first_used_connector(int fd, drmModeRes *res) {
-    drmModeConnector *connector = NULL;
+static drm_connector_handle find_first_used_connector(DrmDevice *device) {
+    drmModeRes *res = device->get_resources();
     for (int i = 0; i < res->count_connectors; i++) {
-        connector = drmModeGetConnector(fd, res->connectors[i]);
-        if (connector != NULL) {
-            if (connector_is_used(fd, res, connector)) {
-                return connector;
-            }
-            drmModeFreeConnector(connector);
+        drm_connector_handle connector = device->get_connector(res->connectors[i]);
+        if (connector != NULL && connector_is_used(device, connector.get())) {
+            return connector;
         }
     }
 
-    return NULL;
+    return drm_connector_handle();
 }
 
-static drmModeConnector *find_used_connector_by_type(int fd, drmModeRes *res, int type) {
-    drmModeConnector *connector = NULL;
+static drm_connector_handle find_used_connector_by_type(DrmDevice *device, int type) {
+    drmModeRes *res = device->get_resources();
     for (int i = 0; i < res->count_connectors; i++) {
-        connector = drmModeGetConnector(fd, res->connectors[i]);
-        if (connector != NULL) {
-            if ((connector->connector_type == type) && connector_is_used(fd, res, connector)) {
-                return connector;
-            }
-            drmModeFreeConnector(connector);
+        drm_connector_handle connector = device->get_connector(res->connectors[i]);
+        if (connector != NULL && connector->connector_type == (uint32_t)type &&
+            connector_is_used(device, connector.get())) {
+            return connector;
         }
     }
 
-    return NULL;
+    return drm_connector_handle();
 }
 
-static drmModePlane *find_plane_for_crtc(int fd, drmModeRes *res, drmModePlaneRes *pres,
-                                         int crtc_id) {
-    drmModePlane *plane = NULL;
+static drm_plane_handle find_plane_for_crtc(DrmDevice *device, uint32_t crtc_id) {
+    drmModeRes *res = device->get_resources();
+    drmModePlaneRes *pres = device->get_plane_resources();
     int pipe = -1;
 
     for (int i = 0; i < res->count_crtcs; i++) {
@@ -509,16 +2595,55 @@ static drmModePlane *find_plane_for_crtc(int fd, drmModeRes *res, drmModePlaneRe
     }
 
     if (pipe == -1) {
-        return NULL;
+        return drm_plane_handle();
     }
 
-    for (int i = 0; i < pres->count_planes; i++) {
-        plane = drmModeGetPlane(fd, pres->planes[i]);
-        if (plane->possible_crtcs & (1 << pipe)) {
+    for (uint32_t i = 0; i < pres->count_planes; i++) {
+        drm_plane_handle plane = device->get_plane(pres->planes[i]);
+        if (plane != NULL && (plane->possible_crtcs & (1 << pipe))) {
             return plane;
         }
-        drmModeFreePlane(plane);
     }
 
-    return NULL;
-}
\ No newline at end of file
+    return drm_plane_handle();
+}
+
+static void copy_nv12_planes(frame_buffer_object *buffer_object, const uint8_t *y_address,
+                             int32_t y_stride, const uint8_t *uv_address, int32_t uv_stride) {
+    nv12_upload_generic(y_address, y_stride, uv_address, uv_stride, buffer_object->vaddr[0],
+                        buffer_object->pitch[0], buffer_object->vaddr[1], buffer_object->pitch[1],
+                        buffer_object->width, buffer_object->height);
+}
+
+static bool wait_fence(int fence_fd, int timeout_ms) {
+    // a sync_file becomes readable once it signals
+    struct pollfd pfd = {};
+    pfd.fd = fence_fd;
+    pfd.events = POLLIN;
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t wake_ns) {
+    struct timespec wake = {};
+    wake.tv_sec = wake_ns / 1000000000ULL;
+    wake.tv_nsec = wake_ns % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+}
+
+static uint32_t scanout_line(uint64_t now_ns, uint64_t vblank_ns, uint64_t line_ns,
+                             uint64_t frame_ns) {
+    // the timestamp may lie a little ahead of now, it is corrected to the end of vblank
+    int64_t since_ns = ((int64_t)(now_ns - vblank_ns) % (int64_t)frame_ns + (int64_t)frame_ns) %
+                       (int64_t)frame_ns;
+    return since_ns / line_ns;
+}
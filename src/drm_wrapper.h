@@ -1,9 +1,27 @@
 #pragma once
 
+#include <pthread.h>
 #include <stdint.h>
 #include <xf86drmMode.h>
 
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "color_calibration.h"
+#include "drm_device.h"
+#include "drm_utils.h"
+#include "mode_cache.h"
+#include "nv12_upload.h"
+#include "pixel_convert.h"
+#include "pixel_rotate.h"
+#include "render_thread.h"
+
 constexpr int32_t kBufferObjectSize = 4;
+constexpr int32_t kSwapchainSize = 3;
 
 struct frame_buffer_object {
     uint32_t width;
@@ -15,6 +33,21 @@ struct frame_buffer_object {
     uint32_t fb_id;
 };
 
+/**
+ * @brief dma-buf view of one swapchain buffer, the fds are owned by the caller
+ */
+struct dma_buf_frame {
+    uint32_t index;  ///< swapchain index, pass to present_frame_buffer or submit when ready
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t modifier;  ///< layout of all planes, DRM_FORMAT_MOD_LINEAR when zeroed
+    uint32_t num_planes;
+    int fd[kBufferObjectSize];
+    uint32_t pitch[kBufferObjectSize];
+    uint32_t offset[kBufferObjectSize];
+};
+
 class DrmWrapper {
 public:
     /**
@@ -22,13 +55,351 @@ public:
      * @param driver_name drm driver name
      */
     bool open(const char *driver_name = nullptr);
+    /**
+     * @brief open the output leased by another process, the connector, crtc and planes of
+     *        the lease are driven with atomic commits of this process alone
+     * @param lease_fd from create_lease of the master, owned by the wrapper from now on
+     */
+    bool open_lease(int lease_fd);
+    /**
+     * @brief lease a connector with a free crtc and its free planes to another process
+     * @param lessee_id receives the id revoke_lease takes
+     * @return lease fd to hand to the client e.g. over a unix socket, -1 on failure
+     */
+    int create_lease(uint32_t connector_id, uint32_t *lessee_id);
+    /**
+     * @brief end a lease, the lessee loses the output immediately
+     */
+    bool revoke_lease(uint32_t lessee_id);
+    /**
+     * @brief mlock the swapchain mappings so scan out buffers are never paged out,
+     *        takes effect for buffers created afterwards
+     */
+    void set_lock_frame_buffers(bool lock) {
+        _lock_frame_buffers = lock;
+    }
+    /**
+     * @brief rotate and mirror everything drawn afterwards, on the plane when it has a rotation
+     *        property, otherwise while uploading into the swapchain
+     * @param rotation one DRM_MODE_ROTATE_* optionally or-ed with DRM_MODE_REFLECT_*
+     */
+    bool set_rotation(uint64_t rotation);
+    /**
+     * @brief place the video plane on the crtc, so wrappers sharing a crtc do not cover each
+     *        other. a width or height of 0 goes back to full screen, or 1:1 when the plane
+     *        cannot scale. applied with the next frame, atomic only
+     * @param zpos stacking order, higher is on top, -1 keeps the plane's own. kept below the
+     *        osd and ignored when the plane's zpos is fixed
+     */
+    bool set_video_position(int32_t x, int32_t y, uint32_t width, uint32_t height,
+                            int64_t zpos = -1);
+    /**
+     * @brief show an argb8888 osd over the video, on a plane of its own when one is free,
+     *        otherwise alpha-blended into each frame drawn afterwards
+     * @param address straight alpha argb8888, B G R A byte order
+     * @param width osd size, even
+     * @param x position in video frame pixels, rounded down to even
+     * @param matrix rgb to yuv matrix when the osd is blended into the video
+     */
+    bool set_osd(const uint8_t *address, int32_t width, int32_t height, int32_t stride,
+                 int32_t x, int32_t y, color_matrix matrix = color_matrix::BT709);
+    /**
+     * @brief remove the osd
+     */
+    void clear_osd();
+    /**
+     * @brief program degamma, color transform and gamma into the crtc, so correction costs
+     *        nothing per frame. without the color management properties only gamma is set,
+     *        through the legacy gamma ramp
+     */
+    bool set_color_calibration(const color_calibration &calibration);
+    /**
+     * @brief read a calibration file, see load_color_calibration, and program it
+     */
+    bool load_color_calibration(const char *path);
+    /**
+     * @brief where the result of every mode switch is remembered across sessions,
+     *        call before set_content_format, an empty path keeps results in memory only
+     */
+    void set_mode_cache_path(const char *path);
+    /**
+     * @brief switch to the connector mode that shows content of this size and rate best,
+     *        e.g. 1080p50 for 25 fps and 1080p60 for 30 fps. the switch happens with the next
+     *        frame, modes that fail or failed in an earlier session are skipped
+     * @param frame_rate content frames per second, 0 when unknown
+     */
+    bool set_content_format(uint32_t width, uint32_t height, double frame_rate);
+    /**
+     * @brief drm device fd, -1 when closed
+     */
+    int get_fd() const {
+        return _fd;
+    }
+    /**
+     * @brief device shared with the other wrappers on the same driver, NULL when closed
+     */
+    DrmDevice *get_device() const {
+        return _device;
+    }
+    /**
+     * @brief crtc driving the main monitor
+     */
+    uint32_t get_crtc_id() const {
+        return _crtc_id;
+    }
+    /**
+     * @brief plane showing the main video, primary or overlay
+     */
+    uint32_t get_plane_id() const {
+        return _plane_id;
+    }
+    /**
+     * @brief the main monitor and the driver can refresh at a variable rate
+     */
+    bool is_vrr_capable() const {
+        return _vrr_capable;
+    }
+    /**
+     * @brief refresh when a frame is ready instead of at a fixed rate. frames are committed
+     *        no sooner than 1 / max_hz after the last flip and otherwise as they are presented,
+     *        the display rate follows the content rate within get_vrr_range; below the range
+     *        the display repeats frames. the render thread picks the setting up with the next
+     *        frame
+     */
+    bool set_variable_refresh(bool enable);
+    /**
+     * @brief refresh range of a variable refresh display, in hertz
+     */
+    void get_vrr_range(uint32_t *min_hz, uint32_t *max_hz) const {
+        *min_hz = _vrr_min_hz;
+        *max_hz = _vrr_max_hz;
+    }
+    /**
+     * @brief mode the crtc is driven with, or will be after the next frame
+     */
+    const drmModeModeInfo &get_display_mode() const {
+        return _display_mode;
+    }
+    /**
+     * @brief write drawn nv12 frames straight into the buffer on screen instead of flipping,
+     *        in horizontal slices each written just ahead of the scanout line. the part of the
+     *        frame below the beam shows in the refresh already running, saving up to a frame
+     *        of latency; a slice the beam overtakes tears. frames of another size than the
+     *        buffer on screen, rotation, a blended osd and variable refresh take the flip
+     * @param slices slices per frame, 0 turns beam racing off
+     */
+    bool set_beam_racing(uint32_t slices);
+    /**
+     * @brief slices the scanout line reached while they were written
+     */
+    uint64_t get_beam_racing_late_slices() const {
+        return _beam_racing_late_slices;
+    }
     /**
      * @brief draw nv 12 frame
      * @param width frame width
      * @param height frame height
      * @param stride line stride
     */
-    bool draw_nv12_frame(uint8_t *address, int32_t width, int32_t height, int32_t stride);
+    bool draw_nv12_frame(const uint8_t *address, int32_t width, int32_t height, int32_t stride);
+    /**
+     * @brief draw nv 12 frame whose Y and UV planes are not contiguous
+     * @param y_address Y plane
+     * @param y_stride Y line stride
+     * @param uv_address interleaved UV plane
+     * @param uv_stride UV line stride
+    */
+    bool draw_nv12_planes(const uint8_t *y_address, int32_t y_stride, const uint8_t *uv_address,
+                          int32_t uv_stride, int32_t width, int32_t height);
+    /**
+     * @brief draw i420 frame, U and V are interleaved while uploading
+    */
+    bool draw_i420_frame(const uint8_t *y_address, int32_t y_stride, const uint8_t *u_address,
+                         int32_t u_stride, const uint8_t *v_address, int32_t v_stride,
+                         int32_t width, int32_t height);
+    /**
+     * @brief draw packed yuyv frame, converted to nv12 while uploading
+     * @param stride line stride in bytes
+    */
+    bool draw_yuyv_frame(const uint8_t *address, int32_t width, int32_t height, int32_t stride);
+    /**
+     * @brief draw rgba frame, converted to nv12 while uploading
+     * @param stride line stride in bytes
+     * @param matrix rgb to yuv matrix
+    */
+    bool draw_rgba_frame(const uint8_t *address, int32_t width, int32_t height, int32_t stride,
+                         color_matrix matrix = color_matrix::BT709);
+    /**
+     * @brief allocate the nv12 swapchain for acquire_frame_buffer and submit, without
+     *        exporting it. an existing swapchain is kept
+     * @param width frame width
+     * @param height frame height
+     */
+    bool create_swapchain(int32_t width, int32_t height);
+    /**
+     * @brief export every nv12 swapchain buffer as dma-buf fds
+     * @param width frame width
+     * @param height frame height
+     * @param frames filled with one entry per swapchain buffer, caller must close the fds
+     */
+    bool export_nv12_frame_buffers(int32_t width, int32_t height,
+                                   std::vector<dma_buf_frame> *frames);
+    /**
+     * @brief scan out a swapchain buffer written by an external producer
+     * @param index swapchain index from dma_buf_frame
+     */
+    bool present_frame_buffer(uint32_t index);
+    /**
+     * @brief take a swapchain buffer the display no longer reads
+     * @param timeout_ms time to wait for a release fence, -1 waits forever
+     * @return swapchain index, -1 on timeout or when no buffer can be released
+     */
+    int acquire_frame_buffer(int timeout_ms);
+    /**
+     * @brief queue a swapchain buffer for scan out without waiting for the producer or the flip
+     * @param index swapchain index from acquire_frame_buffer or dma_buf_frame
+     * @param in_fence_fd sync_file signalled when the producer finished writing, -1 if the
+     *                    buffer is ready, stays owned by the caller
+     * @param out_fence_fd receives a sync_file signalled when the frame is on screen, -1 without
+     *                     atomic support, may be nullptr, caller must close it. with device
+     *                     commit batching a frame asking for it is committed on its own instead
+     *                     of joining the batch
+     */
+    bool submit(uint32_t index, int in_fence_fd = -1, int *out_fence_fd = nullptr);
+    /**
+     * @brief dispatch page flip events of submitted frames, of every wrapper on the device
+     * @param timeout_ms 0 only drains queued events, -1 waits for the next one
+     * @return true if an event was dispatched
+     */
+    bool handle_events(int timeout_ms);
+    /**
+     * @brief page flips of submitted frames reported so far
+     */
+    uint64_t get_flip_count() const {
+        return _flip_count;
+    }
+    /**
+     * @brief frame buffers this wrapper removed so far. while it does not change, a frame
+     *        buffer id seen on the planes of the wrapper names the same buffer. callable from
+     *        any thread
+     */
+    uint64_t get_removed_frame_buffers() const {
+        return __atomic_load_n(&_removed_frame_buffers, __ATOMIC_ACQUIRE);
+    }
+    /**
+     * @brief vblank the last reported flip happened on, CLOCK_MONOTONIC microseconds
+     */
+    uint64_t get_last_flip_time_us() const {
+        return _last_flip_us;
+    }
+    /**
+     * @brief import a dma-buf frame from another device or process as a frame buffer
+     * @param frame dma-buf description, the fds stay owned by the caller
+     * @param fb_id returned frame buffer id
+     * @param plane_id plane that scans the frame out, its modifiers are checked. a layer id,
+     *        0 for the main plane
+     */
+    bool import_dma_buf_frame(const dma_buf_frame &frame, uint32_t *fb_id,
+                              uint32_t plane_id = 0);
+    /**
+     * @brief modifiers a plane can scan out for a format
+     * @param modifiers empty when the driver only supports implicit layouts
+     * @param plane_id a layer id, 0 for the main plane
+     */
+    bool get_supported_modifiers(uint32_t format, std::vector<uint64_t> *modifiers,
+                                 uint32_t plane_id = 0);
+    /**
+     * @brief layout a producer should render format in for the cheapest scan out on a plane
+     * @param plane_id a layer id, 0 for the main plane
+     * @return DRM_FORMAT_MOD_INVALID when the format is unsupported or layouts are implicit
+     */
+    uint64_t get_preferred_modifier(uint32_t format, uint32_t plane_id = 0);
+    /**
+     * @brief capabilities of every plane, read once when the device is opened
+     */
+    const std::vector<plane_capability> &get_plane_capabilities() const;
+    /**
+     * @brief reserve the cheapest free plane of the crtc that shows a stream natively
+     * @param format drm fourcc of the stream
+     * @param src_width source width, src and dst sizes of 0 mean no scaling
+     * @param dst_width size on screen
+     * @param rotation DRM_MODE_ROTATE_* | DRM_MODE_REFLECT_* the plane has to apply
+     * @return plane id, 0 if no plane fits
+     */
+    uint32_t assign_plane(uint32_t format, uint32_t src_width, uint32_t src_height,
+                          uint32_t dst_width, uint32_t dst_height,
+                          uint64_t rotation = DRM_MODE_ROTATE_0);
+    /**
+     * @brief give back a plane reserved with assign_plane
+     */
+    void release_plane(uint32_t plane_id);
+    /**
+     * @brief scan out a frame buffer created by import_dma_buf_frame
+     */
+    bool present_imported_frame(uint32_t fb_id);
+    /**
+     * @brief remove an imported frame buffer and close its gem handles. the frame on
+     *        screen stays imported until the next frame replaces it, removing it would
+     *        turn the plane off
+     */
+    void release_imported_frame(uint32_t fb_id);
+    /**
+     * @brief show a video stream on a plane of its own above the main video, e.g. picture in
+     *        picture. layer changes go out with the next commit_layers or main frame, both
+     *        update only the layers that changed
+     * @param src_width size of the stream frames, used to pick a plane that can scale them
+     * @param x position on the crtc
+     * @param width size on the crtc
+     * @param zpos stacking order, higher is on top, kept below the osd and ignored when the
+     *        plane's zpos is fixed
+     * @return layer id, 0 when no plane fits
+     */
+    uint32_t create_layer(uint32_t src_width, uint32_t src_height, int32_t x, int32_t y,
+                          uint32_t width, uint32_t height, uint32_t zpos);
+    /**
+     * @brief move, resize or restack a layer
+     */
+    bool set_layer_position(uint32_t layer_id, int32_t x, int32_t y, uint32_t width,
+                            uint32_t height, uint32_t zpos);
+    /**
+     * @brief copy a nv12 frame into the layer
+     */
+    bool draw_layer_nv12_frame(uint32_t layer_id, const uint8_t *address, int32_t width,
+                               int32_t height, int32_t stride);
+    /**
+     * @brief show a frame buffer created by import_dma_buf_frame on the layer, without a copy.
+     *        import it with the layer id so its modifier is checked against the layer plane,
+     *        and keep it imported while the layer shows it
+     */
+    bool set_layer_frame(uint32_t layer_id, uint32_t fb_id);
+    /**
+     * @brief commit the layers that changed since the last commit, in one atomic commit
+     */
+    bool commit_layers();
+    /**
+     * @brief take a layer off the screen and release its plane
+     */
+    void destroy_layer(uint32_t layer_id);
+    /**
+     * @brief start the thread that uploads and presents queued frames, while it runs it
+     *        owns presentation and the draw_* and submit calls must not be used. set_osd,
+     *        clear_osd, set_rotation, set_video_position, set_color_calibration and
+     *        set_variable_refresh wait for the frame it is drawing
+     */
+    bool start_render_thread(const render_thread_config &config);
+    /**
+     * @brief hand a frame to the render thread, safe to call from any thread
+     * @return false if the queue is full, the frame is then released to its pool
+     */
+    bool queue_frame(const render_frame &frame);
+    /**
+     * @brief scheduling and timing counters of the render thread
+     */
+    render_stats get_render_stats();
+    /**
+     * @brief stop the render thread, queued frames are released without being shown
+     */
+    void stop_render_thread();
     /**
      * @brief close drm device
     */
@@ -38,39 +409,221 @@ public:
     ~DrmWrapper();
 private:
     /**
-     *  @brief log drm version info
-     */
-    void log_drm_version();
-    /**
-     * @brief get drm capability
+     * find connector, crtc and plane on the acquired device
     */
-    bool get_drm_capability();
+    bool open_output();
     /**
-     * create nv12 frame buffer object
+     * create nv12 frame buffer object for every swapchain buffer
     */
     bool create_nv12_frame_buffer_object(int32_t width, int32_t height);
+    /**
+     * create one nv12 dumb buffer, register it as fb and map it
+    */
+    bool create_nv12_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                                   int32_t height);
+    /**
+     * copy nv12 into a swapchain buffer, applying the software rotation
+    */
+    void upload_nv12(frame_buffer_object *buffer_object, const uint8_t *y_address,
+                     int32_t y_stride, const uint8_t *uv_address, int32_t uv_stride);
+    /**
+     * copy the osd into its plane buffer and show it
+    */
+    bool show_osd_plane(const uint8_t *address, int32_t width, int32_t height, int32_t stride);
+    /**
+     * osd plane state for an atomic request, disabled when no osd buffer is shown
+    */
+    bool add_osd_plane_properties(drmModeAtomicReq *request);
+    /**
+     * plane properties of every layer that changed since the last commit
+    */
+    bool add_layer_properties(drmModeAtomicReq *request);
+    /**
+     * mark the changed layers as committed and free destroyed ones
+    */
+    void finish_layer_commit();
+    /**
+     * crtc color properties for an atomic request
+    */
+    bool add_color_properties(drmModeAtomicReq *request);
+    bool add_vrr_properties(drmModeAtomicReq *request);
+    void release_color_blobs();
+    /**
+     * commit the properties add_properties puts into a request and wait until they are on
+     * screen, through the device batch when commits are batched. before the first frame
+     * they go out with it
+     * @param name what is committed, for the log
+    */
+    bool commit_properties(bool (DrmWrapper::*add_properties)(drmModeAtomicReq *request),
+                           const char *name);
+    bool set_legacy_gamma(const color_calibration &calibration);
+    /**
+     * blend the software osd into a swapchain buffer, only its bounding box is touched
+    */
+    void blend_osd(frame_buffer_object *buffer_object);
+    /**
+     * nv12 strip other formats are converted into before the software rotation
+    */
+    uint8_t *get_rotation_scratch(int32_t width, int32_t height);
+    /**
+     * software rotation of a frame in another format. convert(row, rows, y, uv, pitch) writes
+     * rows of the frame as nv12 into a strip that stays in cache, each strip is rotated into
+     * the back buffer right after, so the frame is written to memory once
+    */
+    bool draw_rotated_strips(
+        int32_t width, int32_t height,
+        const std::function<void(int32_t row, int32_t rows, uint8_t *y, uint8_t *uv,
+                                 int32_t pitch)> &convert);
+    /**
+     * map a dumb buffer with its pages populated, locked if requested
+    */
+    uint8_t *map_dumb_buffer(uint32_t handle, uint32_t size);
+    /**
+     * create one argb8888 dumb buffer, register it as fb and map it
+    */
+    bool create_argb_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                                   int32_t height);
+    /**
+     * remove the fb, unmap and destroy the dumb buffers of one buffer object
+    */
+    void destroy_buffer_object(frame_buffer_object *buffer_object);
     /**
      * free nv12 frame buffer object
     */
     void free_frame_buffer_object();
+    const plane_capability *find_plane_capability(uint32_t plane_id) const;
+    /**
+     * reserve a plane on the device for this wrapper
+    */
+    bool reserve_plane(uint32_t plane_id);
+    /**
+     * cheapest unassigned plane of the crtc at pipe for a stream, 0 if none fits
+    */
+    uint32_t find_best_plane(uint32_t pipe, uint32_t format, uint32_t src_width,
+                             uint32_t src_height, uint32_t dst_width, uint32_t dst_height,
+                             uint64_t rotation) const;
+    /**
+     * add fb, with an explicit modifier when the driver supports modifiers
+    */
+    int add_frame_buffer(uint32_t width, uint32_t height, uint32_t format, uint64_t modifier,
+                         const uint32_t handles[4], const uint32_t pitches[4],
+                         const uint32_t offsets[4], uint32_t *fb_id);
+    /**
+     * swapchain buffer the next frame is written into
+    */
+    frame_buffer_object *get_back_buffer(int32_t width, int32_t height);
+    /**
+     * scan out the back buffer and advance the swapchain
+    */
+    bool present_back_buffer();
+    /**
+     * scan out a frame buffer and wait until it is on screen
+    */
+    bool show_frame_buffer(const frame_buffer_object &buffer_object);
+    /**
+     * property id of a kms object, looked up once and cached
+    */
+    uint32_t get_property_id(uint32_t object_id, uint32_t object_type, const char *name);
+    bool add_atomic_property(drmModeAtomicReq *request, uint32_t object_id, uint32_t object_type,
+                             const char *name, uint64_t value);
+    /**
+     * atomic commit of buffer_object on the plane, with the modeset on first use
+    */
+    bool commit_frame_buffer(const frame_buffer_object &buffer_object, int in_fence_fd,
+                             int *out_fence_fd, bool nonblock);
+    bool try_commit_frame_buffer(const frame_buffer_object &buffer_object, int in_fence_fd,
+                                 int *out_fence_fd, bool nonblock);
+    /**
+     * remember the outcome of a mode switch, on failure move to the next candidate mode
+     * @return false when there is no candidate left to try
+    */
+    bool finish_mode_switch(bool accepted);
+    /**
+     * take the mode another wrapper already set on the crtc instead of setting it again,
+     * unless this wrapper chose a different one with set_content_format
+    */
+    bool adopt_crtc_mode();
+    void select_display_mode(const drmModeModeInfo &mode);
+    /**
+     * read vrr_capable of the connector and the refresh range of its EDID
+    */
+    void detect_variable_refresh();
+    /**
+     * copy a frame into the front buffer racing the beam
+     * @return false if the frame has to be flipped instead
+    */
+    bool race_nv12_planes(const uint8_t *y_address, int32_t y_stride, const uint8_t *uv_address,
+                          int32_t uv_stride, int32_t width, int32_t height);
+    /**
+     * time the last vblank of the crtc ended, CLOCK_MONOTONIC
+    */
+    bool get_vblank_time(uint64_t *vblank_ns);
+    /**
+     * commit time for target_ns on a variable refresh display, moved into the window of
+     * 1 / max_hz to 1 / min_hz after the last flip. 0 asks for the earliest time
+    */
+    uint64_t get_variable_refresh_time(uint64_t target_ns);
+    /**
+     * make index the front buffer, the previous front buffer is free once release_fence_fd
+     * signals or immediately when it is -1
+    */
+    void retire_front_buffer(int index, int release_fence_fd);
+    /**
+     * the main plane shows the imported frame fb_id, 0 for a swapchain buffer. an import
+     * released while it was on screen is removed once it left the screen
+    */
+    void set_displayed_import(uint32_t fb_id);
+    /**
+     * wait until the last nonblocking commit has flipped
+    */
+    void wait_pending_flip();
+    /**
+     * take the main plane and the layer planes off the crtc, leaving the crtc on
+     * @return false when the planes could not be disabled on their own
+    */
+    bool disable_planes();
+    static void flip_done(void *context, uint32_t crtc_id, bool flipped, uint64_t timestamp_us);
+    static void *render_thread_main(void *user_data);
+    void render_loop();
 private:
+    DrmDevice *_device;
     int _fd;
-    drmModeRes *_mode_res;
-    drmModeCrtc *_mode_crtc;
-    drmModePlaneRes *_mode_plane_res;
-    drmModePlane *_mode_plane;
+    drm_crtc_handle _mode_crtc;
+    drm_plane_handle _mode_plane;
     uint32_t _conn_id;
-    drmModeConnector *_conn;
+    drm_connector_handle _conn;
     int _crtc_id;
     int _plane_id;
     uint32_t _pipe;
     bool _has_prime_import;
     bool _has_prime_export;
-    bool _has_async_page_flip;
+    bool _has_addfb2_modifiers;
+    bool _has_atomic;
     bool _modesetting_enabled;
 
     uint16_t _hdisplay;
     uint16_t _vdisplay;
+    drmModeModeInfo _display_mode;
+    uint32_t _mode_blob_id;
+    bool _mode_set;
+    bool _flip_pending;
+    drm_flip_callback _flip_callback;
+    uint64_t _flip_count;
+    uint64_t _removed_frame_buffers;  ///< ids the kernel may hand out again
+    uint64_t _last_flip_us;
+    std::vector<drmModeModeInfo> _mode_candidates;  ///< fallbacks for _display_mode, best first
+    ModeCache _mode_cache;
+    std::string _mode_cache_path;
+    std::string _display_key;  ///< names the display in _mode_cache
+
+    bool _vrr_capable;
+    bool _vrr_enabled;
+    bool _vrr_dirty;  ///< VRR_ENABLED waits for the next commit
+    uint32_t _vrr_min_hz;
+    uint32_t _vrr_max_hz;
+
+    uint32_t _beam_racing_slices;
+    uint64_t _beam_racing_late_slices;
 
     uint32_t _buffer_id;
 
@@ -78,5 +631,91 @@ private:
     uint32_t _mm_height;
 
     bool _init_nv12_frame_buffer_object;
-    frame_buffer_object _buffer_object;
+    bool _lock_frame_buffers;
+    uint64_t _rotation;           ///< rotation the plane applies
+    uint64_t _upload_rotation;    ///< rotation applied while uploading
+    std::vector<uint8_t> _rotation_scratch;  ///< converted strip waiting to be rotated
+    // upload kernel of the current stream and the geometry it was picked for
+    nv12_upload_fn _upload_kernel;
+    uint32_t _upload_width;
+    uint32_t _upload_height;
+    int32_t _upload_y_stride;
+    int32_t _upload_uv_stride;
+    uint32_t _upload_pitch;
+
+    // geometry of the last video commit, the osd plane is placed with the same scale
+    uint32_t _video_width;
+    uint32_t _video_height;
+    uint32_t _video_crtc_width;
+    uint32_t _video_crtc_height;
+    int32_t _video_crtc_x;
+    int32_t _video_crtc_y;
+
+    // requested by set_video_position
+    int32_t _video_dst_x;
+    int32_t _video_dst_y;
+    uint32_t _video_dst_width;  ///< 0 for full screen
+    uint32_t _video_dst_height;
+    int64_t _video_zpos;  ///< -1 for the plane's own
+
+    bool _osd_visible;
+    int32_t _osd_x;
+    int32_t _osd_y;
+    uint32_t _osd_plane_id;  ///< 0 when the osd is blended into the video
+    bool _osd_plane_failed;
+    frame_buffer_object _osd_buffers[2];
+    int _osd_buffer_index;  ///< buffer on the osd plane, -1 if none
+    nv12a_image _osd_image;
+    nv12a_image _osd_rotated_image;  ///< _osd_image turned by _osd_image_rotation
+    uint64_t _osd_image_rotation;
+
+    uint32_t _color_blob_ids[3];  ///< DEGAMMA_LUT, CTM, GAMMA_LUT, 0 bypasses the stage
+    bool _color_dirty;            ///< blobs wait for the next commit
+    frame_buffer_object _buffer_objects[kSwapchainSize];
+    uint32_t _back_buffer_index;
+    int _front_buffer_index;
+    int _batched_index;  ///< queued in a commit batch, retired when the batch flips
+    int _release_fences[kSwapchainSize];  ///< signals when the display stops reading, -1 if free
+    bool _buffer_acquired[kSwapchainSize];
+    std::map<std::pair<uint32_t, std::string>, uint32_t> _property_ids;
+
+    struct queued_frame {
+        render_frame frame;
+        uint64_t queue_time_ns;
+    };
+    bool _render_thread_running;
+    bool _render_thread_quit;
+    pthread_t _render_thread;
+    pthread_mutex_t _render_mutex;  ///< priority inheritance, producers may run at lower priority
+    pthread_cond_t _render_cond;
+    render_thread_config _render_config;
+    std::deque<queued_frame> _render_queue;
+    render_stats _render_stats;
+    /**
+     * held by the render thread while it draws and by the setters that change what it draws
+     * with, recursive so setters can call each other
+    */
+    pthread_mutex_t _draw_mutex;
+
+    struct video_layer {
+        uint32_t plane_id;
+        int32_t x;
+        int32_t y;
+        uint32_t width;
+        uint32_t height;
+        uint64_t zpos;
+        frame_buffer_object buffers[2];  ///< copies of drawn frames
+        uint32_t fb_id;                  ///< frame to show, 0 for none
+        uint32_t screen_fb_id;           ///< frame shown since the last commit
+        uint32_t src_width;
+        uint32_t src_height;
+        bool dirty;      ///< changed since the last commit
+        bool destroyed;  ///< leaves the screen with the next commit
+    };
+    std::map<uint32_t, video_layer> _layers;  ///< by layer id, the plane id
+
+    std::map<uint32_t, frame_buffer_object> _imported_frames;
+    uint32_t _displayed_import_fb_id;  ///< imported frame on the main plane, 0 if none
+    bool _displayed_import_released;   ///< its removal waits for the next frame
+    std::vector<uint32_t> _assigned_planes;  ///< reserved on the device by this wrapper
 };
\ No newline at end of file
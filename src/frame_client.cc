@@ -0,0 +1,117 @@
+#include "frame_client.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "base/log.h"
+
+bool FrameClient::connect(const char *socket_path) {
+    struct sockaddr_un addr = {};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        base::LogError() << "socket path too long " << socket_path;
+        return false;
+    }
+
+    _fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+        base::LogError() << "create frame client socket failed reason:" << strerror(errno);
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    if (::connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        base::LogError() << "connect to " << socket_path << " failed reason:" << strerror(errno);
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool FrameClient::attach_buffer(uint32_t buffer_id, const dma_buf_frame &frame) {
+    if (frame.num_planes == 0 || frame.num_planes > kBufferObjectSize) {
+        base::LogError() << "invalid plane count " << frame.num_planes;
+        return false;
+    }
+
+    frame_message message = {};
+    message.type = frame_message_type::AttachBuffer;
+    message.buffer_id = buffer_id;
+    message.width = frame.width;
+    message.height = frame.height;
+    message.format = frame.format;
+    message.modifier = frame.modifier;
+    message.num_planes = frame.num_planes;
+    for (uint32_t plane = 0; plane < frame.num_planes; plane++) {
+        message.pitch[plane] = frame.pitch[plane];
+        message.offset[plane] = frame.offset[plane];
+    }
+    return send_frame_message(_fd, message, frame.fd, frame.num_planes);
+}
+
+bool FrameClient::detach_buffer(uint32_t buffer_id) {
+    frame_message message = {};
+    message.type = frame_message_type::DetachBuffer;
+    message.buffer_id = buffer_id;
+    return send_frame_message(_fd, message, nullptr, 0);
+}
+
+bool FrameClient::present(uint32_t buffer_id) {
+    frame_message message = {};
+    message.type = frame_message_type::PresentFrame;
+    message.buffer_id = buffer_id;
+    return send_frame_message(_fd, message, nullptr, 0);
+}
+
+bool FrameClient::wait_release(uint32_t *buffer_id, int timeout_ms) {
+    while (true) {
+        struct pollfd pfd = {_fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+
+        frame_message message = {};
+        int fds[kBufferObjectSize];
+        uint32_t fd_count = 0;
+        if (recv_frame_message(_fd, &message, fds, &fd_count) <= 0) {
+            return false;
+        }
+        for (uint32_t i = 0; i < fd_count; i++) {
+            ::close(fds[i]);
+        }
+
+        if (message.type == frame_message_type::FrameReleased) {
+            *buffer_id = message.buffer_id;
+            return true;
+        }
+        if (message.type == frame_message_type::Error) {
+            base::LogError() << "frame server rejected buffer " << message.buffer_id
+                             << " status:" << message.status;
+            return false;
+        }
+    }
+}
+
+void FrameClient::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+FrameClient::FrameClient() {
+    _fd = -1;
+}
+
+FrameClient::~FrameClient() {
+    close();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "drm_wrapper.h"
+#include "frame_protocol.h"
+
+/**
+ * client side of FrameServer, attaches buffers once and then only sends
+ * per frame metadata.
+ */
+class FrameClient {
+public:
+    /**
+     * @brief connect to a frame server
+     * @param socket_path unix socket path the server listens on
+     */
+    bool connect(const char *socket_path);
+    /**
+     * @brief pass a buffer to the server
+     * @param buffer_id id used by present and FrameReleased
+     * @param frame dma-buf or memfd planes, the fds stay owned by the caller
+     */
+    bool attach_buffer(uint32_t buffer_id, const dma_buf_frame &frame);
+    /**
+     * @brief drop a buffer on the server side
+     */
+    bool detach_buffer(uint32_t buffer_id);
+    /**
+     * @brief ask the server to present an attached buffer, it is shown with the next vblank
+     */
+    bool present(uint32_t buffer_id);
+    /**
+     * @brief wait until the server hands a buffer back
+     * @param buffer_id released buffer
+     * @param timeout_ms poll timeout, -1 waits forever
+     */
+    bool wait_release(uint32_t *buffer_id, int timeout_ms);
+    /**
+     * @brief socket fd, can be added to a caller owned poll loop
+     */
+    int get_fd() const { return _fd; }
+    /**
+     * @brief disconnect from the server
+     */
+    void close();
+public:
+    FrameClient();
+    ~FrameClient();
+private:
+    int _fd;
+};
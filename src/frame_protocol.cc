@@ -0,0 +1,90 @@
+#include "frame_protocol.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "base/log.h"
+
+bool send_frame_message(int socket_fd, const frame_message &message, const int *fds,
+                        uint32_t fd_count) {
+    if (fd_count > kBufferObjectSize) {
+        base::LogError() << "too many fds for one frame message " << fd_count;
+        return false;
+    }
+
+    struct iovec iov = {};
+    iov.iov_base = const_cast<frame_message *>(&message);
+    iov.iov_len = sizeof(message);
+
+    char control[CMSG_SPACE(sizeof(int) * kBufferObjectSize)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd_count > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != sizeof(message)) {
+        base::LogError() << "sendmsg frame message failed reason:" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+int recv_frame_message(int socket_fd, frame_message *message, int *fds, uint32_t *fd_count) {
+    struct iovec iov = {};
+    iov.iov_base = message;
+    iov.iov_len = sizeof(*message);
+
+    char control[CMSG_SPACE(sizeof(int) * kBufferObjectSize)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *fd_count = 0;
+    ssize_t ret;
+    do {
+        ret = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret == 0 || (ret < 0 && errno == ECONNRESET)) {
+        return 0;
+    }
+    if (ret < 0) {
+        base::LogError() << "recvmsg frame message failed reason:" << strerror(errno);
+        return -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        uint32_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds + *fd_count, CMSG_DATA(cmsg), sizeof(int) * count);
+        *fd_count += count;
+    }
+
+    if (ret != sizeof(*message) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        base::LogError() << "truncated frame message, size " << ret;
+        for (uint32_t i = 0; i < *fd_count; i++) {
+            ::close(fds[i]);
+        }
+        *fd_count = 0;
+        return -1;
+    }
+    return 1;
+}
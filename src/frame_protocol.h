@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "drm_wrapper.h"
+
+/**
+ * wire protocol between FrameServer and FrameClient, fixed size messages on a
+ * SOCK_SEQPACKET unix socket. pixel data never crosses the socket, buffers are
+ * passed once as fds with SCM_RIGHTS and afterwards referenced by buffer_id.
+ */
+
+enum class frame_message_type : uint32_t {
+    AttachBuffer = 1,  ///< client -> server, carries num_planes fds
+    DetachBuffer = 2,  ///< client -> server
+    PresentFrame = 3,  ///< client -> server
+    FrameReleased = 4, ///< server -> client, buffer can be written again
+    Error = 5,         ///< server -> client, status holds -errno
+};
+
+struct frame_message {
+    frame_message_type type;
+    uint32_t buffer_id;  ///< chosen by the client, unique per connection
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t modifier;
+    uint32_t num_planes;
+    uint32_t pitch[kBufferObjectSize];
+    uint32_t offset[kBufferObjectSize];
+    int32_t status;
+};
+
+/**
+ * @brief send one message, fds are duplicated into the peer with SCM_RIGHTS
+ * @param fds fds to pass, may be nullptr when fd_count is 0
+ */
+bool send_frame_message(int socket_fd, const frame_message &message, const int *fds,
+                        uint32_t fd_count);
+
+/**
+ * @brief receive one message
+ * @param fds receives up to kBufferObjectSize fds, the caller owns them
+ * @param fd_count number of fds received
+ * @return 1 on message, 0 on peer hangup, -1 on error
+ */
+int recv_frame_message(int socket_fd, frame_message *message, int *fds, uint32_t *fd_count);
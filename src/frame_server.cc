@@ -0,0 +1,379 @@
+#include "frame_server.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/udmabuf.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "base/log.h"
+
+bool FrameServer::open(DrmWrapper *drm_wrapper, const char *socket_path) {
+    struct sockaddr_un addr = {};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        base::LogError() << "socket path too long " << socket_path;
+        return false;
+    }
+
+    _listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (_listen_fd < 0) {
+        base::LogError() << "create frame server socket failed reason:" << strerror(errno);
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(_listen_fd, 8) != 0) {
+        base::LogError() << "listen on " << socket_path << " failed reason:" << strerror(errno);
+        ::close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+
+    // optional, lets memfd clients be scanned out without a copy
+    _udmabuf_fd = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (_udmabuf_fd < 0) {
+        base::LogDebug() << "udmabuf not available, memfd buffers are presented by copy";
+    }
+
+    _drm_wrapper = drm_wrapper;
+    _socket_path = socket_path;
+    base::LogInfo() << "frame server listening on " << _socket_path;
+    return true;
+}
+
+bool FrameServer::process_events(int timeout_ms) {
+    if (_listen_fd < 0) {
+        return false;
+    }
+
+    std::vector<struct pollfd> fds;
+    fds.push_back({_listen_fd, POLLIN, 0});
+    for (const auto &client : _clients) {
+        fds.push_back({client.first, POLLIN, 0});
+    }
+
+    int ret = poll(fds.data(), fds.size(), timeout_ms);
+    if (ret < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        base::LogError() << "frame server poll failed reason:" << strerror(errno);
+        return false;
+    }
+
+    for (size_t i = 1; i < fds.size(); i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        auto iter = _clients.find(fds[i].fd);
+        if (iter == _clients.end()) {
+            continue;
+        }
+        if ((fds[i].revents & POLLIN) == 0 || !handle_client_message(&iter->second)) {
+            remove_client(fds[i].fd);
+        }
+    }
+
+    if (fds[0].revents & POLLIN) {
+        accept_client();
+    }
+    return true;
+}
+
+void FrameServer::close() {
+    while (!_clients.empty()) {
+        remove_client(_clients.begin()->first);
+    }
+    if (_udmabuf_fd >= 0) {
+        ::close(_udmabuf_fd);
+        _udmabuf_fd = -1;
+    }
+    if (_listen_fd >= 0) {
+        ::close(_listen_fd);
+        _listen_fd = -1;
+        unlink(_socket_path.c_str());
+    }
+    _drm_wrapper = nullptr;
+}
+
+FrameServer::FrameServer() {
+    _drm_wrapper = nullptr;
+    _listen_fd = -1;
+    _udmabuf_fd = -1;
+    _displayed_client_fd = -1;
+    _displayed_buffer_id = 0;
+}
+
+FrameServer::~FrameServer() {
+    close();
+}
+
+bool FrameServer::accept_client() {
+    int fd = accept4(_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        base::LogWarn() << "accept frame client failed reason:" << strerror(errno);
+        return false;
+    }
+
+    client_connection client;
+    client.fd = fd;
+    _clients[fd] = client;
+    base::LogInfo() << "frame client connected, fd:" << fd;
+    return true;
+}
+
+bool FrameServer::handle_client_message(client_connection *client) {
+    frame_message message = {};
+    int fds[kBufferObjectSize];
+    uint32_t fd_count = 0;
+    int ret = recv_frame_message(client->fd, &message, fds, &fd_count);
+    if (ret <= 0) {
+        return false;
+    }
+
+    switch (message.type) {
+        case frame_message_type::AttachBuffer:
+            if (!attach_buffer(client, message, fds, fd_count)) {
+                send_status(client, frame_message_type::Error, message.buffer_id, -EINVAL);
+            }
+            return true;
+        case frame_message_type::DetachBuffer:
+            detach_buffer(client, message.buffer_id);
+            break;
+        case frame_message_type::PresentFrame:
+            if (!present_buffer(client, message)) {
+                send_status(client, frame_message_type::Error, message.buffer_id, -EINVAL);
+            }
+            break;
+        default:
+            base::LogWarn() << "unexpected frame message type " << (uint32_t)message.type;
+            break;
+    }
+
+    // fds are only expected with AttachBuffer
+    for (uint32_t i = 0; i < fd_count; i++) {
+        ::close(fds[i]);
+    }
+    return true;
+}
+
+bool FrameServer::attach_buffer(client_connection *client, const frame_message &message, int *fds,
+                                uint32_t fd_count) {
+    if (message.num_planes == 0 || message.num_planes > kBufferObjectSize ||
+        fd_count != message.num_planes ||
+        client->buffers.find(message.buffer_id) != client->buffers.end()) {
+        base::LogError() << "invalid attach for buffer " << message.buffer_id;
+        for (uint32_t i = 0; i < fd_count; i++) {
+            ::close(fds[i]);
+        }
+        return false;
+    }
+
+    client_buffer buffer = {};
+    buffer.frame.index = message.buffer_id;
+    buffer.frame.width = message.width;
+    buffer.frame.height = message.height;
+    buffer.frame.format = message.format;
+    buffer.frame.modifier = message.modifier;
+    buffer.frame.num_planes = message.num_planes;
+    for (uint32_t plane = 0; plane < kBufferObjectSize; plane++) {
+        buffer.frame.fd[plane] = plane < fd_count ? fds[plane] : -1;
+        buffer.frame.pitch[plane] = message.pitch[plane];
+        buffer.frame.offset[plane] = message.offset[plane];
+    }
+
+    // dma-buf from a decoder or gpu: scan out directly
+    bool imported = _drm_wrapper->import_dma_buf_frame(buffer.frame, &buffer.fb_id);
+
+    // memfd: wrap into a dma-buf, needs F_SEAL_SHRINK and page aligned size
+    if (!imported && _udmabuf_fd >= 0) {
+        dma_buf_frame wrapped = buffer.frame;
+        bool wrapped_all = true;
+        for (uint32_t plane = 0; plane < wrapped.num_planes; plane++) {
+            wrapped.fd[plane] = -1;
+        }
+        for (uint32_t plane = 0; plane < wrapped.num_planes && wrapped_all; plane++) {
+            struct stat st = {};
+            struct udmabuf_create create = {};
+            if (fstat(buffer.frame.fd[plane], &st) != 0) {
+                wrapped_all = false;
+                break;
+            }
+            create.memfd = buffer.frame.fd[plane];
+            create.flags = UDMABUF_FLAGS_CLOEXEC;
+            create.offset = 0;
+            create.size = st.st_size;
+            wrapped.fd[plane] = ioctl(_udmabuf_fd, UDMABUF_CREATE, &create);
+            wrapped_all = wrapped.fd[plane] >= 0;
+        }
+        if (wrapped_all) {
+            imported = _drm_wrapper->import_dma_buf_frame(wrapped, &buffer.fb_id);
+        }
+        for (uint32_t plane = 0; plane < wrapped.num_planes; plane++) {
+            if (wrapped.fd[plane] >= 0) {
+                ::close(wrapped.fd[plane]);
+            }
+        }
+    }
+
+    if (!imported && !map_client_buffer(&buffer)) {
+        for (uint32_t plane = 0; plane < buffer.frame.num_planes; plane++) {
+            ::close(buffer.frame.fd[plane]);
+        }
+        return false;
+    }
+
+    client->buffers[message.buffer_id] = buffer;
+    base::LogDebug() << "client fd:" << client->fd << " attached buffer " << message.buffer_id
+                     << " " << message.width << "x" << message.height
+                     << (imported ? " zero copy" : " by copy");
+    return true;
+}
+
+void FrameServer::detach_buffer(client_connection *client, uint32_t buffer_id) {
+    auto iter = client->buffers.find(buffer_id);
+    if (iter == client->buffers.end()) {
+        return;
+    }
+
+    // a zero copy buffer on screen stays imported in the wrapper until the next frame
+    if (_displayed_client_fd == client->fd && _displayed_buffer_id == buffer_id) {
+        _displayed_client_fd = -1;
+    }
+
+    client_buffer &buffer = iter->second;
+    if (buffer.fb_id > 0) {
+        _drm_wrapper->release_imported_frame(buffer.fb_id);
+    }
+    for (uint32_t plane = 0; plane < buffer.frame.num_planes; plane++) {
+        if (buffer.vaddr[plane] != NULL) {
+            munmap(buffer.vaddr[plane], buffer.map_size[plane]);
+        }
+        ::close(buffer.frame.fd[plane]);
+    }
+    client->buffers.erase(iter);
+}
+
+bool FrameServer::present_buffer(client_connection *client, const frame_message &message) {
+    auto iter = client->buffers.find(message.buffer_id);
+    if (iter == client->buffers.end()) {
+        base::LogError() << "present of unknown buffer " << message.buffer_id;
+        return false;
+    }
+
+    const client_buffer &buffer = iter->second;
+    if (buffer.fb_id > 0) {
+        if (!_drm_wrapper->present_imported_frame(buffer.fb_id)) {
+            return false;
+        }
+        // the previous buffer left the screen, the new one stays until replaced
+        release_displayed_buffer();
+        _displayed_client_fd = client->fd;
+        _displayed_buffer_id = message.buffer_id;
+        return true;
+    }
+
+    const dma_buf_frame &frame = buffer.frame;
+    bool ret = _drm_wrapper->draw_nv12_planes(
+        buffer.vaddr[0] + frame.offset[0], frame.pitch[0], buffer.vaddr[1] + frame.offset[1],
+        frame.pitch[1], frame.width, frame.height);
+    if (ret) {
+        // the pixels now live in the server swapchain
+        release_displayed_buffer();
+        send_status(client, frame_message_type::FrameReleased, message.buffer_id, 0);
+    }
+    return ret;
+}
+
+bool FrameServer::map_client_buffer(client_buffer *buffer) {
+    dma_buf_frame &frame = buffer->frame;
+    if (frame.format != DRM_FORMAT_NV12 || frame.num_planes != 2 ||
+        frame.modifier != DRM_FORMAT_MOD_LINEAR) {
+        base::LogError() << "only two plane linear nv12 buffers can be presented by copy";
+        return false;
+    }
+
+    bool ret = true;
+    for (uint32_t plane = 0; plane < frame.num_planes; plane++) {
+        struct stat st = {};
+        if (fstat(frame.fd[plane], &st) != 0) {
+            base::LogError() << "fstat client buffer failed reason:" << strerror(errno);
+            ret = false;
+            break;
+        }
+        uint32_t lines = plane == 0 ? frame.height : frame.height / 2;
+        if (frame.pitch[plane] < frame.width ||
+            (uint64_t)frame.offset[plane] + (uint64_t)frame.pitch[plane] * lines >
+                (uint64_t)st.st_size) {
+            base::LogError() << "client buffer plane " << plane << " exceeds its fd size";
+            ret = false;
+            break;
+        }
+
+        void *vaddr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, frame.fd[plane], 0);
+        if (vaddr == MAP_FAILED) {
+            base::LogError() << "mmap client buffer failed reason:" << strerror(errno);
+            ret = false;
+            break;
+        }
+        buffer->vaddr[plane] = (uint8_t *)vaddr;
+        buffer->map_size[plane] = st.st_size;
+    }
+    if (!ret) {
+        // the buffer is dropped, so are the planes mapped before the failing one
+        for (uint32_t plane = 0; plane < frame.num_planes; plane++) {
+            if (buffer->vaddr[plane] != NULL) {
+                munmap(buffer->vaddr[plane], buffer->map_size[plane]);
+                buffer->vaddr[plane] = NULL;
+            }
+        }
+    }
+    return ret;
+}
+
+void FrameServer::release_displayed_buffer() {
+    if (_displayed_client_fd < 0) {
+        return;
+    }
+
+    auto iter = _clients.find(_displayed_client_fd);
+    if (iter != _clients.end()) {
+        send_status(&iter->second, frame_message_type::FrameReleased, _displayed_buffer_id, 0);
+    }
+    _displayed_client_fd = -1;
+}
+
+void FrameServer::remove_client(int fd) {
+    auto iter = _clients.find(fd);
+    if (iter == _clients.end()) {
+        return;
+    }
+
+    client_connection &client = iter->second;
+    while (!client.buffers.empty()) {
+        detach_buffer(&client, client.buffers.begin()->first);
+    }
+    ::close(client.fd);
+    _clients.erase(iter);
+    base::LogInfo() << "frame client disconnected, fd:" << fd;
+}
+
+void FrameServer::send_status(client_connection *client, frame_message_type type,
+                              uint32_t buffer_id, int32_t status) {
+    frame_message message = {};
+    message.type = type;
+    message.buffer_id = buffer_id;
+    message.status = status;
+    send_frame_message(client->fd, message, nullptr, 0);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "drm_wrapper.h"
+#include "frame_protocol.h"
+
+/**
+ * one process owns the display through DrmWrapper and presents frames for
+ * clients connected over a unix socket. dma-buf buffers are imported and scanned
+ * out directly, memfd buffers are turned into dma-bufs with udmabuf when the
+ * kernel allows it and are otherwise mapped and copied once into scanout memory.
+ */
+class FrameServer {
+public:
+    /**
+     * @brief start listening for frame clients
+     * @param drm_wrapper opened display, frames are presented on it
+     * @param socket_path unix socket path, a stale socket file is replaced
+     */
+    bool open(DrmWrapper *drm_wrapper, const char *socket_path);
+    /**
+     * @brief accept new clients and handle pending client messages
+     * @param timeout_ms poll timeout, -1 waits forever
+     */
+    bool process_events(int timeout_ms);
+    /**
+     * @brief number of connected clients
+     */
+    size_t get_client_count() const { return _clients.size(); }
+    /**
+     * @brief disconnect all clients and remove the socket
+     */
+    void close();
+public:
+    FrameServer();
+    ~FrameServer();
+private:
+    struct client_buffer {
+        dma_buf_frame frame;  ///< fds are owned by the server
+        uint32_t fb_id;       ///< 0 when the buffer is presented by copy
+        uint8_t *vaddr[kBufferObjectSize];
+        size_t map_size[kBufferObjectSize];
+    };
+    struct client_connection {
+        int fd;
+        std::map<uint32_t, client_buffer> buffers;
+    };
+    /**
+     * accept one pending client
+    */
+    bool accept_client();
+    /**
+     * handle one message, false when the client has to be dropped
+    */
+    bool handle_client_message(client_connection *client);
+    bool attach_buffer(client_connection *client, const frame_message &message, int *fds,
+                       uint32_t fd_count);
+    void detach_buffer(client_connection *client, uint32_t buffer_id);
+    bool present_buffer(client_connection *client, const frame_message &message);
+    /**
+     * map the planes of a buffer that cannot be scanned out directly
+    */
+    bool map_client_buffer(client_buffer *buffer);
+    /**
+     * send FrameReleased for the buffer that is replaced on screen
+    */
+    void release_displayed_buffer();
+    void remove_client(int fd);
+    void send_status(client_connection *client, frame_message_type type, uint32_t buffer_id,
+                     int32_t status);
+private:
+    DrmWrapper *_drm_wrapper;
+    int _listen_fd;
+    int _udmabuf_fd;
+    std::string _socket_path;
+    std::map<int, client_connection> _clients;
+
+    int _displayed_client_fd;
+    uint32_t _displayed_buffer_id;
+};
@@ -0,0 +1,100 @@
+#include "mode_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "base/log.h"
+#include "drm_utils.h"
+
+bool ModeCache::load(const char *path) {
+    _path = path;
+    _records.clear();
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        int error = errno;
+        if (error == ENOENT) {
+            return true;
+        }
+        // a cache that exists but cannot be read must not be replaced by an empty one
+        base::LogWarn() << "open mode cache " << path << " failed reason:" << strerror(error);
+        _path.clear();
+        return false;
+    }
+    char key[256];
+    char result[16];
+    while (fscanf(fp, "%255s %15s", key, result) == 2) {
+        _records[key] = strcmp(result, "ok") == 0;
+    }
+    fclose(fp);
+    base::LogDebug() << "mode cache " << path << ": " << _records.size() << " records";
+    return true;
+}
+
+bool ModeCache::lookup(const std::string &display, const drmModeModeInfo &mode,
+                       bool *accepted) const {
+    auto iter = _records.find(make_key(display, mode));
+    if (iter == _records.end()) {
+        return false;
+    }
+    *accepted = iter->second;
+    return true;
+}
+
+void ModeCache::record(const std::string &display, const drmModeModeInfo &mode, bool accepted) {
+    std::string key = make_key(display, mode);
+    auto iter = _records.find(key);
+    if (iter != _records.end() && iter->second == accepted) {
+        return;
+    }
+    _records[key] = accepted;
+    if (!_path.empty()) {
+        save();
+    }
+}
+
+std::string ModeCache::display_key(int fd, const drmModeConnector *connector) {
+    char key[64];
+    std::vector<uint8_t> edid;
+    if (drm_get_connector_edid(fd, connector->connector_id, &edid)) {
+        // fnv-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (uint8_t byte : edid) {
+            hash = (hash ^ byte) * 1099511628211ULL;
+        }
+        snprintf(key, sizeof(key), "edid-%016llx", (unsigned long long)hash);
+    } else {
+        snprintf(key, sizeof(key), "connector-%u-%u", connector->connector_type,
+                 connector->connector_type_id);
+    }
+    return key;
+}
+
+std::string ModeCache::make_key(const std::string &display, const drmModeModeInfo &mode) {
+    // the timings, not the name, tell modes apart
+    char key[128];
+    snprintf(key, sizeof(key), "%s/%ux%u@%u/%u,%u/%x", display.c_str(), mode.hdisplay,
+             mode.vdisplay, mode.clock, mode.htotal, mode.vtotal, mode.flags);
+    return key;
+}
+
+bool ModeCache::save() const {
+    // write a new file and rename it, so a crash never leaves half a cache behind
+    std::string tmp_path = _path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL) {
+        base::LogWarn() << "write mode cache " << tmp_path << " failed reason:" << strerror(errno);
+        return false;
+    }
+    for (const auto &record : _records) {
+        fprintf(fp, "%s %s\n", record.first.c_str(), record.second ? "ok" : "fail");
+    }
+    bool ret = fclose(fp) == 0 && rename(tmp_path.c_str(), _path.c_str()) == 0;
+    if (!ret) {
+        base::LogWarn() << "write mode cache " << _path << " failed reason:" << strerror(errno);
+    }
+    return ret;
+}
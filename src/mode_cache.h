@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <map>
+#include <string>
+
+/**
+ * outcome of every mode switch tried on a display, kept in a small text file so a
+ * mode a panel or driver rejected is not tried again in the next session. the
+ * display is identified by a hash of its EDID, so the record follows the panel
+ * across ports and reboots.
+ */
+class ModeCache {
+public:
+    /**
+     * @brief read the records of path, a missing file is an empty cache. a file that cannot
+     *        be read leaves the cache in memory only, it is never overwritten
+     */
+    bool load(const char *path);
+    /**
+     * @brief result of an earlier switch
+     * @return false if the mode was never tried on this display
+     */
+    bool lookup(const std::string &display, const drmModeModeInfo &mode, bool *accepted) const;
+    /**
+     * @brief remember the result of a switch and write the file
+     */
+    void record(const std::string &display, const drmModeModeInfo &mode, bool accepted);
+    /**
+     * @brief stable name of a display, from its EDID when it has one
+     */
+    static std::string display_key(int fd, const drmModeConnector *connector);
+private:
+    static std::string make_key(const std::string &display, const drmModeModeInfo &mode);
+    bool save() const;
+private:
+    std::string _path;
+    std::map<std::string, bool> _records;
+};
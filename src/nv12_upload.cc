@@ -0,0 +1,128 @@
+#include "nv12_upload.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "base/log.h"
+
+/**
+ * copy kBytes, 64 bytes per iteration of a loop the compiler sees the trip count of
+ */
+template <uint32_t kBytes>
+static inline void copy_row(uint8_t *dst, const uint8_t *src) {
+    static_assert(kBytes % 64 == 0, "rows of the fixed kernels are whole 64 byte blocks");
+    for (uint32_t x = 0; x < kBytes; x += 64) {
+#if defined(__ARM_NEON)
+        uint8x16_t a = vld1q_u8(src + x);
+        uint8x16_t b = vld1q_u8(src + x + 16);
+        uint8x16_t c = vld1q_u8(src + x + 32);
+        uint8x16_t d = vld1q_u8(src + x + 48);
+        vst1q_u8(dst + x, a);
+        vst1q_u8(dst + x + 16, b);
+        vst1q_u8(dst + x + 32, c);
+        vst1q_u8(dst + x + 48, d);
+#elif defined(__SSE2__)
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+        _mm_storeu_si128((__m128i *)(dst + x), a);
+        _mm_storeu_si128((__m128i *)(dst + x + 16), b);
+        _mm_storeu_si128((__m128i *)(dst + x + 32), c);
+        _mm_storeu_si128((__m128i *)(dst + x + 48), d);
+#else
+        memcpy(dst + x, src + x, 64);
+#endif
+    }
+}
+
+template <uint32_t kWidth, uint32_t kHeight, uint32_t kStride, uint32_t kPitch>
+static void nv12_upload_fixed(const uint8_t *src_y, int32_t /*src_y_stride*/,
+                              const uint8_t *src_uv, int32_t /*src_uv_stride*/, uint8_t *dst_y,
+                              uint32_t /*dst_y_pitch*/, uint8_t *dst_uv,
+                              uint32_t /*dst_uv_pitch*/, uint32_t /*width*/,
+                              uint32_t /*height*/) {
+    if (kStride == kWidth && kPitch == kWidth) {
+        // both sides packed, each plane is one block
+        memcpy(dst_y, src_y, kWidth * kHeight);
+        memcpy(dst_uv, src_uv, kWidth * kHeight / 2);
+        return;
+    }
+    for (uint32_t i = 0; i < kHeight; i++) {
+        copy_row<kWidth>(dst_y + i * kPitch, src_y + i * kStride);
+    }
+    for (uint32_t i = 0; i < kHeight / 2; i++) {
+        copy_row<kWidth>(dst_uv + i * kPitch, src_uv + i * kStride);
+    }
+}
+
+struct upload_kernel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;  ///< source stride of both planes
+    uint32_t pitch;   ///< destination pitch of both planes
+    nv12_upload_fn upload;
+};
+
+#define NV12_UPLOAD_KERNEL(width, height, stride, pitch) \
+    { width, height, stride, pitch, nv12_upload_fixed<width, height, stride, pitch> }
+
+// clang-format off
+static const upload_kernel kUploadKernels[] = {
+    NV12_UPLOAD_KERNEL(1920, 1080, 1920, 1920),
+    NV12_UPLOAD_KERNEL(1920, 1080, 1920, 2048),
+    NV12_UPLOAD_KERNEL(1920, 1080, 2048, 1920),
+    NV12_UPLOAD_KERNEL(1920, 1080, 2048, 2048),
+    NV12_UPLOAD_KERNEL(3840, 2160, 3840, 3840),
+    NV12_UPLOAD_KERNEL(3840, 2160, 3840, 4096),
+    NV12_UPLOAD_KERNEL(3840, 2160, 4096, 3840),
+    NV12_UPLOAD_KERNEL(3840, 2160, 4096, 4096),
+};
+// clang-format on
+
+#undef NV12_UPLOAD_KERNEL
+
+void nv12_upload_generic(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_uv,
+                         int32_t src_uv_stride, uint8_t *dst_y, uint32_t dst_y_pitch,
+                         uint8_t *dst_uv, uint32_t dst_uv_pitch, uint32_t width,
+                         uint32_t height) {
+    if (src_y_stride == (int32_t)dst_y_pitch && src_uv_stride == (int32_t)dst_uv_pitch &&
+        width == (uint32_t)src_y_stride) {
+        memcpy(dst_y, src_y, width * height);
+        memcpy(dst_uv, src_uv, width * height / 2);
+        return;
+    }
+    // copy Y buffer
+    for (uint32_t i = 0; i < height; i++) {
+        memcpy(dst_y, src_y + i * src_y_stride, width);
+        dst_y += dst_y_pitch;
+    }
+    // copy uv buffer
+    for (uint32_t i = 0; i < height / 2; i++) {
+        memcpy(dst_uv, src_uv + i * src_uv_stride, width);
+        dst_uv += dst_uv_pitch;
+    }
+}
+
+nv12_upload_fn select_nv12_upload(uint32_t width, uint32_t height, int32_t src_y_stride,
+                                  int32_t src_uv_stride, uint32_t dst_y_pitch,
+                                  uint32_t dst_uv_pitch) {
+    if (src_y_stride == src_uv_stride && dst_y_pitch == dst_uv_pitch) {
+        for (const upload_kernel &kernel : kUploadKernels) {
+            if (kernel.width == width && kernel.height == height &&
+                kernel.stride == (uint32_t)src_y_stride && kernel.pitch == dst_y_pitch) {
+                base::LogDebug() << "nv12 upload kernel " << width << "x" << height
+                                 << " stride " << src_y_stride << " pitch " << dst_y_pitch;
+                return kernel.upload;
+            }
+        }
+    }
+    base::LogDebug() << "nv12 upload generic " << width << "x" << height << " stride "
+                     << src_y_stride << " pitch " << dst_y_pitch;
+    return nv12_upload_generic;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * nv12 copies into scanout memory. the common stream geometries get kernels whose
+ * size, stride and pitch are template constants, so the row copy is an unrolled
+ * block loop with a known trip count and no tail; every other geometry takes the
+ * generic runtime copy. pick the kernel once per stream with select_nv12_upload.
+ */
+
+typedef void (*nv12_upload_fn)(const uint8_t *src_y, int32_t src_y_stride,
+                               const uint8_t *src_uv, int32_t src_uv_stride, uint8_t *dst_y,
+                               uint32_t dst_y_pitch, uint8_t *dst_uv, uint32_t dst_uv_pitch,
+                               uint32_t width, uint32_t height);
+
+/**
+ * @brief copy nv12 row by row, any geometry
+ */
+void nv12_upload_generic(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_uv,
+                         int32_t src_uv_stride, uint8_t *dst_y, uint32_t dst_y_pitch,
+                         uint8_t *dst_uv, uint32_t dst_uv_pitch, uint32_t width, uint32_t height);
+
+/**
+ * @brief kernel for a stream geometry, specialized for 1920x1080 and 3840x2160 with packed
+ *        or 256 byte aligned strides, nv12_upload_generic otherwise
+ */
+nv12_upload_fn select_nv12_upload(uint32_t width, uint32_t height, int32_t src_y_stride,
+                                  int32_t src_uv_stride, uint32_t dst_y_pitch,
+                                  uint32_t dst_uv_pitch);
@@ -0,0 +1,331 @@
+#include "pixel_convert.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct matrix_coefficients {
+    int16_t yr, yg, yb;
+    int16_t ur, ug, ub;
+    int16_t vr, vg, vb;
+};
+
+// 8 bit fixed point, limited range output
+static const matrix_coefficients kBt601 = {66, 129, 25, -38, -74, 112, 112, -94, -18};
+static const matrix_coefficients kBt709 = {47, 157, 16, -26, -87, 112, 112, -102, -10};
+
+static inline uint8_t rgb_to_y(const matrix_coefficients &m, int r, int g, int b) {
+    return ((m.yr * r + m.yg * g + m.yb * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t rgb_to_u(const matrix_coefficients &m, int r, int g, int b) {
+    return ((m.ur * r + m.ug * g + m.ub * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t rgb_to_v(const matrix_coefficients &m, int r, int g, int b) {
+    return ((m.vr * r + m.vg * g + m.vb * b + 128) >> 8) + 128;
+}
+
+static void interleave_uv_row(const uint8_t *src_u, const uint8_t *src_v, uint8_t *dst_uv,
+                              int32_t count) {
+    int32_t x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= count; x += 16) {
+        uint8x16x2_t uv;
+        uv.val[0] = vld1q_u8(src_u + x);
+        uv.val[1] = vld1q_u8(src_v + x);
+        vst2q_u8(dst_uv + 2 * x, uv);
+    }
+#elif defined(__SSE2__)
+    for (; x + 16 <= count; x += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i *)(src_u + x));
+        __m128i v = _mm_loadu_si128((const __m128i *)(src_v + x));
+        _mm_storeu_si128((__m128i *)(dst_uv + 2 * x), _mm_unpacklo_epi8(u, v));
+        _mm_storeu_si128((__m128i *)(dst_uv + 2 * x + 16), _mm_unpackhi_epi8(u, v));
+    }
+#endif
+    for (; x < count; x++) {
+        dst_uv[2 * x] = src_u[x];
+        dst_uv[2 * x + 1] = src_v[x];
+    }
+}
+
+void convert_i420_to_nv12(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_u,
+                          int32_t src_u_stride, const uint8_t *src_v, int32_t src_v_stride,
+                          uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                          int32_t dst_uv_pitch, int32_t width, int32_t height) {
+    for (int32_t i = 0; i < height; i++) {
+        memcpy(dst_y + i * dst_y_pitch, src_y + i * src_y_stride, width);
+    }
+    for (int32_t i = 0; i < height / 2; i++) {
+        interleave_uv_row(src_u + i * src_u_stride, src_v + i * src_v_stride,
+                          dst_uv + i * dst_uv_pitch, width / 2);
+    }
+}
+
+/**
+ * two yuyv lines into two Y lines and one UV line
+ */
+static void yuyv_row_pair(const uint8_t *src0, const uint8_t *src1, uint8_t *dst_y0,
+                          uint8_t *dst_y1, uint8_t *dst_uv, int32_t width) {
+    int32_t x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x2_t p0 = vld2q_u8(src0 + 2 * x);
+        uint8x16x2_t p1 = vld2q_u8(src1 + 2 * x);
+        vst1q_u8(dst_y0 + x, p0.val[0]);
+        vst1q_u8(dst_y1 + x, p1.val[0]);
+        vst1q_u8(dst_uv + x, vrhaddq_u8(p0.val[1], p1.val[1]));
+    }
+#elif defined(__SSE2__)
+    const __m128i y_mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * x));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * x + 16));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * x + 16));
+        _mm_storeu_si128((__m128i *)(dst_y0 + x),
+                         _mm_packus_epi16(_mm_and_si128(a0, y_mask), _mm_and_si128(b0, y_mask)));
+        _mm_storeu_si128((__m128i *)(dst_y1 + x),
+                         _mm_packus_epi16(_mm_and_si128(a1, y_mask), _mm_and_si128(b1, y_mask)));
+        __m128i uv0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+        __m128i uv1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+        _mm_storeu_si128((__m128i *)(dst_uv + x), _mm_avg_epu8(uv0, uv1));
+    }
+#endif
+    for (; x < width; x += 2) {
+        dst_y0[x] = src0[2 * x];
+        dst_y0[x + 1] = src0[2 * x + 2];
+        dst_y1[x] = src1[2 * x];
+        dst_y1[x + 1] = src1[2 * x + 2];
+        dst_uv[x] = (src0[2 * x + 1] + src1[2 * x + 1] + 1) >> 1;
+        dst_uv[x + 1] = (src0[2 * x + 3] + src1[2 * x + 3] + 1) >> 1;
+    }
+}
+
+void convert_yuyv_to_nv12(const uint8_t *src, int32_t src_stride, uint8_t *dst_y,
+                          int32_t dst_y_pitch, uint8_t *dst_uv, int32_t dst_uv_pitch,
+                          int32_t width, int32_t height) {
+    for (int32_t i = 0; i < height; i += 2) {
+        yuyv_row_pair(src + i * src_stride, src + (i + 1) * src_stride, dst_y + i * dst_y_pitch,
+                      dst_y + (i + 1) * dst_y_pitch, dst_uv + i / 2 * dst_uv_pitch, width);
+    }
+}
+
+#if defined(__SSE2__) && !defined(__ARM_NEON)
+/**
+ * deinterleave 8 rgba pixels into 16 bit R, G and B lanes
+ */
+static inline void load_rgba8(const uint8_t *src, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i lo = _mm_loadu_si128((const __m128i *)src);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(src + 16));
+    *r = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+                         _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask),
+                         _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+static inline __m128i rgb8_to_y(const matrix_coefficients &m, __m128i r, __m128i g, __m128i b) {
+    // all Y coefficients are positive, the sum fits unsigned 16 bit
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(m.yr)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(m.yg)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(m.yb)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+static inline __m128i rgb_to_chroma(__m128i r, __m128i g, __m128i b, int16_t cr, int16_t cg,
+                                    int16_t cb) {
+    // |sum| stays below 2^15 for 8 bit input
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+    c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+
+/**
+ * average horizontal pairs of two rows, 8 lanes in and 4 lanes out
+ */
+static inline __m128i average_2x2(__m128i row0, __m128i row1) {
+    __m128i sum = _mm_madd_epi16(_mm_add_epi16(row0, row1), _mm_set1_epi16(1));
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+    return _mm_packs_epi32(sum, sum);
+}
+#endif
+
+/**
+ * two rgba lines into two Y lines and one UV line
+ */
+static void rgba_row_pair(const matrix_coefficients &m, const uint8_t *src0, const uint8_t *src1,
+                          uint8_t *dst_y0, uint8_t *dst_y1, uint8_t *dst_uv, int32_t width) {
+    int32_t x = 0;
+#if defined(__ARM_NEON)
+    const uint8x8_t yr = vdup_n_u8(m.yr);
+    const uint8x8_t yg = vdup_n_u8(m.yg);
+    const uint8x8_t yb = vdup_n_u8(m.yb);
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t p0 = vld4_u8(src0 + 4 * x);
+        uint8x8x4_t p1 = vld4_u8(src1 + 4 * x);
+
+        uint16x8_t y0 = vmlal_u8(vmlal_u8(vmull_u8(p0.val[0], yr), p0.val[1], yg), p0.val[2], yb);
+        uint16x8_t y1 = vmlal_u8(vmlal_u8(vmull_u8(p1.val[0], yr), p1.val[1], yg), p1.val[2], yb);
+        y0 = vaddq_u16(y0, vdupq_n_u16(128));
+        y1 = vaddq_u16(y1, vdupq_n_u16(128));
+        vst1_u8(dst_y0 + x, vadd_u8(vshrn_n_u16(y0, 8), vdup_n_u8(16)));
+        vst1_u8(dst_y1 + x, vadd_u8(vshrn_n_u16(y1, 8), vdup_n_u8(16)));
+
+        int16x4_t r = vreinterpret_s16_u16(vshr_n_u16(
+            vadd_u16(vpadal_u8(vpaddl_u8(p0.val[0]), p1.val[0]), vdup_n_u16(2)), 2));
+        int16x4_t g = vreinterpret_s16_u16(vshr_n_u16(
+            vadd_u16(vpadal_u8(vpaddl_u8(p0.val[1]), p1.val[1]), vdup_n_u16(2)), 2));
+        int16x4_t b = vreinterpret_s16_u16(vshr_n_u16(
+            vadd_u16(vpadal_u8(vpaddl_u8(p0.val[2]), p1.val[2]), vdup_n_u16(2)), 2));
+        int16x4_t u = vmla_n_s16(vmla_n_s16(vmul_n_s16(r, m.ur), g, m.ug), b, m.ub);
+        int16x4_t v = vmla_n_s16(vmla_n_s16(vmul_n_s16(r, m.vr), g, m.vg), b, m.vb);
+        u = vadd_s16(vshr_n_s16(vadd_s16(u, vdup_n_s16(128)), 8), vdup_n_s16(128));
+        v = vadd_s16(vshr_n_s16(vadd_s16(v, vdup_n_s16(128)), 8), vdup_n_s16(128));
+        int16x4x2_t uv = vzip_s16(u, v);
+        vst1_u8(dst_uv + x, vqmovun_s16(vcombine_s16(uv.val[0], uv.val[1])));
+    }
+#elif defined(__SSE2__)
+    for (; x + 8 <= width; x += 8) {
+        __m128i r0, g0, b0, r1, g1, b1;
+        load_rgba8(src0 + 4 * x, &r0, &g0, &b0);
+        load_rgba8(src1 + 4 * x, &r1, &g1, &b1);
+
+        __m128i y0 = rgb8_to_y(m, r0, g0, b0);
+        __m128i y1 = rgb8_to_y(m, r1, g1, b1);
+        _mm_storel_epi64((__m128i *)(dst_y0 + x), _mm_packus_epi16(y0, y0));
+        _mm_storel_epi64((__m128i *)(dst_y1 + x), _mm_packus_epi16(y1, y1));
+
+        __m128i r = average_2x2(r0, r1);
+        __m128i g = average_2x2(g0, g1);
+        __m128i b = average_2x2(b0, b1);
+        __m128i u = rgb_to_chroma(r, g, b, m.ur, m.ug, m.ub);
+        __m128i v = rgb_to_chroma(r, g, b, m.vr, m.vg, m.vb);
+        __m128i uv = _mm_unpacklo_epi16(u, v);
+        _mm_storel_epi64((__m128i *)(dst_uv + x), _mm_packus_epi16(uv, uv));
+    }
+#endif
+    for (; x < width; x += 2) {
+        const uint8_t *p00 = src0 + 4 * x;
+        const uint8_t *p01 = p00 + 4;
+        const uint8_t *p10 = src1 + 4 * x;
+        const uint8_t *p11 = p10 + 4;
+        dst_y0[x] = rgb_to_y(m, p00[0], p00[1], p00[2]);
+        dst_y0[x + 1] = rgb_to_y(m, p01[0], p01[1], p01[2]);
+        dst_y1[x] = rgb_to_y(m, p10[0], p10[1], p10[2]);
+        dst_y1[x + 1] = rgb_to_y(m, p11[0], p11[1], p11[2]);
+
+        int r = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+        int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        int b = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+        dst_uv[x] = rgb_to_u(m, r, g, b);
+        dst_uv[x + 1] = rgb_to_v(m, r, g, b);
+    }
+}
+
+void convert_rgba_to_nv12(const uint8_t *src, int32_t src_stride, uint8_t *dst_y,
+                          int32_t dst_y_pitch, uint8_t *dst_uv, int32_t dst_uv_pitch,
+                          int32_t width, int32_t height, color_matrix matrix) {
+    const matrix_coefficients &m = matrix == color_matrix::BT709 ? kBt709 : kBt601;
+    for (int32_t i = 0; i < height; i += 2) {
+        rgba_row_pair(m, src + i * src_stride, src + (i + 1) * src_stride,
+                      dst_y + i * dst_y_pitch, dst_y + (i + 1) * dst_y_pitch,
+                      dst_uv + i / 2 * dst_uv_pitch, width);
+    }
+}
+
+void convert_argb_to_nv12a(const uint8_t *src, int32_t src_stride, int32_t width, int32_t height,
+                           color_matrix matrix, nv12a_image *image) {
+    const matrix_coefficients &m = matrix == color_matrix::BT709 ? kBt709 : kBt601;
+    image->width = width;
+    image->height = height;
+    image->y.resize(width * height);
+    image->y_alpha.resize(width * height);
+    image->uv.resize(width * height / 2);
+    image->uv_alpha.resize(width * height / 2);
+
+    // runs once per osd update, not per frame, so there is no vector path
+    for (int32_t i = 0; i < height; i += 2) {
+        for (int32_t x = 0; x < width; x += 2) {
+            int r = 0, g = 0, b = 0, a = 0;
+            for (int32_t j = 0; j < 4; j++) {
+                int32_t row = i + j / 2;
+                int32_t col = x + j % 2;
+                const uint8_t *p = src + row * src_stride + 4 * col;
+                image->y[row * width + col] = rgb_to_y(m, p[2], p[1], p[0]);
+                image->y_alpha[row * width + col] = p[3];
+                r += p[2] * p[3];
+                g += p[1] * p[3];
+                b += p[0] * p[3];
+                a += p[3];
+            }
+            // alpha weighted, so transparent pixels do not darken the edges
+            if (a > 0) {
+                r = (r + a / 2) / a;
+                g = (g + a / 2) / a;
+                b = (b + a / 2) / a;
+            }
+            uint8_t *uv = &image->uv[i / 2 * width + x];
+            uint8_t *uv_alpha = &image->uv_alpha[i / 2 * width + x];
+            uv[0] = rgb_to_u(m, r, g, b);
+            uv[1] = rgb_to_v(m, r, g, b);
+            uv_alpha[0] = uv_alpha[1] = (a + 2) >> 2;
+        }
+    }
+}
+
+/**
+ * dst = (src * alpha + dst * (255 - alpha)) / 255, rounded
+ */
+static void blend_row(const uint8_t *src, const uint8_t *alpha, uint8_t *dst, int32_t count) {
+    int32_t x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 8 <= count; x += 8) {
+        uint8x8_t a = vld1_u8(alpha + x);
+        uint16x8_t t = vmlal_u8(vmull_u8(vld1_u8(src + x), a), vld1_u8(dst + x), vmvn_u8(a));
+        t = vaddq_u16(t, vdupq_n_u16(128));
+        vst1_u8(dst + x, vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    for (; x + 8 <= count; x += 8) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(alpha + x)), zero);
+        __m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + x)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(dst + x)), zero);
+        // at most 255 * 255 + 128, still fits unsigned 16 bit
+        __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                                _mm_mullo_epi16(d, _mm_sub_epi16(full, a))),
+                                  half);
+        t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(t, t));
+    }
+#endif
+    for (; x < count; x++) {
+        uint32_t t = src[x] * alpha[x] + dst[x] * (255 - alpha[x]) + 128;
+        dst[x] = (t + (t >> 8)) >> 8;
+    }
+}
+
+void blend_nv12a_to_nv12(const nv12a_image &image, int32_t src_x, int32_t src_y, int32_t width,
+                         int32_t height, uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                         int32_t dst_uv_pitch) {
+    for (int32_t i = 0; i < height; i++) {
+        int32_t offset = (src_y + i) * image.width + src_x;
+        blend_row(&image.y[offset], &image.y_alpha[offset], dst_y + i * dst_y_pitch, width);
+    }
+    for (int32_t i = 0; i < height / 2; i++) {
+        int32_t offset = (src_y / 2 + i) * image.width + src_x;
+        blend_row(&image.uv[offset], &image.uv_alpha[offset], dst_uv + i * dst_uv_pitch, width);
+    }
+}
\ No newline at end of file
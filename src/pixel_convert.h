@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * pixel format conversion into nv12. every function reads the source once and
+ * writes straight into the destination planes, which are usually the mapped
+ * dumb buffer, so no intermediate nv12 frame is produced. width and height must
+ * be even.
+ */
+
+enum class color_matrix {
+    BT601,  ///< limited range, sd content
+    BT709,  ///< limited range, hd content
+};
+
+/**
+ * @brief interleave the U and V planes of i420 into the nv12 UV plane, Y is copied
+ */
+void convert_i420_to_nv12(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_u,
+                          int32_t src_u_stride, const uint8_t *src_v, int32_t src_v_stride,
+                          uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                          int32_t dst_uv_pitch, int32_t width, int32_t height);
+
+/**
+ * @brief split packed yuyv 4:2:2 into nv12, chroma of two lines is averaged
+ */
+void convert_yuyv_to_nv12(const uint8_t *src, int32_t src_stride, uint8_t *dst_y,
+                          int32_t dst_y_pitch, uint8_t *dst_uv, int32_t dst_uv_pitch,
+                          int32_t width, int32_t height);
+
+/**
+ * @brief convert rgba (R G B A byte order) into nv12, chroma of each 2x2 block is averaged
+ */
+void convert_rgba_to_nv12(const uint8_t *src, int32_t src_stride, uint8_t *dst_y,
+                          int32_t dst_y_pitch, uint8_t *dst_uv, int32_t dst_uv_pitch,
+                          int32_t width, int32_t height, color_matrix matrix);
+
+/**
+ * argb osd converted once into the video color space, so blending it into each
+ * frame is a per byte interpolation
+ */
+struct nv12a_image {
+    int32_t width;
+    int32_t height;
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> y_alpha;
+    std::vector<uint8_t> uv;        ///< interleaved, width bytes per line
+    std::vector<uint8_t> uv_alpha;  ///< alpha of each UV byte, both bytes of a pair share it
+};
+
+/**
+ * @brief convert straight alpha argb8888 (B G R A byte order) into nv12 plus alpha,
+ *        chroma of each 2x2 block is weighted by alpha
+ */
+void convert_argb_to_nv12a(const uint8_t *src, int32_t src_stride, int32_t width, int32_t height,
+                           color_matrix matrix, nv12a_image *image);
+
+/**
+ * @brief alpha-blend part of an osd into nv12, nothing outside the part is read or written
+ * @param src_x left of the part inside image, even
+ * @param width size of the part, even
+ * @param dst_y destination of the top left pixel of the part
+ */
+void blend_nv12a_to_nv12(const nv12a_image &image, int32_t src_x, int32_t src_y, int32_t width,
+                         int32_t height, uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                         int32_t dst_uv_pitch);
@@ -0,0 +1,309 @@
+#include "pixel_rotate.h"
+
+#include <drm_mode.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// source pixels per side of the block that stays in cache while it is transposed
+static const int32_t kBlockSize = 64;
+static const int32_t kTileSize = 8;
+
+/**
+ * where source pixel (x, y) lands: dst + x * step_x + y * step_y, in bytes
+ */
+struct plane_mapping {
+    int64_t origin;
+    int64_t step_x;
+    int64_t step_y;
+};
+
+static plane_mapping map_plane(int32_t width, int32_t height, int32_t pitch, int32_t pixel_size,
+                               uint64_t rotation) {
+    // destination column and row as x0 + x * xx + y * xy, y0 + x * yx + y * yy
+    int64_t x0 = 0, xx = 1, xy = 0;
+    int64_t y0 = 0, yx = 0, yy = 1;
+    if (rotation & DRM_MODE_REFLECT_X) {
+        x0 = width - 1;
+        xx = -1;
+    }
+    if (rotation & DRM_MODE_REFLECT_Y) {
+        y0 = height - 1;
+        yy = -1;
+    }
+    int64_t t0, tx, ty;
+    switch (rotation & DRM_MODE_ROTATE_MASK) {
+        case DRM_MODE_ROTATE_90:
+            // (x, y) -> (y, width - 1 - x)
+            t0 = x0, tx = xx, ty = xy;
+            x0 = y0, xx = yx, xy = yy;
+            y0 = width - 1 - t0, yx = -tx, yy = -ty;
+            break;
+        case DRM_MODE_ROTATE_180:
+            x0 = width - 1 - x0, xx = -xx, xy = -xy;
+            y0 = height - 1 - y0, yx = -yx, yy = -yy;
+            break;
+        case DRM_MODE_ROTATE_270:
+            // (x, y) -> (height - 1 - y, x)
+            t0 = x0, tx = xx, ty = xy;
+            x0 = height - 1 - y0, xx = -yx, xy = -yy;
+            y0 = t0, yx = tx, yy = ty;
+            break;
+        default:
+            break;
+    }
+
+    plane_mapping mapping;
+    mapping.origin = y0 * pitch + x0 * pixel_size;
+    mapping.step_x = yx * pitch + xx * pixel_size;
+    mapping.step_y = yy * pitch + xy * pixel_size;
+    return mapping;
+}
+
+template <typename T>
+static void map_tile(const uint8_t *src, int32_t src_stride, uint8_t *dst, int64_t step_x,
+                     int64_t step_y, int32_t width, int32_t height) {
+    for (int32_t y = 0; y < height; y++) {
+        const T *row = (const T *)(src + (int64_t)y * src_stride);
+        uint8_t *out = dst + y * step_y;
+        for (int32_t x = 0; x < width; x++) {
+            *(T *)(out + x * step_x) = row[x];
+        }
+    }
+}
+
+/**
+ * transpose an 8x8 tile of T when source rows land in destination columns, i.e.
+ * step_y is one pixel forwards or backwards
+ */
+template <typename T>
+static void transpose_tile(const uint8_t *src, int32_t src_stride, uint8_t *dst, int64_t step_x,
+                           int64_t step_y);
+
+template <>
+void transpose_tile<uint8_t>(const uint8_t *src, int32_t src_stride, uint8_t *dst, int64_t step_x,
+                             int64_t step_y) {
+    // with a backwards step the last source row is the first byte of each output row
+    const uint8_t *rows[kTileSize];
+    for (int32_t i = 0; i < kTileSize; i++) {
+        rows[i] = src + (int64_t)(step_y > 0 ? i : kTileSize - 1 - i) * src_stride;
+    }
+    if (step_y < 0) {
+        dst += (kTileSize - 1) * step_y;
+    }
+#if defined(__ARM_NEON)
+    uint8x8x2_t t01 = vtrn_u8(vld1_u8(rows[0]), vld1_u8(rows[1]));
+    uint8x8x2_t t23 = vtrn_u8(vld1_u8(rows[2]), vld1_u8(rows[3]));
+    uint8x8x2_t t45 = vtrn_u8(vld1_u8(rows[4]), vld1_u8(rows[5]));
+    uint8x8x2_t t67 = vtrn_u8(vld1_u8(rows[6]), vld1_u8(rows[7]));
+    uint16x4x2_t u02 = vtrn_u16(vreinterpret_u16_u8(t01.val[0]), vreinterpret_u16_u8(t23.val[0]));
+    uint16x4x2_t u13 = vtrn_u16(vreinterpret_u16_u8(t01.val[1]), vreinterpret_u16_u8(t23.val[1]));
+    uint16x4x2_t u46 = vtrn_u16(vreinterpret_u16_u8(t45.val[0]), vreinterpret_u16_u8(t67.val[0]));
+    uint16x4x2_t u57 = vtrn_u16(vreinterpret_u16_u8(t45.val[1]), vreinterpret_u16_u8(t67.val[1]));
+    uint32x2x2_t v04 = vtrn_u32(vreinterpret_u32_u16(u02.val[0]), vreinterpret_u32_u16(u46.val[0]));
+    uint32x2x2_t v15 = vtrn_u32(vreinterpret_u32_u16(u13.val[0]), vreinterpret_u32_u16(u57.val[0]));
+    uint32x2x2_t v26 = vtrn_u32(vreinterpret_u32_u16(u02.val[1]), vreinterpret_u32_u16(u46.val[1]));
+    uint32x2x2_t v37 = vtrn_u32(vreinterpret_u32_u16(u13.val[1]), vreinterpret_u32_u16(u57.val[1]));
+    vst1_u8(dst + 0 * step_x, vreinterpret_u8_u32(v04.val[0]));
+    vst1_u8(dst + 1 * step_x, vreinterpret_u8_u32(v15.val[0]));
+    vst1_u8(dst + 2 * step_x, vreinterpret_u8_u32(v26.val[0]));
+    vst1_u8(dst + 3 * step_x, vreinterpret_u8_u32(v37.val[0]));
+    vst1_u8(dst + 4 * step_x, vreinterpret_u8_u32(v04.val[1]));
+    vst1_u8(dst + 5 * step_x, vreinterpret_u8_u32(v15.val[1]));
+    vst1_u8(dst + 6 * step_x, vreinterpret_u8_u32(v26.val[1]));
+    vst1_u8(dst + 7 * step_x, vreinterpret_u8_u32(v37.val[1]));
+#elif defined(__SSE2__)
+    __m128i r[kTileSize];
+    for (int32_t i = 0; i < kTileSize; i++) {
+        r[i] = _mm_loadl_epi64((const __m128i *)rows[i]);
+    }
+    __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+    __m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+    __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+    __m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    // each register now holds two output rows
+    __m128i c[4];
+    c[0] = _mm_unpacklo_epi32(b0, b2);
+    c[1] = _mm_unpackhi_epi32(b0, b2);
+    c[2] = _mm_unpacklo_epi32(b1, b3);
+    c[3] = _mm_unpackhi_epi32(b1, b3);
+    for (int32_t i = 0; i < 4; i++) {
+        _mm_storel_epi64((__m128i *)(dst + (2 * i) * step_x), c[i]);
+        _mm_storel_epi64((__m128i *)(dst + (2 * i + 1) * step_x), _mm_srli_si128(c[i], 8));
+    }
+#else
+    for (int32_t y = 0; y < kTileSize; y++) {
+        for (int32_t x = 0; x < kTileSize; x++) {
+            dst[x * step_x + y] = rows[y][x];
+        }
+    }
+#endif
+}
+
+template <>
+void transpose_tile<uint16_t>(const uint8_t *src, int32_t src_stride, uint8_t *dst,
+                              int64_t step_x, int64_t step_y) {
+    const uint16_t *rows[kTileSize];
+    for (int32_t i = 0; i < kTileSize; i++) {
+        rows[i] =
+            (const uint16_t *)(src + (int64_t)(step_y > 0 ? i : kTileSize - 1 - i) * src_stride);
+    }
+    if (step_y < 0) {
+        dst += (kTileSize - 1) * step_y;
+    }
+#if defined(__ARM_NEON)
+    uint16x8x2_t t01 = vtrnq_u16(vld1q_u16(rows[0]), vld1q_u16(rows[1]));
+    uint16x8x2_t t23 = vtrnq_u16(vld1q_u16(rows[2]), vld1q_u16(rows[3]));
+    uint16x8x2_t t45 = vtrnq_u16(vld1q_u16(rows[4]), vld1q_u16(rows[5]));
+    uint16x8x2_t t67 = vtrnq_u16(vld1q_u16(rows[6]), vld1q_u16(rows[7]));
+    uint32x4x2_t u02 =
+        vtrnq_u32(vreinterpretq_u32_u16(t01.val[0]), vreinterpretq_u32_u16(t23.val[0]));
+    uint32x4x2_t u13 =
+        vtrnq_u32(vreinterpretq_u32_u16(t01.val[1]), vreinterpretq_u32_u16(t23.val[1]));
+    uint32x4x2_t u46 =
+        vtrnq_u32(vreinterpretq_u32_u16(t45.val[0]), vreinterpretq_u32_u16(t67.val[0]));
+    uint32x4x2_t u57 =
+        vtrnq_u32(vreinterpretq_u32_u16(t45.val[1]), vreinterpretq_u32_u16(t67.val[1]));
+    // output row i is the low or high half of the 0123 and 4567 registers of column i
+    uint32x4_t low[4] = {u02.val[0], u13.val[0], u02.val[1], u13.val[1]};
+    uint32x4_t high[4] = {u46.val[0], u57.val[0], u46.val[1], u57.val[1]};
+    for (int32_t i = 0; i < 4; i++) {
+        vst1q_u16((uint16_t *)(dst + i * step_x),
+                  vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(low[i]), vget_low_u32(high[i]))));
+        vst1q_u16(
+            (uint16_t *)(dst + (i + 4) * step_x),
+            vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(low[i]), vget_high_u32(high[i]))));
+    }
+#elif defined(__SSE2__)
+    __m128i r[kTileSize];
+    for (int32_t i = 0; i < kTileSize; i++) {
+        r[i] = _mm_loadu_si128((const __m128i *)rows[i]);
+    }
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    // rows 0-3 and 4-7 of two output rows each
+    __m128i low[4] = {_mm_unpacklo_epi32(a0, a2), _mm_unpackhi_epi32(a0, a2),
+                      _mm_unpacklo_epi32(a1, a3), _mm_unpackhi_epi32(a1, a3)};
+    __m128i high[4] = {_mm_unpacklo_epi32(a4, a6), _mm_unpackhi_epi32(a4, a6),
+                       _mm_unpacklo_epi32(a5, a7), _mm_unpackhi_epi32(a5, a7)};
+    for (int32_t i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(dst + (2 * i) * step_x),
+                         _mm_unpacklo_epi64(low[i], high[i]));
+        _mm_storeu_si128((__m128i *)(dst + (2 * i + 1) * step_x),
+                         _mm_unpackhi_epi64(low[i], high[i]));
+    }
+#else
+    for (int32_t y = 0; y < kTileSize; y++) {
+        for (int32_t x = 0; x < kTileSize; x++) {
+            *(uint16_t *)(dst + x * step_x + y * sizeof(uint16_t)) = rows[y][x];
+        }
+    }
+#endif
+}
+
+template <typename T>
+static void rotate_plane(const uint8_t *src, int32_t src_stride, uint8_t *dst, int32_t dst_pitch,
+                         int32_t width, int32_t height, uint64_t rotation) {
+    plane_mapping mapping = map_plane(width, height, dst_pitch, sizeof(T), rotation);
+    dst += mapping.origin;
+
+    if (mapping.step_x == (int64_t)sizeof(T)) {
+        // rows stay rows and keep their direction
+        for (int32_t y = 0; y < height; y++) {
+            memcpy(dst + y * mapping.step_y, src + (int64_t)y * src_stride, width * sizeof(T));
+        }
+        return;
+    }
+    bool transpose = mapping.step_y == (int64_t)sizeof(T) || mapping.step_y == -(int64_t)sizeof(T);
+    if (!transpose) {
+        map_tile<T>(src, src_stride, dst, mapping.step_x, mapping.step_y, width, height);
+        return;
+    }
+
+    // blocks keep the written destination lines in cache until they are complete
+    for (int32_t block_y = 0; block_y < height; block_y += kBlockSize) {
+        int32_t block_height = height - block_y < kBlockSize ? height - block_y : kBlockSize;
+        for (int32_t block_x = 0; block_x < width; block_x += kBlockSize) {
+            int32_t block_width = width - block_x < kBlockSize ? width - block_x : kBlockSize;
+            for (int32_t y = block_y; y < block_y + block_height; y += kTileSize) {
+                for (int32_t x = block_x; x < block_x + block_width; x += kTileSize) {
+                    const uint8_t *tile_src = src + (int64_t)y * src_stride + x * sizeof(T);
+                    uint8_t *tile_dst = dst + x * mapping.step_x + y * mapping.step_y;
+                    int32_t tile_width = block_x + block_width - x;
+                    int32_t tile_height = block_y + block_height - y;
+                    if (tile_width >= kTileSize && tile_height >= kTileSize) {
+                        transpose_tile<T>(tile_src, src_stride, tile_dst, mapping.step_x,
+                                          mapping.step_y);
+                    } else {
+                        map_tile<T>(tile_src, src_stride, tile_dst, mapping.step_x,
+                                    mapping.step_y, tile_width < kTileSize ? tile_width : kTileSize,
+                                    tile_height < kTileSize ? tile_height : kTileSize);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void rotate_nv12(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_uv,
+                 int32_t src_uv_stride, uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                 int32_t dst_uv_pitch, int32_t width, int32_t height, uint64_t rotation) {
+    rotate_plane<uint8_t>(src_y, src_y_stride, dst_y, dst_y_pitch, width, height, rotation);
+    // a UV pair moves as one 16 bit pixel of the half size chroma plane
+    rotate_plane<uint16_t>(src_uv, src_uv_stride, dst_uv, dst_uv_pitch, width / 2, height / 2,
+                           rotation);
+}
+
+bool rotation_swaps_axes(uint64_t rotation) {
+    return (rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270)) != 0;
+}
+
+static void rotate_point(int32_t width, int32_t height, uint64_t rotation, int32_t *x,
+                         int32_t *y) {
+    int32_t px = (rotation & DRM_MODE_REFLECT_X) ? width - 1 - *x : *x;
+    int32_t py = (rotation & DRM_MODE_REFLECT_Y) ? height - 1 - *y : *y;
+    switch (rotation & DRM_MODE_ROTATE_MASK) {
+        case DRM_MODE_ROTATE_90:
+            *x = py;
+            *y = width - 1 - px;
+            break;
+        case DRM_MODE_ROTATE_180:
+            *x = width - 1 - px;
+            *y = height - 1 - py;
+            break;
+        case DRM_MODE_ROTATE_270:
+            *x = height - 1 - py;
+            *y = px;
+            break;
+        default:
+            *x = px;
+            *y = py;
+            break;
+    }
+}
+
+void rotate_rect(int32_t width, int32_t height, uint64_t rotation, int32_t *x, int32_t *y,
+                 int32_t *rect_width, int32_t *rect_height) {
+    int32_t x0 = *x, y0 = *y;
+    int32_t x1 = *x + *rect_width - 1, y1 = *y + *rect_height - 1;
+    rotate_point(width, height, rotation, &x0, &y0);
+    rotate_point(width, height, rotation, &x1, &y1);
+    *x = x0 < x1 ? x0 : x1;
+    *y = y0 < y1 ? y0 : y1;
+    *rect_width = (x0 < x1 ? x1 - x0 : x0 - x1) + 1;
+    *rect_height = (y0 < y1 ? y1 - y0 : y0 - y1) + 1;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * software fallback for planes without the rotation property. the source is
+ * read once and written straight into the destination planes, usually the
+ * mapped dumb buffer. 90 and 270 degree turns are done as cache blocked 8x8 tile
+ * transposes. width and height must be even.
+ */
+
+/**
+ * @brief rotate and reflect nv12 the way a plane with the same rotation value shows it,
+ *        reflection first, then a counter clockwise rotation
+ * @param width source width, the destination is height x width for 90 and 270
+ * @param rotation one DRM_MODE_ROTATE_* optionally or-ed with DRM_MODE_REFLECT_*
+ */
+void rotate_nv12(const uint8_t *src_y, int32_t src_y_stride, const uint8_t *src_uv,
+                 int32_t src_uv_stride, uint8_t *dst_y, int32_t dst_y_pitch, uint8_t *dst_uv,
+                 int32_t dst_uv_pitch, int32_t width, int32_t height, uint64_t rotation);
+
+/**
+ * @brief true if rotation swaps width and height
+ */
+bool rotation_swaps_axes(uint64_t rotation);
+
+/**
+ * @brief where a rectangle of a width x height frame lands after rotate_nv12
+ */
+void rotate_rect(int32_t width, int32_t height, uint64_t rotation, int32_t *x, int32_t *y,
+                 int32_t *rect_width, int32_t *rect_height);
@@ -0,0 +1,83 @@
+#include "render_thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "base/log.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/**
+ * glibc has no sched_setattr wrapper, this is the kernel layout
+ */
+struct sched_attr_v0 {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+void render_thread_config_init(render_thread_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->policy = SCHED_OTHER;
+    CPU_ZERO(&config->cpus);
+}
+
+bool apply_render_thread_config(const render_thread_config &config, uint64_t refresh_period_ns,
+                                int *policy, int *priority) {
+    bool ret = true;
+    *policy = SCHED_OTHER;
+    *priority = 0;
+
+    // the kernel admits a SCHED_DEADLINE task only while its affinity spans its whole root
+    // domain, a narrower mask makes sched_setattr fail with EPERM. pinning a deadline thread
+    // takes an exclusive cpuset that holds just those cpus, set up outside this process
+    if (CPU_COUNT(&config.cpus) > 0 && config.policy == SCHED_DEADLINE) {
+        base::LogError() << "render thread cpus cannot be combined with SCHED_DEADLINE, "
+                         << "put the process in an exclusive cpuset instead";
+        ret = false;
+    } else if (CPU_COUNT(&config.cpus) > 0) {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(config.cpus), &config.cpus);
+        if (err != 0) {
+            base::LogWarn() << "set render thread affinity failed reason:" << strerror(err);
+            ret = false;
+        }
+    }
+
+    if (config.policy == SCHED_FIFO || config.policy == SCHED_RR) {
+        struct sched_param param = {};
+        param.sched_priority = config.priority;
+        int err = pthread_setschedparam(pthread_self(), config.policy, &param);
+        if (err != 0) {
+            base::LogWarn() << "set render thread priority " << config.priority
+                            << " failed reason:" << strerror(err);
+            return false;
+        }
+        *policy = config.policy;
+        *priority = config.priority;
+    } else if (config.policy == SCHED_DEADLINE) {
+        struct sched_attr_v0 attr = {};
+        attr.size = sizeof(attr);
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_period = config.period_ns > 0 ? config.period_ns : refresh_period_ns;
+        attr.sched_deadline = config.deadline_ns > 0 ? config.deadline_ns : attr.sched_period;
+        attr.sched_runtime = config.runtime_ns > 0 ? config.runtime_ns : attr.sched_period / 2;
+        if (syscall(SYS_sched_setattr, 0, &attr, 0) != 0) {
+            base::LogWarn() << "set render thread deadline " << attr.sched_runtime << "/"
+                            << attr.sched_deadline << "/" << attr.sched_period
+                            << " ns failed reason:" << strerror(errno);
+            return false;
+        }
+        *policy = SCHED_DEADLINE;
+    }
+    return ret;
+}
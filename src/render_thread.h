@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sched.h>
+#include <stdint.h>
+
+class StagingPool;
+
+/**
+ * scheduling of the thread that uploads and presents frames
+ */
+struct render_thread_config {
+    int policy;            ///< SCHED_OTHER, SCHED_FIFO or SCHED_DEADLINE
+    int priority;          ///< SCHED_FIFO priority, 1-99
+    uint64_t runtime_ns;   ///< SCHED_DEADLINE budget per period, 0 uses half the period
+    uint64_t deadline_ns;  ///< SCHED_DEADLINE relative deadline, 0 uses the period
+    uint64_t period_ns;    ///< SCHED_DEADLINE period, 0 uses the refresh interval
+    cpu_set_t cpus;        ///< affinity, an empty set keeps the inherited mask. not applied
+                           ///< with SCHED_DEADLINE, which needs an exclusive cpuset instead
+    bool lock_memory;      ///< mlockall current and future pages, swapchain included
+};
+
+/**
+ * nv12 frame handed to the render thread
+ */
+struct render_frame {
+    const uint8_t *address;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    uint64_t present_time_ns;  ///< CLOCK_MONOTONIC time to show the frame, 0 for the next vblank
+    StagingPool *pool;         ///< address goes back to the pool once uploaded, may be nullptr
+};
+
+/**
+ * what the render thread observed since it started
+ */
+struct render_stats {
+    int policy;    ///< policy the thread really runs with, SCHED_OTHER if raising it failed
+    int priority;
+    uint64_t frames;
+    uint64_t dropped;              ///< frames rejected because the queue was full
+    uint64_t deadline_misses;      ///< frames shown after their present time or a vblank later
+                                   ///< than they were ready for
+    uint64_t preemptions;          ///< involuntary context switches of the render thread
+    uint64_t max_late_us;
+    uint64_t max_wake_us;          ///< longest time from queueing a frame to the idle thread
+                                   ///< running with it
+};
+
+/**
+ * @brief SCHED_OTHER, no affinity and no memory locking
+ */
+void render_thread_config_init(render_thread_config *config);
+
+/**
+ * @brief apply affinity and scheduling policy to the calling thread
+ * @param refresh_period_ns period used when a SCHED_DEADLINE period is not set
+ * @param policy policy the thread ends up with
+ * @param priority priority the thread ends up with
+ * @return false if any part of the config could not be applied
+ */
+bool apply_render_thread_config(const render_thread_config &config, uint64_t refresh_period_ns,
+                                int *policy, int *priority);
@@ -0,0 +1,503 @@
+#include "scanout_capture.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <smmintrin.h>
+#endif
+
+#include "base/log.h"
+#include "drm_utils.h"
+
+// frame buffers stay mapped while the display cycles through its swapchain
+static const uint32_t kMaxMappings = 8;
+
+static bool plane_layout(uint32_t format, uint32_t width, uint32_t height, uint32_t plane,
+                         uint32_t *row_bytes, uint32_t *rows);
+static void stream_copy(uint8_t *dst, const uint8_t *src, size_t size);
+static uint64_t monotonic_us();
+
+bool ScanoutCapture::open(DrmWrapper *drm_wrapper, const char *path, capture_file_format format,
+                          uint32_t ring_size) {
+    if (drm_wrapper == NULL || drm_wrapper->get_fd() < 0 || ring_size == 0) {
+        base::LogError() << "capture needs an open display and a ring";
+        return false;
+    }
+    _file = fopen(path, "wb");
+    if (_file == NULL) {
+        base::LogError() << "open capture file " << path << " failed reason:" << strerror(errno);
+        return false;
+    }
+    _drm_wrapper = drm_wrapper;
+    _format = format;
+    _y4m_header_written = false;
+    // the writer thread must not read the wrapper, it is driven from another thread
+    _refresh_mhz = drm_mode_refresh_mhz(drm_wrapper->get_display_mode());
+    _slots.resize(ring_size);
+    _free_slots.clear();
+    for (uint32_t i = 0; i < ring_size; i++) {
+        _free_slots.push_back(i);
+    }
+    _filled_slots.clear();
+    memset(&_stats, 0, sizeof(_stats));
+
+    _writer_quit = false;
+    int err = pthread_create(&_writer_thread, NULL, writer_thread_main, this);
+    if (err != 0) {
+        base::LogError() << "create capture writer failed reason:" << strerror(err);
+        close();
+        return false;
+    }
+    _writer_running = true;
+    return true;
+}
+
+bool ScanoutCapture::capture() {
+    pthread_mutex_lock(&_capture_mutex);
+    if (!_writer_running) {
+        pthread_mutex_unlock(&_capture_mutex);
+        return false;
+    }
+    // the video may be on an overlay, the crtc only reports the fb of the primary plane
+    int fd = _drm_wrapper->get_fd();
+    drmModePlane *plane = drmModeGetPlane(fd, _drm_wrapper->get_plane_id());
+    uint32_t fb_id = plane != NULL ? plane->fb_id : 0;
+    if (plane != NULL) {
+        drmModeFreePlane(plane);
+    }
+    scanout_mapping *mapping = fb_id != 0 ? get_mapping(fb_id) : NULL;
+    if (mapping == NULL) {
+        pthread_mutex_unlock(&_capture_mutex);
+        return false;
+    }
+
+    pthread_mutex_lock(&_ring_mutex);
+    if (_free_slots.empty()) {
+        _stats.dropped++;
+        pthread_mutex_unlock(&_ring_mutex);
+        pthread_mutex_unlock(&_capture_mutex);
+        return false;
+    }
+    uint32_t index = _free_slots.back();
+    _free_slots.pop_back();
+    pthread_mutex_unlock(&_ring_mutex);
+
+    uint64_t start_us = monotonic_us();
+    copy_frame(*mapping, &_slots[index]);
+    uint64_t copy_us = monotonic_us() - start_us;
+
+    pthread_mutex_lock(&_ring_mutex);
+    _filled_slots.push_back(index);
+    _stats.captured++;
+    if (copy_us > _stats.max_copy_us) {
+        _stats.max_copy_us = copy_us;
+    }
+    pthread_cond_signal(&_ring_cond);
+    pthread_mutex_unlock(&_ring_mutex);
+    pthread_mutex_unlock(&_capture_mutex);
+    return true;
+}
+
+capture_stats ScanoutCapture::get_stats() {
+    pthread_mutex_lock(&_ring_mutex);
+    capture_stats stats = _stats;
+    pthread_mutex_unlock(&_ring_mutex);
+    return stats;
+}
+
+void ScanoutCapture::close() {
+    // a capture() still copying out of a mapping finishes first
+    pthread_mutex_lock(&_capture_mutex);
+    if (_writer_running) {
+        // the writer drains the ring before it quits
+        pthread_mutex_lock(&_ring_mutex);
+        _writer_quit = true;
+        pthread_cond_signal(&_ring_cond);
+        pthread_mutex_unlock(&_ring_mutex);
+        pthread_join(_writer_thread, NULL);
+        _writer_running = false;
+    }
+    if (_file != NULL) {
+        fclose(_file);
+        _file = NULL;
+    }
+    for (auto &mapping : _mappings) {
+        unmap_frame_buffer(&mapping.second);
+    }
+    _mappings.clear();
+    _slots.clear();
+    _free_slots.clear();
+    _filled_slots.clear();
+    _chroma_scratch.clear();
+    _drm_wrapper = NULL;
+    pthread_mutex_unlock(&_capture_mutex);
+}
+
+ScanoutCapture::ScanoutCapture() {
+    _drm_wrapper = NULL;
+    _file = NULL;
+    _format = capture_file_format::Raw;
+    _y4m_header_written = false;
+    _y4m_width = 0;
+    _y4m_height = 0;
+    _refresh_mhz = 0;
+    _use_counter = 0;
+    _writer_running = false;
+    _writer_quit = false;
+    memset(&_stats, 0, sizeof(_stats));
+    pthread_mutex_init(&_capture_mutex, NULL);
+    pthread_mutex_init(&_ring_mutex, NULL);
+    pthread_cond_init(&_ring_cond, NULL);
+}
+
+ScanoutCapture::~ScanoutCapture() {
+    close();
+    pthread_cond_destroy(&_ring_cond);
+    pthread_mutex_destroy(&_ring_mutex);
+    pthread_mutex_destroy(&_capture_mutex);
+}
+
+ScanoutCapture::scanout_mapping *ScanoutCapture::get_mapping(uint32_t fb_id) {
+    // the kernel hands out the id of a removed fb again, the buffer tells them apart. the
+    // gem handle drmModeGetFB2 returns does not, it is a new handle for every call
+    uint64_t removed_frame_buffers = _drm_wrapper->get_removed_frame_buffers();
+    auto iter = _mappings.find(fb_id);
+    if (iter != _mappings.end() &&
+        iter->second.removed_frame_buffers != removed_frame_buffers) {
+        uint64_t inode = 0;
+        if (!get_buffer_inode(fb_id, &inode)) {
+            return NULL;
+        }
+        if (iter->second.buffer_inode != inode) {
+            base::LogDebug() << "fb " << fb_id << " was reused, remap";
+            unmap_frame_buffer(&iter->second);
+            _mappings.erase(iter);
+            iter = _mappings.end();
+        } else {
+            iter->second.removed_frame_buffers = removed_frame_buffers;
+        }
+    }
+    if (iter == _mappings.end()) {
+        if (_mappings.size() >= kMaxMappings) {
+            auto oldest = _mappings.begin();
+            for (auto it = _mappings.begin(); it != _mappings.end(); ++it) {
+                if (it->second.last_use < oldest->second.last_use) {
+                    oldest = it;
+                }
+            }
+            unmap_frame_buffer(&oldest->second);
+            _mappings.erase(oldest);
+        }
+        scanout_mapping mapping;
+        if (!map_frame_buffer(fb_id, &mapping)) {
+            return NULL;
+        }
+        mapping.removed_frame_buffers = removed_frame_buffers;
+        iter = _mappings.insert(std::make_pair(fb_id, mapping)).first;
+    }
+    iter->second.last_use = ++_use_counter;
+    return &iter->second;
+}
+
+bool ScanoutCapture::get_buffer_inode(uint32_t fb_id, uint64_t *inode) {
+    int fd = _drm_wrapper->get_fd();
+    drmModeFB2 *fb = drmModeGetFB2(fd, fb_id);
+    if (fb == NULL) {
+        base::LogError() << "drmModeGetFB2 " << fb_id << " failed reason:" << strerror(errno);
+        return false;
+    }
+    bool ret = false;
+    int prime_fd = -1;
+    struct stat st;
+    if (fb->handles[0] == 0) {
+        base::LogError() << "no handles for fb " << fb_id
+                         << ", capture needs DRM master or CAP_SYS_ADMIN";
+    } else if (drmPrimeHandleToFD(fd, fb->handles[0], DRM_CLOEXEC, &prime_fd) != 0) {
+        base::LogError() << "export fb " << fb_id << " failed reason:" << strerror(errno);
+    } else if (fstat(prime_fd, &st) != 0) {
+        base::LogError() << "fstat fb " << fb_id << " failed reason:" << strerror(errno);
+    } else {
+        // a gem object is exported as the same dma-buf every time
+        *inode = st.st_ino;
+        ret = true;
+    }
+    if (prime_fd >= 0) {
+        ::close(prime_fd);
+    }
+    drm_close_gem_handles(fd, fb->handles, kBufferObjectSize);
+    drmModeFreeFB2(fb);
+    return ret;
+}
+
+bool ScanoutCapture::map_frame_buffer(uint32_t fb_id, scanout_mapping *mapping) {
+    int fd = _drm_wrapper->get_fd();
+    drmModeFB2 *fb = drmModeGetFB2(fd, fb_id);
+    if (fb == NULL) {
+        base::LogError() << "drmModeGetFB2 " << fb_id << " failed reason:" << strerror(errno);
+        return false;
+    }
+
+    memset(mapping, 0, sizeof(*mapping));
+    for (uint32_t i = 0; i < kBufferObjectSize; i++) {
+        mapping->prime_fd[i] = -1;
+    }
+    mapping->width = fb->width;
+    mapping->height = fb->height;
+    mapping->format = fb->pixel_format;
+
+    bool ret = true;
+    if (fb->handles[0] == 0) {
+        base::LogError() << "no handles for fb " << fb_id
+                         << ", capture needs DRM master or CAP_SYS_ADMIN";
+        ret = false;
+    } else if ((fb->flags & DRM_MODE_FB_MODIFIERS) && fb->modifier != DRM_FORMAT_MOD_LINEAR) {
+        base::LogError() << "fb " << fb_id << " is not linear, modifier 0x" << std::hex
+                         << fb->modifier;
+        ret = false;
+    }
+    uint32_t row_bytes = 0;
+    uint32_t rows = 0;
+    for (uint32_t plane = 0; ret && plane < kBufferObjectSize &&
+                             plane_layout(fb->pixel_format, fb->width, fb->height, plane,
+                                          &row_bytes, &rows);
+         plane++) {
+        // map from the start of the buffer, offsets need not be page aligned
+        mapping->map_size[plane] = fb->offsets[plane] + (size_t)fb->pitches[plane] * rows;
+        if (drmPrimeHandleToFD(fd, fb->handles[plane], DRM_CLOEXEC,
+                               &mapping->prime_fd[plane]) != 0) {
+            base::LogError() << "export fb " << fb_id << " failed reason:" << strerror(errno);
+            ret = false;
+            break;
+        }
+        void *address = mmap(NULL, mapping->map_size[plane], PROT_READ, MAP_SHARED,
+                             mapping->prime_fd[plane], 0);
+        if (address == MAP_FAILED) {
+            base::LogError() << "mmap fb " << fb_id << " failed reason:" << strerror(errno);
+            ret = false;
+            break;
+        }
+        mapping->map_address[plane] = (uint8_t *)address;
+        mapping->vaddr[plane] = mapping->map_address[plane] + fb->offsets[plane];
+        mapping->pitch[plane] = fb->pitches[plane];
+        mapping->num_planes = plane + 1;
+    }
+    struct stat st;
+    if (ret && fstat(mapping->prime_fd[0], &st) == 0) {
+        mapping->buffer_inode = st.st_ino;
+    }
+    if (ret && mapping->num_planes == 0) {
+        base::LogError() << "cannot capture format 0x" << std::hex << fb->pixel_format;
+        ret = false;
+    }
+    // the dma-bufs keep the buffers alive
+    drm_close_gem_handles(fd, fb->handles, kBufferObjectSize);
+    drmModeFreeFB2(fb);
+    if (!ret) {
+        unmap_frame_buffer(mapping);
+        return false;
+    }
+    base::LogDebug() << "capture fb " << fb_id << ": " << mapping->width << "x"
+                     << mapping->height << " / " << mapping->num_planes << " planes";
+    return true;
+}
+
+void ScanoutCapture::unmap_frame_buffer(scanout_mapping *mapping) {
+    for (uint32_t i = 0; i < kBufferObjectSize; i++) {
+        if (mapping->map_address[i] != NULL) {
+            munmap(mapping->map_address[i], mapping->map_size[i]);
+            mapping->map_address[i] = NULL;
+        }
+        if (mapping->prime_fd[i] >= 0) {
+            ::close(mapping->prime_fd[i]);
+            mapping->prime_fd[i] = -1;
+        }
+    }
+}
+
+void ScanoutCapture::copy_frame(const scanout_mapping &mapping, capture_slot *slot) {
+    size_t size = 0;
+    uint32_t row_bytes[kBufferObjectSize];
+    uint32_t rows[kBufferObjectSize];
+    for (uint32_t plane = 0; plane < mapping.num_planes; plane++) {
+        plane_layout(mapping.format, mapping.width, mapping.height, plane, &row_bytes[plane],
+                     &rows[plane]);
+        size += (size_t)row_bytes[plane] * rows[plane];
+    }
+    slot->data.resize(size);
+    slot->width = mapping.width;
+    slot->height = mapping.height;
+    slot->format = mapping.format;
+
+    struct dma_buf_sync sync = {};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    for (uint32_t plane = 0; plane < mapping.num_planes; plane++) {
+        ioctl(mapping.prime_fd[plane], DMA_BUF_IOCTL_SYNC, &sync);
+    }
+    uint8_t *dst = slot->data.data();
+    for (uint32_t plane = 0; plane < mapping.num_planes; plane++) {
+        const uint8_t *src = mapping.vaddr[plane];
+        for (uint32_t i = 0; i < rows[plane]; i++) {
+            stream_copy(dst, src, row_bytes[plane]);
+            dst += row_bytes[plane];
+            src += mapping.pitch[plane];
+        }
+    }
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    for (uint32_t plane = 0; plane < mapping.num_planes; plane++) {
+        ioctl(mapping.prime_fd[plane], DMA_BUF_IOCTL_SYNC, &sync);
+    }
+}
+
+void *ScanoutCapture::writer_thread_main(void *user_data) {
+    ScanoutCapture *capture = (ScanoutCapture *)user_data;
+    capture->writer_loop();
+    return NULL;
+}
+
+void ScanoutCapture::writer_loop() {
+    for (;;) {
+        pthread_mutex_lock(&_ring_mutex);
+        while (_filled_slots.empty() && !_writer_quit) {
+            pthread_cond_wait(&_ring_cond, &_ring_mutex);
+        }
+        if (_filled_slots.empty()) {
+            pthread_mutex_unlock(&_ring_mutex);
+            break;
+        }
+        uint32_t index = _filled_slots.front();
+        _filled_slots.pop_front();
+        pthread_mutex_unlock(&_ring_mutex);
+
+        bool written = write_frame(_slots[index]);
+
+        pthread_mutex_lock(&_ring_mutex);
+        _free_slots.push_back(index);
+        if (written) {
+            _stats.written++;
+        }
+        pthread_mutex_unlock(&_ring_mutex);
+    }
+    fflush(_file);
+}
+
+bool ScanoutCapture::write_frame(const capture_slot &slot) {
+    if (_format == capture_file_format::Raw) {
+        return fwrite(slot.data.data(), 1, slot.data.size(), _file) == slot.data.size();
+    }
+
+    if (slot.format != DRM_FORMAT_NV12) {
+        base::LogError() << "y4m capture needs a nv12 scanout, got format 0x" << std::hex
+                         << slot.format;
+        return false;
+    }
+    if (!_y4m_header_written) {
+        fprintf(_file, "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C420mpeg2\n", slot.width, slot.height,
+                _refresh_mhz > 0 ? _refresh_mhz : 60000);
+        _y4m_width = slot.width;
+        _y4m_height = slot.height;
+        _y4m_header_written = true;
+    }
+    if (slot.width != _y4m_width || slot.height != _y4m_height) {
+        // a y4m stream has one frame size
+        return false;
+    }
+
+    // nv12 interleaves U and V, y4m stores the two planes one after the other
+    size_t luma_size = (size_t)slot.width * slot.height;
+    size_t chroma_size = (size_t)(slot.width / 2) * (slot.height / 2);
+    _chroma_scratch.resize(chroma_size * 2);
+    const uint8_t *uv = slot.data.data() + luma_size;
+    uint8_t *u = _chroma_scratch.data();
+    uint8_t *v = u + chroma_size;
+    for (size_t i = 0; i < chroma_size; i++) {
+        u[i] = uv[i * 2];
+        v[i] = uv[i * 2 + 1];
+    }
+    return fputs("FRAME\n", _file) >= 0 &&
+           fwrite(slot.data.data(), 1, luma_size, _file) == luma_size &&
+           fwrite(_chroma_scratch.data(), 1, chroma_size * 2, _file) == chroma_size * 2;
+}
+
+/**
+ * packed size of one plane of a frame, false past the last plane or for unknown formats
+ */
+static bool plane_layout(uint32_t format, uint32_t width, uint32_t height, uint32_t plane,
+                         uint32_t *row_bytes, uint32_t *rows) {
+    switch (format) {
+        case DRM_FORMAT_NV12:
+            if (plane > 1) {
+                return false;
+            }
+            *row_bytes = (width + 1) & ~1u;
+            *rows = plane == 0 ? height : (height + 1) / 2;
+            return true;
+        case DRM_FORMAT_XRGB8888:
+        case DRM_FORMAT_ARGB8888:
+        case DRM_FORMAT_XBGR8888:
+        case DRM_FORMAT_ABGR8888:
+            *row_bytes = width * 4;
+            *rows = height;
+            return plane == 0;
+        case DRM_FORMAT_RGB565:
+            *row_bytes = width * 2;
+            *rows = height;
+            return plane == 0;
+        default:
+            return false;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * movntdqa reads write-combined memory a cache line at a time instead of a word at a time
+ */
+__attribute__((target("sse4.1"))) static void stream_copy_sse41(uint8_t *dst, const uint8_t *src,
+                                                                 size_t size) {
+    size_t head = (16 - ((uintptr_t)src & 15)) & 15;
+    if (head > size) {
+        head = size;
+    }
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+    for (; size >= 64; size -= 64, src += 64, dst += 64) {
+        __m128i a = _mm_stream_load_si128((__m128i *)src);
+        __m128i b = _mm_stream_load_si128((__m128i *)(src + 16));
+        __m128i c = _mm_stream_load_si128((__m128i *)(src + 32));
+        __m128i d = _mm_stream_load_si128((__m128i *)(src + 48));
+        _mm_storeu_si128((__m128i *)dst, a);
+        _mm_storeu_si128((__m128i *)(dst + 16), b);
+        _mm_storeu_si128((__m128i *)(dst + 32), c);
+        _mm_storeu_si128((__m128i *)(dst + 48), d);
+    }
+    memcpy(dst, src, size);
+}
+#endif
+
+static void stream_copy(uint8_t *dst, const uint8_t *src, size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+    if (has_sse41) {
+        stream_copy_sse41(dst, src, size);
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+static uint64_t monotonic_us() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
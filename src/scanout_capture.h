@@ -0,0 +1,121 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "drm_wrapper.h"
+
+enum class capture_file_format {
+    Raw,  ///< frames as scanned out, rows packed without padding
+    Y4M,  ///< yuv4mpeg2 4:2:0, nv12 scanout only
+};
+
+/**
+ * @brief counters of a running capture
+ */
+struct capture_stats {
+    uint64_t captured;  ///< frames copied out of scanout memory
+    uint64_t written;   ///< frames written to the file
+    uint64_t dropped;   ///< frames skipped because every ring buffer was still being written
+    uint64_t max_copy_us;
+};
+
+/**
+ * reads back what the video plane of a DrmWrapper scans out. the frame buffer on screen is
+ * looked up with drmModeGetFB2, mapped once through a dma-buf and copied with
+ * streaming loads, which read write-combined scanout memory at full speed, into a
+ * ring of buffers. a background thread writes the ring to a file, so capture()
+ * costs one copy and never waits for the disk; when the writer falls behind frames
+ * are dropped instead. getting the buffer handles needs DRM master or CAP_SYS_ADMIN.
+ */
+class ScanoutCapture {
+public:
+    /**
+     * @brief start a capture into a file
+     * @param drm_wrapper opened display whose video plane is captured, osd and layers on
+     *        planes of their own are not part of the capture
+     * @param ring_size frames that may wait for the writer
+     */
+    bool open(DrmWrapper *drm_wrapper, const char *path, capture_file_format format,
+              uint32_t ring_size);
+    /**
+     * @brief copy the frame on screen into the ring, callable from any thread
+     * @return false when the frame was dropped or could not be read
+     */
+    bool capture();
+    capture_stats get_stats();
+    /**
+     * @brief write the frames still in the ring and close the file
+     */
+    void close();
+public:
+    ScanoutCapture();
+    ~ScanoutCapture();
+private:
+    struct scanout_mapping {
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t num_planes;
+        int prime_fd[kBufferObjectSize];
+        const uint8_t *vaddr[kBufferObjectSize];  ///< start of the plane
+        uint8_t *map_address[kBufferObjectSize];
+        size_t map_size[kBufferObjectSize];
+        uint32_t pitch[kBufferObjectSize];
+        uint64_t last_use;
+        uint64_t buffer_inode;  ///< dma-buf of plane 0, tells a reused fb id apart
+        uint64_t removed_frame_buffers;  ///< of the wrapper when the fb id was last checked
+    };
+    struct capture_slot {
+        std::vector<uint8_t> data;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+    };
+    /**
+     * mapping of a frame buffer, created on first use. the buffer behind the id is only
+     * checked again after the wrapper removed frame buffers
+    */
+    scanout_mapping *get_mapping(uint32_t fb_id);
+    /**
+     * inode of the dma-buf behind plane 0 of a frame buffer
+    */
+    bool get_buffer_inode(uint32_t fb_id, uint64_t *inode);
+    bool map_frame_buffer(uint32_t fb_id, scanout_mapping *mapping);
+    void unmap_frame_buffer(scanout_mapping *mapping);
+    /**
+     * copy the planes of a mapping packed into a ring buffer
+    */
+    void copy_frame(const scanout_mapping &mapping, capture_slot *slot);
+    static void *writer_thread_main(void *user_data);
+    void writer_loop();
+    bool write_frame(const capture_slot &slot);
+private:
+    DrmWrapper *_drm_wrapper;
+    FILE *_file;
+    capture_file_format _format;
+    bool _y4m_header_written;
+    uint32_t _y4m_width;
+    uint32_t _y4m_height;
+    uint32_t _refresh_mhz;  ///< of the display mode when the capture started
+    std::vector<uint8_t> _chroma_scratch;  ///< deinterleaved U and V of one y4m frame
+    std::map<uint32_t, scanout_mapping> _mappings;
+    uint64_t _use_counter;
+    pthread_mutex_t _capture_mutex;  ///< serializes capture() callers and close()
+
+    std::vector<capture_slot> _slots;
+    std::vector<uint32_t> _free_slots;
+    std::deque<uint32_t> _filled_slots;
+    bool _writer_running;
+    bool _writer_quit;
+    pthread_t _writer_thread;
+    pthread_mutex_t _ring_mutex;
+    pthread_cond_t _ring_cond;
+    capture_stats _stats;
+};
@@ -0,0 +1,106 @@
+#include "staging_pool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "base/log.h"
+
+static const size_t kCacheLineSize = 64;
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+bool StagingPool::open(size_t buffer_size, uint32_t count, bool huge_pages /*= false*/,
+                       bool lock /*= false*/) {
+    if (buffer_size == 0 || count == 0) {
+        base::LogError() << "invalid staging pool size";
+        return false;
+    }
+    _buffer_size = (buffer_size + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+    _map_size = _buffer_size * count;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+    void *vaddr = MAP_FAILED;
+    if (huge_pages) {
+        size_t huge_size = (_map_size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        vaddr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (vaddr != MAP_FAILED) {
+            _map_size = huge_size;
+        } else {
+            base::LogWarn() << "no hugetlb pages for the staging pool, using transparent huge "
+                               "pages reason:"
+                            << strerror(errno);
+        }
+    }
+    if (vaddr == MAP_FAILED) {
+        vaddr = mmap(NULL, _map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (vaddr == MAP_FAILED) {
+            base::LogError() << "mmap staging pool failed reason:" << strerror(errno);
+            return false;
+        }
+        if (huge_pages) {
+            madvise(vaddr, _map_size, MADV_HUGEPAGE);
+        }
+    }
+    _vaddr = (uint8_t *)vaddr;
+
+    if (lock) {
+        _locked = mlock(_vaddr, _map_size) == 0;
+        if (!_locked) {
+            base::LogWarn() << "mlock staging pool failed reason:" << strerror(errno);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    _free_buffers.clear();
+    for (uint32_t i = count; i > 0; i--) {
+        _free_buffers.push_back(_vaddr + (size_t)(i - 1) * _buffer_size);
+    }
+    base::LogDebug() << "staging pool: " << count << " buffers of " << _buffer_size
+                     << " bytes / huge pages (" << (huge_pages ? "✓" : "✗") << ") / locked ("
+                     << (_locked ? "✓" : "✗") << ")";
+    return true;
+}
+
+uint8_t *StagingPool::acquire() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (_free_buffers.empty()) {
+        return nullptr;
+    }
+    uint8_t *buffer = _free_buffers.back();
+    _free_buffers.pop_back();
+    return buffer;
+}
+
+void StagingPool::release(uint8_t *buffer) {
+    if (buffer == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(_mutex);
+    _free_buffers.push_back(buffer);
+}
+
+void StagingPool::close() {
+    if (_vaddr == NULL) {
+        return;
+    }
+    if (_locked) {
+        munlock(_vaddr, _map_size);
+        _locked = false;
+    }
+    munmap(_vaddr, _map_size);
+    _vaddr = NULL;
+    _map_size = 0;
+    std::lock_guard<std::mutex> guard(_mutex);
+    _free_buffers.clear();
+}
+
+StagingPool::StagingPool() {
+    _vaddr = NULL;
+    _map_size = 0;
+    _buffer_size = 0;
+    _locked = false;
+}
+
+StagingPool::~StagingPool() {
+    close();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+/**
+ * fixed set of equally sized staging buffers carved out of one mapping. the
+ * mapping is populated when the pool opens and can be locked, so frames written
+ * on the render path never take page faults. buffers are recycled through
+ * acquire/release instead of being allocated per frame.
+ */
+class StagingPool {
+public:
+    /**
+     * @brief map and prefault the pool
+     * @param buffer_size bytes per buffer, rounded up to a 64 byte cache line
+     * @param count number of buffers
+     * @param huge_pages back the pool with huge pages when the system has them
+     * @param lock mlock the pool, needs RLIMIT_MEMLOCK or CAP_IPC_LOCK
+     */
+    bool open(size_t buffer_size, uint32_t count, bool huge_pages = false, bool lock = false);
+    /**
+     * @brief take a free buffer, safe to call from any thread
+     * @return buffer of at least buffer_size bytes, nullptr when every buffer is in use
+     */
+    uint8_t *acquire();
+    /**
+     * @brief give a buffer from acquire back to the pool
+     */
+    void release(uint8_t *buffer);
+    size_t get_buffer_size() const {
+        return _buffer_size;
+    }
+    /**
+     * @brief unmap the pool, every buffer must be released
+     */
+    void close();
+public:
+    StagingPool();
+    ~StagingPool();
+private:
+    std::mutex _mutex;
+    uint8_t *_vaddr;
+    size_t _map_size;
+    size_t _buffer_size;
+    bool _locked;
+    std::vector<uint8_t *> _free_buffers;
+};
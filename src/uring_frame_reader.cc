@@ -0,0 +1,395 @@
+#include "uring_frame_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "base/log.h"
+
+static const uint32_t kBufferAlignment = 4096;
+// user_data of the cancel requests, slot indices are small
+static const uint64_t kCancelUserData = ~0ULL;
+
+bool UringFrameReader::open(int fd, uint32_t frame_size, uint32_t queue_depth) {
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || frame_size == 0 || queue_depth == 0) {
+        base::LogError() << "invalid uring frame reader input";
+        return false;
+    }
+    _fd = fd;
+    _frame_size = frame_size;
+    _seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+    _base_offset = _seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+
+    if (fcntl(fd, F_GETFL) & O_DIRECT) {
+        int block_size = st.st_blksize;
+        if (S_ISBLK(st.st_mode)) {
+            ioctl(fd, BLKSSZGET, &block_size);
+        }
+        if (block_size <= 0 || frame_size % block_size != 0 || _base_offset % block_size != 0) {
+            base::LogError() << "O_DIRECT needs frames aligned to the " << block_size
+                             << " byte block size, frame size is " << frame_size;
+            return false;
+        }
+    }
+
+    // one extra buffer stays with the consumer while queue_depth reads are in flight
+    uint32_t slot_count = queue_depth + 1;
+    uint32_t entries = 1;
+    while (entries < slot_count) {
+        entries <<= 1;
+    }
+    if (!setup_ring(entries)) {
+        close();
+        return false;
+    }
+
+    _buffer_size = (frame_size + kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+    std::vector<struct iovec> iovecs(slot_count);
+    _slots.resize(slot_count);
+    for (uint32_t i = 0; i < slot_count; i++) {
+        void *vaddr = NULL;
+        if (posix_memalign(&vaddr, kBufferAlignment, _buffer_size) != 0) {
+            base::LogError() << "allocate uring frame buffer failed";
+            close();
+            return false;
+        }
+        _slots[i].vaddr = (uint8_t *)vaddr;
+        _slots[i].filled = 0;
+        _slots[i].frame_index = 0;
+        _slots[i].state = slot_state::Free;
+        iovecs[i].iov_base = vaddr;
+        iovecs[i].iov_len = _buffer_size;
+    }
+
+    // fixed buffers skip the per read page pinning, fall back to plain reads if
+    // RLIMIT_MEMLOCK does not allow registering the pool
+    _fixed_buffers = syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_BUFFERS,
+                             iovecs.data(), slot_count) == 0;
+    if (!_fixed_buffers) {
+        base::LogWarn() << "io_uring buffer registration failed, using plain reads reason:"
+                        << strerror(errno);
+    }
+
+    base::LogDebug() << "uring frame reader: " << slot_count << " buffers of " << _buffer_size
+                     << " bytes, " << (_seekable ? "seekable" : "stream") << " input";
+    submit_reads();
+    return enter(_pending_submit, 0);
+}
+
+uint8_t *UringFrameReader::acquire_frame() {
+    if (_acquired_slot >= 0) {
+        release_frame();
+    }
+
+    while (!_error) {
+        bool pending = false;
+        for (uint32_t i = 0; i < _slots.size(); i++) {
+            frame_slot &slot = _slots[i];
+            if (slot.state == slot_state::Free || slot.frame_index != _next_acquire_frame) {
+                continue;
+            }
+            if (slot.state == slot_state::Ready) {
+                slot.state = slot_state::Acquired;
+                _acquired_slot = i;
+                _next_acquire_frame++;
+                return slot.vaddr;
+            }
+            pending = true;
+        }
+        if (!pending && _eof) {
+            return nullptr;
+        }
+
+        submit_reads();
+        if (!enter(_pending_submit, 1)) {
+            return nullptr;
+        }
+        reap_completions();
+    }
+    return nullptr;
+}
+
+void UringFrameReader::release_frame() {
+    if (_acquired_slot < 0) {
+        return;
+    }
+    _slots[_acquired_slot].state = slot_state::Free;
+    _acquired_slot = -1;
+
+    submit_reads();
+    enter(_pending_submit, 0);
+}
+
+void UringFrameReader::close() {
+    // the ring is torn down asynchronously, a read still running after the ring fd is
+    // closed would write into freed slot buffers
+    bool reads_done = _ring_fd < 0 || cancel_reads();
+
+    if (_sqes != NULL) {
+        munmap(_sqes, _sqes_size);
+        _sqes = NULL;
+    }
+    if (_cq_ring != NULL && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    _cq_ring = NULL;
+    if (_sq_ring != NULL) {
+        munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = NULL;
+    }
+    if (_ring_fd >= 0) {
+        ::close(_ring_fd);
+        _ring_fd = -1;
+    }
+
+    if (reads_done) {
+        for (frame_slot &slot : _slots) {
+            free(slot.vaddr);
+        }
+    } else {
+        base::LogError() << "io_uring reads did not complete, leaking the frame buffers";
+    }
+    _slots.clear();
+
+    _fd = -1;
+    _eof = false;
+    _error = false;
+    _closing = false;
+    _next_read_frame = 0;
+    _next_acquire_frame = 0;
+    _acquired_slot = -1;
+    _in_flight = 0;
+    _pending_submit = 0;
+}
+
+UringFrameReader::UringFrameReader() {
+    _fd = -1;
+    _ring_fd = -1;
+    _frame_size = 0;
+    _buffer_size = 0;
+    _base_offset = 0;
+    _seekable = false;
+    _fixed_buffers = false;
+    _eof = false;
+    _error = false;
+    _closing = false;
+
+    _next_read_frame = 0;
+    _next_acquire_frame = 0;
+    _acquired_slot = -1;
+    _in_flight = 0;
+    _pending_submit = 0;
+
+    _sq_ring = NULL;
+    _sq_ring_size = 0;
+    _cq_ring = NULL;
+    _cq_ring_size = 0;
+    _sqes = NULL;
+    _sqes_size = 0;
+}
+
+UringFrameReader::~UringFrameReader() {
+    close();
+}
+
+bool UringFrameReader::setup_ring(uint32_t entries) {
+    struct io_uring_params params = {};
+    _ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (_ring_fd < 0) {
+        base::LogError() << "io_uring_setup failed reason:" << strerror(errno);
+        return false;
+    }
+
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && _cq_ring_size > _sq_ring_size) {
+        _sq_ring_size = _cq_ring_size;
+    }
+
+    _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        _sq_ring = NULL;
+        base::LogError() << "mmap io_uring sq ring failed reason:" << strerror(errno);
+        return false;
+    }
+    if (single_mmap) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        _ring_fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            _cq_ring = NULL;
+            base::LogError() << "mmap io_uring cq ring failed reason:" << strerror(errno);
+            return false;
+        }
+    }
+
+    _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        base::LogError() << "mmap io_uring sqes failed reason:" << strerror(errno);
+        return false;
+    }
+    _sqes = (struct io_uring_sqe *)sqes;
+
+    uint8_t *sq = (uint8_t *)_sq_ring;
+    _sq_head = (uint32_t *)(sq + params.sq_off.head);
+    _sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    _sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    _sq_array = (uint32_t *)(sq + params.sq_off.array);
+    uint8_t *cq = (uint8_t *)_cq_ring;
+    _cq_head = (uint32_t *)(cq + params.cq_off.head);
+    _cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    _cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void UringFrameReader::submit_reads() {
+    for (uint32_t i = 0; i < _slots.size() && !_eof && !_error; i++) {
+        // a stream has no offsets, so reads must not overlap to keep frame order
+        if (!_seekable && _in_flight > 0) {
+            break;
+        }
+        frame_slot &slot = _slots[i];
+        if (slot.state != slot_state::Free) {
+            continue;
+        }
+        slot.filled = 0;
+        slot.frame_index = _next_read_frame++;
+        slot.state = slot_state::Reading;
+        queue_read(i);
+    }
+}
+
+void UringFrameReader::queue_read(uint32_t slot_index) {
+    frame_slot &slot = _slots[slot_index];
+
+    uint32_t tail = *_sq_tail;
+    uint32_t index = tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = _fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = _fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot.vaddr + slot.filled);
+    sqe->len = _frame_size - slot.filled;
+    sqe->off = _seekable ? _base_offset + slot.frame_index * _frame_size + slot.filled
+                         : (uint64_t)-1;
+    sqe->buf_index = _fixed_buffers ? slot_index : 0;
+    sqe->user_data = slot_index;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    _in_flight++;
+    _pending_submit++;
+}
+
+bool UringFrameReader::cancel_reads() {
+    _closing = true;
+    // reads still in the submission ring go to the kernel first, so they can be cancelled
+    if (!enter(_pending_submit, 0)) {
+        return false;
+    }
+    uint32_t cancels = 0;
+    for (uint32_t i = 0; i < _slots.size(); i++) {
+        if (_slots[i].state != slot_state::Reading) {
+            continue;
+        }
+        uint32_t tail = *_sq_tail;
+        uint32_t index = tail & *_sq_mask;
+        struct io_uring_sqe *sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = i;
+        sqe->user_data = kCancelUserData;
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        cancels++;
+    }
+    _pending_submit += cancels;
+    // a cancelled read completes with -ECANCELED, one that already ran with its result
+    while (_in_flight > 0) {
+        if (!enter(_pending_submit, 1)) {
+            return false;
+        }
+        reap_completions();
+    }
+    return true;
+}
+
+bool UringFrameReader::enter(uint32_t to_submit, uint32_t min_complete) {
+    if (to_submit == 0 && min_complete == 0) {
+        return true;
+    }
+    uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete, flags, NULL, 0);
+        if (ret >= 0) {
+            _pending_submit -= ret < (int)_pending_submit ? ret : _pending_submit;
+            return true;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            base::LogError() << "io_uring_enter failed reason:" << strerror(errno);
+            _error = true;
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // completion ring is full, drain it before submitting more
+        reap_completions();
+    }
+}
+
+void UringFrameReader::reap_completions() {
+    uint32_t head = *_cq_head;
+    uint32_t tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe &cqe = _cqes[head & *_cq_mask];
+        uint64_t user_data = cqe.user_data;
+        int32_t res = cqe.res;
+        head++;
+        if (user_data == kCancelUserData) {
+            continue;
+        }
+
+        _in_flight--;
+        uint32_t slot_index = user_data;
+        frame_slot &slot = _slots[slot_index];
+        if (_closing) {
+            slot.state = slot_state::Free;
+        } else if (res == -EAGAIN || res == -EINTR) {
+            queue_read(slot_index);
+        } else if (res < 0) {
+            base::LogError() << "read frame " << slot.frame_index
+                             << " failed reason:" << strerror(-res);
+            slot.state = slot_state::Free;
+            _error = true;
+        } else if (res == 0) {
+            // a trailing partial frame is dropped
+            slot.state = slot_state::Free;
+            _eof = true;
+        } else {
+            slot.filled += res;
+            if (slot.filled < _frame_size) {
+                queue_read(slot_index);
+            } else {
+                slot.state = slot_state::Ready;
+            }
+        }
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * reads fixed size raw frames ahead of the display with io_uring. frames land
+ * in a pool of page aligned buffers registered with the ring, so files and block
+ * devices opened with O_DIRECT are read without going through the page cache or
+ * an extra copy. seekable inputs keep queue_depth reads in flight, pipes are read
+ * one frame at a time but still asynchronously to the consumer.
+ */
+class UringFrameReader {
+public:
+    /**
+     * @brief start reading frames
+     * @param fd file, block device or pipe, stays owned by the caller
+     * @param frame_size bytes per frame
+     * @param queue_depth frames read ahead of the consumer
+     */
+    bool open(int fd, uint32_t frame_size, uint32_t queue_depth);
+    /**
+     * @brief wait for the next frame in stream order
+     * @return frame memory, valid until release_frame, nullptr at end of stream or on error
+     */
+    uint8_t *acquire_frame();
+    /**
+     * @brief give the acquired frame back so its buffer can be refilled
+     */
+    void release_frame();
+    /**
+     * @brief stop reading and free the buffer pool
+     */
+    void close();
+public:
+    UringFrameReader();
+    ~UringFrameReader();
+private:
+    enum class slot_state {
+        Free,
+        Reading,
+        Ready,
+        Acquired,
+    };
+    struct frame_slot {
+        uint8_t *vaddr;
+        uint32_t filled;
+        uint64_t frame_index;
+        slot_state state;
+    };
+    /**
+     * map the submission and completion rings
+    */
+    bool setup_ring(uint32_t entries);
+    /**
+     * queue reads into free slots
+    */
+    void submit_reads();
+    /**
+     * queue the remaining part of one frame
+    */
+    void queue_read(uint32_t slot_index);
+    /**
+     * io_uring_enter, optionally waiting for one completion
+    */
+    bool enter(uint32_t to_submit, uint32_t min_complete);
+    /**
+     * drain the completion ring
+    */
+    void reap_completions();
+    /**
+     * cancel the reads in flight and wait for their completions, the kernel writes into
+     * the slot buffers until then
+     * @return false when a read may still be running
+    */
+    bool cancel_reads();
+private:
+    int _fd;
+    int _ring_fd;
+    uint32_t _frame_size;
+    uint32_t _buffer_size;
+    uint64_t _base_offset;
+    bool _seekable;
+    bool _fixed_buffers;
+    bool _eof;
+    bool _error;
+    bool _closing;  ///< completions are not read again
+
+    uint64_t _next_read_frame;
+    uint64_t _next_acquire_frame;
+    int32_t _acquired_slot;
+    uint32_t _in_flight;
+    uint32_t _pending_submit;
+
+    std::vector<frame_slot> _slots;
+
+    void *_sq_ring;
+    size_t _sq_ring_size;
+    void *_cq_ring;
+    size_t _cq_ring_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+
+    uint32_t *_sq_head;
+    uint32_t *_sq_tail;
+    uint32_t *_sq_mask;
+    uint32_t *_sq_array;
+    uint32_t *_cq_head;
+    uint32_t *_cq_tail;
+    uint32_t *_cq_mask;
+    struct io_uring_cqe *_cqes;
+};
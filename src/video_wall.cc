@@ -0,0 +1,486 @@
+#include "video_wall.h"
+
+#include <drm.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+
+#include "base/log.h"
+#include "nv12_upload.h"
+
+bool VideoWall::open(uint32_t columns, uint32_t rows, const std::vector<uint32_t> &connector_ids,
+                     const char *driver_name /*= nullptr*/) {
+    close();
+    if (columns == 0 || rows == 0) {
+        base::LogError() << "invalid video wall " << columns << "x" << rows;
+        return false;
+    }
+    _device = DrmDevice::acquire(driver_name != nullptr ? driver_name : "msm_drm");
+    if (_device == NULL) {
+        return false;
+    }
+    _fd = _device->get_fd();
+    if (!_device->has_atomic()) {
+        base::LogError() << "video wall needs atomic modesetting";
+        close();
+        return false;
+    }
+
+    drmModeRes *mode_res = _device->get_resources();
+    bool pick_displays = connector_ids.empty();
+    std::vector<uint32_t> ids = connector_ids;
+    if (pick_displays) {
+        for (int i = 0; i < mode_res->count_connectors; i++) {
+            drm_connector_handle connector = _device->get_connector(mode_res->connectors[i]);
+            if (connector != NULL && connector->connection == DRM_MODE_CONNECTED &&
+                connector->count_modes > 0) {
+                ids.push_back(connector->connector_id);
+            }
+        }
+    }
+
+    bool ret = true;
+    // crtcs of the wrappers and of leases on the device are taken
+    uint32_t used_crtcs = _device->get_used_crtcs();
+    for (uint32_t i = 0; i < ids.size() && _outputs.size() < columns * rows; i++) {
+        drm_connector_handle connector = _device->get_connector(ids[i]);
+        int pipe = -1;
+        if (connector != NULL && connector->count_modes > 0) {
+            pipe = find_crtc(connector.get(), used_crtcs);
+        }
+        uint32_t plane_id = pipe >= 0 ? find_plane(pipe) : 0;
+        if (plane_id == 0 || !_device->reserve_plane(plane_id)) {
+            // a display shown by a wrapper is left out when the wall picks the displays
+            if (pick_displays) {
+                continue;
+            }
+            base::LogError() << "no free crtc and nv12 plane for connector " << ids[i];
+            ret = false;
+            break;
+        }
+        used_crtcs |= 1 << pipe;
+
+        wall_output output;
+        memset(&output, 0, sizeof(output));
+        output.wall = this;
+        output.index = _outputs.size();
+        output.connector_id = ids[i];
+        output.crtc_id = mode_res->crtcs[pipe];
+        output.plane_id = plane_id;
+        output.mode = connector->modes[0];
+        for (int m = 0; m < connector->count_modes; m++) {
+            if (connector->modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+                output.mode = connector->modes[m];
+                break;
+            }
+        }
+        _device->attach_crtc(output.crtc_id);
+        _outputs.push_back(output);
+        base::LogDebug() << "video wall " << output.index % columns << ","
+                         << output.index / columns << ": connector " << output.connector_id
+                         << " / crtc " << output.crtc_id << " / plane " << output.plane_id
+                         << " / " << output.mode.name;
+    }
+    if (ret && _outputs.size() < columns * rows) {
+        base::LogError() << "video wall " << columns << "x" << rows << " needs "
+                         << columns * rows << " displays, found " << _outputs.size();
+        ret = false;
+    }
+
+    _columns = columns;
+    _rows = rows;
+    _mode_set = false;
+    _quit = false;
+    _generation = 0;
+    _pending = 0;
+    _width = 0;
+    _height = 0;
+    // the threads keep pointers into _outputs, it must not grow once they run
+    for (uint32_t i = 0; ret && i < _outputs.size(); i++) {
+        wall_output &output = _outputs[i];
+        int err = pthread_create(&output.thread, NULL, thread_main, &output);
+        if (err != 0) {
+            base::LogError() << "create video wall thread failed reason:" << strerror(err);
+            ret = false;
+        }
+        output.thread_started = err == 0;
+    }
+    if (!ret) {
+        close();
+    }
+    return ret;
+}
+
+bool VideoWall::draw_nv12_frame(const uint8_t *address, int32_t width, int32_t height,
+                                int32_t stride) {
+    if (_outputs.empty()) {
+        base::LogError() << "video wall is not open";
+        return false;
+    }
+    if (width < (int32_t)_columns * 2 || height < (int32_t)_rows * 2) {
+        base::LogError() << "frame " << width << "x" << height << " is too small for the wall";
+        return false;
+    }
+    if ((width | height) & 1) {
+        base::LogError() << "nv12 frame " << width << "x" << height << " has an odd size";
+        return false;
+    }
+    if (width != _width || height != _height) {
+        if (!create_buffers(width, height)) {
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _frame = address;
+    _stride = stride;
+    _pending = _outputs.size();
+    _generation++;
+    pthread_cond_broadcast(&_frame_cond);
+    while (_pending > 0) {
+        pthread_cond_wait(&_done_cond, &_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    if (!commit()) {
+        return false;
+    }
+    // the commit returns after the flips, the previous front buffers are free again
+    for (wall_output &output : _outputs) {
+        output.back_buffer_index ^= 1;
+    }
+    return true;
+}
+
+void VideoWall::close() {
+    if (_device == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&_mutex);
+    _quit = true;
+    pthread_cond_broadcast(&_frame_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    for (wall_output &output : _outputs) {
+        if (output.thread_started) {
+            pthread_join(output.thread, NULL);
+        }
+        for (uint32_t i = 0; i < 2; i++) {
+            destroy_buffer_object(&output.buffers[i]);
+        }
+        if (output.mode_blob_id != 0) {
+            drmModeDestroyPropertyBlob(_fd, output.mode_blob_id);
+        }
+        _device->release_plane(output.plane_id);
+        _device->detach_crtc(output.crtc_id);
+    }
+    _outputs.clear();
+    _property_ids.clear();
+    _mode_set = false;
+    _width = 0;
+    _height = 0;
+    // removing the scanned out buffers turned the crtcs off
+    _device->invalidate_objects();
+    _device->release();
+    _device = NULL;
+    _fd = -1;
+}
+
+int VideoWall::find_crtc(const drmModeConnector *connector, uint32_t used_crtcs) {
+    drmModeRes *mode_res = _device->get_resources();
+    uint32_t possible_crtcs = 0;
+    int current = -1;
+    for (int i = 0; i < connector->count_encoders; i++) {
+        drm_encoder_handle encoder = _device->get_encoder(connector->encoders[i]);
+        if (encoder == NULL) {
+            continue;
+        }
+        possible_crtcs |= encoder->possible_crtcs;
+        for (int c = 0; encoder->encoder_id == connector->encoder_id && c < mode_res->count_crtcs;
+             c++) {
+            if (mode_res->crtcs[c] == encoder->crtc_id) {
+                current = c;
+            }
+        }
+    }
+    if (current >= 0 && (used_crtcs & (1 << current)) == 0) {
+        return current;
+    }
+    possible_crtcs &= ~used_crtcs;
+    return possible_crtcs != 0 ? ffs(possible_crtcs) - 1 : -1;
+}
+
+uint32_t VideoWall::find_plane(int pipe) const {
+    uint32_t plane_id = 0;
+    for (const plane_capability &capability : _device->get_plane_capabilities()) {
+        if ((capability.possible_crtcs & (1 << pipe)) == 0 ||
+            capability.type == DRM_PLANE_TYPE_CURSOR ||
+            capability.formats.find(DRM_FORMAT_NV12) == capability.formats.end() ||
+            _device->is_plane_reserved(capability.plane_id)) {
+            continue;
+        }
+        // the primary plane costs no extra pipe
+        if (capability.type == DRM_PLANE_TYPE_PRIMARY) {
+            return capability.plane_id;
+        }
+        if (plane_id == 0) {
+            plane_id = capability.plane_id;
+        }
+    }
+    return plane_id;
+}
+
+bool VideoWall::create_buffers(int32_t width, int32_t height) {
+    for (wall_output &output : _outputs) {
+        // even edges keep every part on whole chroma samples
+        uint32_t column = output.index % _columns;
+        uint32_t row = output.index / _columns;
+        uint32_t x0 = (width * column / _columns) & ~1u;
+        uint32_t y0 = (height * row / _rows) & ~1u;
+        uint32_t x1 = width & ~1u;
+        uint32_t y1 = height & ~1u;
+        if (column + 1 < _columns) {
+            x1 = (width * (column + 1) / _columns) & ~1u;
+        }
+        if (row + 1 < _rows) {
+            y1 = (height * (row + 1) / _rows) & ~1u;
+        }
+        output.src_x = x0;
+        output.src_y = y0;
+        output.back_buffer_index = 0;
+        for (uint32_t i = 0; i < 2; i++) {
+            destroy_buffer_object(&output.buffers[i]);
+            if (!create_buffer_object(&output.buffers[i], x1 - x0, y1 - y0)) {
+                _width = 0;
+                _height = 0;
+                return false;
+            }
+        }
+    }
+    _width = width;
+    _height = height;
+    return true;
+}
+
+bool VideoWall::create_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                                     int32_t height) {
+    memset(buffer_object, 0, sizeof(*buffer_object));
+    buffer_object->width = width;
+    buffer_object->height = height;
+
+    // Y and interleaved UV in dumb buffers of their own
+    uint32_t handles[4] = {0, 0, 0, 0};
+    uint32_t pitches[4] = {0, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    for (uint32_t i = 0; i < 2; i++) {
+        struct drm_mode_create_dumb create = {};
+        create.width = width;
+        create.height = i == 0 ? height : height / 2;
+        create.bpp = 8;
+        if (drmIoctl(_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) != 0) {
+            base::LogError() << "drmIoctl DRM_IOCTL_MODE_CREATE_DUMB failed reason:"
+                             << strerror(errno);
+            destroy_buffer_object(buffer_object);
+            return false;
+        }
+        buffer_object->pitch[i] = create.pitch;
+        buffer_object->size[i] = create.size;
+        buffer_object->handle[i] = create.handle;
+        handles[i] = create.handle;
+        pitches[i] = create.pitch;
+    }
+    if (drmModeAddFB2(_fd, width, height, DRM_FORMAT_NV12, handles, pitches, offsets,
+                      &buffer_object->fb_id, 0) != 0) {
+        base::LogError() << "drmModeAddFB2 failed reason:" << strerror(errno);
+        destroy_buffer_object(buffer_object);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        struct drm_mode_map_dumb map = {};
+        map.handle = buffer_object->handle[i];
+        if (drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &map) != 0) {
+            base::LogError() << "drmIoctl DRM_IOCTL_MODE_MAP_DUMB failed reason:"
+                             << strerror(errno);
+            destroy_buffer_object(buffer_object);
+            return false;
+        }
+        // fault every page in now instead of on the first frames written into it
+        void *vaddr = mmap(0, buffer_object->size[i], PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, _fd, map.offset);
+        if (vaddr == MAP_FAILED) {
+            base::LogError() << "mmap dumb buffer failed reason:" << strerror(errno);
+            destroy_buffer_object(buffer_object);
+            return false;
+        }
+        buffer_object->vaddr[i] = (uint8_t *)vaddr;
+    }
+    return true;
+}
+
+void VideoWall::destroy_buffer_object(frame_buffer_object *buffer_object) {
+    if (buffer_object->fb_id > 0) {
+        drmModeRmFB(_fd, buffer_object->fb_id);
+    }
+    for (uint32_t i = 0; i < kBufferObjectSize; i++) {
+        if (buffer_object->vaddr[i] != NULL) {
+            munmap(buffer_object->vaddr[i], buffer_object->size[i]);
+        }
+        if (buffer_object->handle[i] > 0) {
+            struct drm_mode_destroy_dumb destroy = {};
+            destroy.handle = buffer_object->handle[i];
+            drmIoctl(_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+        }
+    }
+    memset(buffer_object, 0, sizeof(*buffer_object));
+}
+
+bool VideoWall::add_atomic_property(drmModeAtomicReq *request, uint32_t object_id,
+                                    uint32_t object_type, const char *name, uint64_t value) {
+    std::pair<uint32_t, std::string> key(object_id, name);
+    auto iter = _property_ids.find(key);
+    if (iter == _property_ids.end()) {
+        uint32_t property_id = drm_get_property_id(_fd, object_id, object_type, name);
+        iter = _property_ids.insert(std::make_pair(key, property_id)).first;
+    }
+    if (iter->second == 0) {
+        base::LogError() << "object " << object_id << " has no property " << name;
+        return false;
+    }
+    if (drmModeAtomicAddProperty(request, object_id, iter->second, value) < 0) {
+        base::LogError() << "drmModeAtomicAddProperty " << name << " failed";
+        return false;
+    }
+    return true;
+}
+
+bool VideoWall::commit() {
+    uint32_t flags = 0;
+    drmModeAtomicReq *request = drmModeAtomicAlloc();
+    bool ret = request != NULL;
+    for (uint32_t i = 0; ret && i < _outputs.size(); i++) {
+        wall_output &output = _outputs[i];
+        const frame_buffer_object &buffer_object = output.buffers[output.back_buffer_index];
+        if (!_mode_set) {
+            if (output.mode_blob_id == 0 &&
+                drmModeCreatePropertyBlob(_fd, &output.mode, sizeof(output.mode),
+                                          &output.mode_blob_id) != 0) {
+                base::LogError() << "drmModeCreatePropertyBlob failed reason:" << strerror(errno);
+                ret = false;
+                break;
+            }
+            ret = add_atomic_property(request, output.connector_id, DRM_MODE_OBJECT_CONNECTOR,
+                                      "CRTC_ID", output.crtc_id) &&
+                  add_atomic_property(request, output.crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID",
+                                      output.mode_blob_id) &&
+                  add_atomic_property(request, output.crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+            flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        }
+
+        uint32_t crtc_width = buffer_object.width;
+        uint32_t crtc_height = buffer_object.height;
+        const plane_capability *capability = _device->find_plane_capability(output.plane_id);
+        if (capability != NULL && capability->can_scale) {
+            crtc_width = output.mode.hdisplay;
+            crtc_height = output.mode.vdisplay;
+        }
+        uint32_t plane_id = output.plane_id;
+        // clang-format off
+        ret = ret &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", buffer_object.fb_id) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", output.crtc_id) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W", (uint64_t)buffer_object.width << 16) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H", (uint64_t)buffer_object.height << 16) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W", crtc_width) &&
+              add_atomic_property(request, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H", crtc_height);
+        // clang-format on
+    }
+    // one commit for every crtc, no display shows the new frame before all of them can
+    if (ret && drmModeAtomicCommit(_fd, request, flags, NULL) != 0) {
+        base::LogError() << "video wall commit failed reason:" << strerror(errno);
+        ret = false;
+    }
+    if (request != NULL) {
+        drmModeAtomicFree(request);
+    }
+    if (ret && !_mode_set) {
+        for (const wall_output &output : _outputs) {
+            _device->set_crtc_mode(output.crtc_id, output.mode);
+        }
+        _device->invalidate_objects();
+        _mode_set = true;
+    }
+    return ret;
+}
+
+void *VideoWall::thread_main(void *user_data) {
+    wall_output *output = (wall_output *)user_data;
+    output->wall->output_loop(output->index);
+    return NULL;
+}
+
+void VideoWall::output_loop(uint32_t index) {
+    wall_output &output = _outputs[index];
+    uint64_t generation = 0;
+    for (;;) {
+        pthread_mutex_lock(&_mutex);
+        while (_generation == generation && !_quit) {
+            pthread_cond_wait(&_frame_cond, &_mutex);
+        }
+        if (_quit) {
+            pthread_mutex_unlock(&_mutex);
+            break;
+        }
+        generation = _generation;
+        const uint8_t *frame = _frame;
+        int32_t stride = _stride;
+        int32_t height = _height;
+        pthread_mutex_unlock(&_mutex);
+
+        frame_buffer_object *buffer_object = &output.buffers[output.back_buffer_index];
+        const uint8_t *y_address = frame + output.src_y * stride + output.src_x;
+        const uint8_t *uv_address = frame + height * stride + output.src_y / 2 * stride +
+                                    output.src_x;
+        nv12_upload_generic(y_address, stride, uv_address, stride, buffer_object->vaddr[0],
+                            buffer_object->pitch[0], buffer_object->vaddr[1],
+                            buffer_object->pitch[1], buffer_object->width,
+                            buffer_object->height);
+
+        pthread_mutex_lock(&_mutex);
+        if (--_pending == 0) {
+            pthread_cond_signal(&_done_cond);
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+VideoWall::VideoWall() {
+    _device = NULL;
+    _fd = -1;
+    _columns = 0;
+    _rows = 0;
+    _mode_set = false;
+    _quit = false;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_frame_cond, NULL);
+    pthread_cond_init(&_done_cond, NULL);
+    _generation = 0;
+    _pending = 0;
+    _frame = NULL;
+    _stride = 0;
+    _width = 0;
+    _height = 0;
+}
+
+VideoWall::~VideoWall() {
+    close();
+    pthread_cond_destroy(&_done_cond);
+    pthread_cond_destroy(&_frame_cond);
+    pthread_mutex_destroy(&_mutex);
+}
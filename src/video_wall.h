@@ -0,0 +1,103 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "drm_device.h"
+#include "drm_wrapper.h"
+
+/**
+ * spreads frames over a columns x rows grid of displays, each showing its part of the
+ * frame on a crtc and plane of its own. the parts are uploaded in parallel, one thread per
+ * display, and all displays flip in one atomic commit, on the same vblank when their
+ * timings come from one clock. the wall shares the DrmDevice of the driver with the
+ * wrappers, but only drives crtcs no wrapper is attached to and no lease holds.
+ */
+class VideoWall {
+public:
+    /**
+     * @brief open the device of a driver, or attach to it, and set up the wall
+     * @param connector_ids displays in row major order, empty takes the connected displays
+     *        that have a free crtc
+     * @param driver_name drm driver name
+     */
+    bool open(uint32_t columns, uint32_t rows,
+              const std::vector<uint32_t> &connector_ids = std::vector<uint32_t>(),
+              const char *driver_name = nullptr);
+    /**
+     * @brief upload each part of a nv12 frame to its display and flip them together
+     * @param width, height frame size, both even so every part starts on a chroma sample
+     */
+    bool draw_nv12_frame(const uint8_t *address, int32_t width, int32_t height, int32_t stride);
+    /**
+     * @brief stop the threads and release the crtcs, planes and buffers of the wall
+     */
+    void close();
+public:
+    VideoWall();
+    ~VideoWall();
+private:
+    struct wall_output {
+        VideoWall *wall;
+        uint32_t index;
+        uint32_t connector_id;
+        uint32_t crtc_id;
+        uint32_t plane_id;
+        drmModeModeInfo mode;
+        uint32_t mode_blob_id;
+        // part of the frame, in pixels
+        uint32_t src_x;
+        uint32_t src_y;
+        frame_buffer_object buffers[2];
+        int back_buffer_index;
+        pthread_t thread;
+        bool thread_started;
+    };
+    /**
+     * free crtc the connector can drive, the crtc already driving it first
+     * @return crtc index, -1 if none
+    */
+    int find_crtc(const drmModeConnector *connector, uint32_t used_crtcs);
+    /**
+     * unreserved nv12 plane of the crtc at pipe, primary first, 0 if none
+    */
+    uint32_t find_plane(int pipe) const;
+    /**
+     * (re)create the buffers of every display for parts of a width x height frame
+    */
+    bool create_buffers(int32_t width, int32_t height);
+    /**
+     * create one nv12 dumb buffer, register it as fb and map it
+    */
+    bool create_buffer_object(frame_buffer_object *buffer_object, int32_t width,
+                              int32_t height);
+    void destroy_buffer_object(frame_buffer_object *buffer_object);
+    bool add_atomic_property(drmModeAtomicReq *request, uint32_t object_id, uint32_t object_type,
+                             const char *name, uint64_t value);
+    bool commit();
+    static void *thread_main(void *user_data);
+    void output_loop(uint32_t index);
+private:
+    DrmDevice *_device;
+    int _fd;
+    uint32_t _columns;
+    uint32_t _rows;
+    std::vector<wall_output> _outputs;
+    std::map<std::pair<uint32_t, std::string>, uint32_t> _property_ids;
+    bool _mode_set;
+    bool _quit;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _frame_cond;  ///< a new frame for the threads
+    pthread_cond_t _done_cond;   ///< every part of the frame is uploaded
+    uint64_t _generation;        ///< counts frames handed to the threads
+    uint32_t _pending;           ///< threads still uploading the current frame
+    const uint8_t *_frame;
+    int32_t _stride;
+    int32_t _width;  ///< frame size the buffers are made for
+    int32_t _height;
+};
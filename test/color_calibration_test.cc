@@ -0,0 +1,94 @@
+#include <stdint.h>
+
+#include <iostream>
+#include <vector>
+
+#include "src/color_calibration.h"
+
+// no device needed: the luts and matrices are what the crtc properties would be fed
+
+static bool check(bool passed, const char *name) {
+    if (!passed) {
+        std::cout << name << " failed" << std::endl;
+    }
+    return passed;
+}
+
+static bool same_lut(const std::vector<drm_color_lut> &a, const std::vector<drm_color_lut> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].red != b[i].red || a[i].green != b[i].green || a[i].blue != b[i].blue ||
+            a[i].reserved != 0 || b[i].reserved != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_resample() {
+    bool passed = true;
+
+    // a lut of the right size, or one too short to interpolate, is passed through
+    const std::vector<drm_color_lut> lut = {{0, 0, 65535, 0}, {1000, 2000, 60000, 0},
+                                            {65535, 65535, 0, 0}};
+    passed &= check(same_lut(resample_color_lut(lut, 3), lut), "resample same size");
+    const std::vector<drm_color_lut> single = {{1234, 2345, 3456, 0}};
+    passed &= check(same_lut(resample_color_lut(single, 256), single), "resample one entry");
+
+    // the ends stay put, the entries between are interpolated per channel and rounded
+    const std::vector<drm_color_lut> ramp = {{0, 0, 65535, 0}, {65535, 32768, 0, 0}};
+    const std::vector<drm_color_lut> ramp_5 = {{0, 0, 65535, 0},
+                                               {16384, 8192, 49151, 0},
+                                               {32768, 16384, 32768, 0},
+                                               {49151, 24576, 16384, 0},
+                                               {65535, 32768, 0, 0}};
+    passed &= check(same_lut(resample_color_lut(ramp, 5), ramp_5), "resample ramp up");
+
+    // a curve keeps its knee when the crtc wants more entries
+    const std::vector<drm_color_lut> lut_5 = {{0, 0, 65535, 0},
+                                              {500, 1000, 62768, 0},
+                                              {1000, 2000, 60000, 0},
+                                              {33268, 33768, 30000, 0},
+                                              {65535, 65535, 0, 0}};
+    passed &= check(same_lut(resample_color_lut(lut, 5), lut_5), "resample curve up");
+
+    // and lands on the original entries when it wants fewer
+    const std::vector<drm_color_lut> fine = {{0, 0, 0, 0},
+                                             {100, 300, 1000, 0},
+                                             {200, 600, 2000, 0},
+                                             {40000, 50000, 60000, 0},
+                                             {65535, 65535, 65535, 0}};
+    const std::vector<drm_color_lut> fine_3 = {{0, 0, 0, 0}, {200, 600, 2000, 0},
+                                               {65535, 65535, 65535, 0}};
+    passed &= check(same_lut(resample_color_lut(fine, 3), fine_3), "resample down");
+    return passed;
+}
+
+static bool test_ctm() {
+    const double matrix[9] = {1.0, 0.0, -0.5, 0.25, 2.0, -1.0, 1.5, -0.0, 0.0000001};
+    drm_color_ctm ctm;
+    fill_color_ctm(matrix, &ctm);
+
+    // S31.32 sign-magnitude: the top bit is the sign, the rest the magnitude
+    const uint64_t sign = 1ULL << 63;
+    const uint64_t one = 1ULL << 32;
+    const uint64_t expected[9] = {
+        one, 0, sign | one / 2, one / 4, 2 * one, sign | one, one + one / 2,
+        0,  // negative zero has no sign bit to set
+        429,  // 1e-7 * 2^32 rounds to 429
+    };
+    bool passed = true;
+    for (int i = 0; i < 9; i++) {
+        passed &= ctm.matrix[i] == expected[i];
+    }
+    return check(passed, "ctm sign-magnitude");
+}
+
+int main() {
+    bool passed = test_resample();
+    passed &= test_ctm();
+    std::cout << "color calibration test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "src/drm_wrapper.h"
+#include "src/staging_pool.h"
 
 int main() {
     DrmWrapper drm_wrapper;
@@ -17,13 +18,21 @@ int main() {
         return 1;
     }
     int buffer_size = width * height * 3 / 2;
-    uint8_t *mem_buffer = (uint8_t *)malloc(buffer_size);
+    StagingPool staging_pool;
+    if (!staging_pool.open(buffer_size, 1)) {
+        fclose(fp);
+        return 1;
+    }
+    uint8_t *mem_buffer = staging_pool.acquire();
     int read_size = fread(mem_buffer, buffer_size, 1, fp);
     fclose(fp);
 
     drm_wrapper.draw_nv12_frame(mem_buffer, width, height, width);
     getchar();
 
+    staging_pool.release(mem_buffer);
+    staging_pool.close();
+
     drm_wrapper.close();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "src/drm_utils.h"
+
+// no device needed: the EDID base blocks are built by hand
+
+static bool check(bool passed, const char *name) {
+    if (!passed) {
+        std::cout << name << " failed" << std::endl;
+    }
+    return passed;
+}
+
+/**
+ * 128 byte base block with a detailed timing in the first descriptor and dummy
+ * descriptors in the other three
+ */
+static std::vector<uint8_t> make_edid() {
+    std::vector<uint8_t> edid(128, 0);
+    const uint8_t header[8] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+    std::copy(header, header + 8, edid.begin());
+    edid[18] = 1;  // version 1.4
+    edid[19] = 4;
+    // 1080p60 detailed timing, pixel clock 148.5 MHz in 10 kHz units
+    edid[54] = 0x02;
+    edid[55] = 0x3a;
+    for (size_t offset = 72; offset < 126; offset += 18) {
+        edid[offset + 3] = 0x10;
+    }
+    return edid;
+}
+
+static void add_range_limits(std::vector<uint8_t> *edid, size_t offset, uint8_t flags,
+                             uint8_t min_hz, uint8_t max_hz) {
+    uint8_t *descriptor = &(*edid)[offset];
+    descriptor[3] = 0xfd;
+    descriptor[4] = flags;
+    descriptor[5] = min_hz;
+    descriptor[6] = max_hz;
+    descriptor[7] = 30;  // horizontal khz
+    descriptor[8] = 160;
+    descriptor[9] = 60;  // max pixel clock in 10 MHz units
+}
+
+static bool test_refresh_range() {
+    bool passed = true;
+    uint32_t min_hz = 0;
+    uint32_t max_hz = 0;
+
+    std::vector<uint8_t> edid = make_edid();
+    passed &= check(!drm_edid_refresh_range(edid, &min_hz, &max_hz), "no range descriptor");
+
+    add_range_limits(&edid, 72, 0, 48, 144);
+    passed &= check(drm_edid_refresh_range(edid, &min_hz, &max_hz) && min_hz == 48 &&
+                        max_hz == 144,
+                    "range descriptor");
+
+    // edid 1.4 rate offsets reach past 255 hz
+    edid = make_edid();
+    add_range_limits(&edid, 108, 0x02, 48, 45);
+    passed &= check(drm_edid_refresh_range(edid, &min_hz, &max_hz) && min_hz == 48 &&
+                        max_hz == 300,
+                    "max rate offset");
+    edid = make_edid();
+    add_range_limits(&edid, 108, 0x03, 5, 45);
+    passed &= check(drm_edid_refresh_range(edid, &min_hz, &max_hz) && min_hz == 260 &&
+                        max_hz == 300,
+                    "min and max rate offset");
+
+    // a detailed timing is not a descriptor even when byte 3 happens to be 0xfd
+    edid = make_edid();
+    edid[57] = 0xfd;
+    passed &= check(!drm_edid_refresh_range(edid, &min_hz, &max_hz), "detailed timing");
+
+    // nonsense ranges and blocks cut short are no range
+    edid = make_edid();
+    add_range_limits(&edid, 90, 0, 0, 144);
+    passed &= check(!drm_edid_refresh_range(edid, &min_hz, &max_hz), "zero min rate");
+    edid = make_edid();
+    add_range_limits(&edid, 90, 0, 144, 48);
+    passed &= check(!drm_edid_refresh_range(edid, &min_hz, &max_hz), "inverted range");
+    edid = make_edid();
+    add_range_limits(&edid, 108, 0, 48, 144);
+    edid.resize(120);
+    passed &= check(!drm_edid_refresh_range(edid, &min_hz, &max_hz), "truncated block");
+    passed &= check(!drm_edid_refresh_range(std::vector<uint8_t>(), &min_hz, &max_hz),
+                    "empty edid");
+    return passed;
+}
+
+int main() {
+    bool passed = test_refresh_range();
+    std::cout << "edid test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
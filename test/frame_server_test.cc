@@ -0,0 +1,112 @@
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "src/drm_wrapper.h"
+#include "src/frame_client.h"
+#include "src/frame_server.h"
+
+// run against the software backend with: drm_frame_server_test vkms
+static const char *kSocketPath = "/tmp/drm_frame_server_test.sock";
+static const int kBufferCount = 2;
+static const int kFrameCount = 120;
+
+static int run_client(int width, int height) {
+    FrameClient client;
+    for (int retry = 0; retry < 100 && !client.connect(kSocketPath); retry++) {
+        usleep(10 * 1000);
+    }
+    if (client.get_fd() < 0) {
+        return 1;
+    }
+
+    uint32_t frame_size = width * height * 3 / 2;
+    uint32_t map_size = (frame_size + 4095) & ~4095u;
+    uint8_t *vaddr[kBufferCount];
+    for (int i = 0; i < kBufferCount; i++) {
+        int fd = memfd_create("nv12", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0 || ftruncate(fd, map_size) != 0) {
+            return 1;
+        }
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+        vaddr[i] = (uint8_t *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        dma_buf_frame frame = {};
+        frame.width = width;
+        frame.height = height;
+        frame.format = DRM_FORMAT_NV12;
+        frame.num_planes = 2;
+        frame.fd[0] = fd;
+        frame.fd[1] = fd;
+        frame.pitch[0] = width;
+        frame.pitch[1] = width;
+        frame.offset[0] = 0;
+        frame.offset[1] = width * height;
+        if (!client.attach_buffer(i, frame)) {
+            return 1;
+        }
+        close(fd);
+    }
+
+    bool busy[kBufferCount] = {false};
+    for (int n = 0; n < kFrameCount; n++) {
+        int index = n % kBufferCount;
+        while (busy[index]) {
+            uint32_t released = 0;
+            if (!client.wait_release(&released, 1000)) {
+                std::cerr << "no release for buffer " << index << std::endl;
+                return 1;
+            }
+            busy[released] = false;
+        }
+        // moving gray bar, written in place, never sent over the socket
+        memset(vaddr[index], 16, width * height);
+        memset(vaddr[index] + (n * 8 % height) * width, 235, width * 8);
+        memset(vaddr[index] + width * height, 128, width * height / 2);
+        busy[index] = true;
+        if (!client.present(index)) {
+            return 1;
+        }
+    }
+
+    client.close();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    DrmWrapper drm_wrapper;
+    if (!drm_wrapper.open(argc > 1 ? argv[1] : nullptr)) {
+        return 1;
+    }
+
+    FrameServer server;
+    if (!server.open(&drm_wrapper, kSocketPath)) {
+        return 1;
+    }
+
+    int width = 1920;
+    int height = 1080;
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(run_client(width, height));
+    }
+
+    int status = 0;
+    bool connected = false;
+    while (waitpid(pid, &status, WNOHANG) == 0 || server.get_client_count() > 0) {
+        server.process_events(100);
+        connected |= server.get_client_count() > 0;
+    }
+
+    server.close();
+    drm_wrapper.close();
+
+    bool passed = connected && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    std::cout << "frame server test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+#include "src/drm_device.h"
+#include "src/drm_wrapper.h"
+
+// run against the software backend with: drm_lease_test vkms
+// the master leases the first connector and drives nothing itself, so one output is enough
+static const int kFrameCount = 120;
+
+static int run_lessee(int lease_fd) {
+    DrmWrapper drm_wrapper;
+    if (!drm_wrapper.open_lease(lease_fd)) {
+        return 1;
+    }
+    const drmModeModeInfo &mode = drm_wrapper.get_display_mode();
+    int width = mode.hdisplay;
+    int height = mode.vdisplay;
+    std::vector<uint8_t> frame(width * height * 3 / 2);
+    for (int n = 0; n < kFrameCount; n++) {
+        // moving gray bar
+        memset(frame.data(), 16, width * height);
+        memset(frame.data() + (n * 8 % height) * width, 235, width * 8);
+        memset(frame.data() + width * height, 128, width * height / 2);
+        if (!drm_wrapper.draw_nv12_frame(frame.data(), width, height, width)) {
+            return 1;
+        }
+    }
+    drm_wrapper.close();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    DrmDevice *device = DrmDevice::acquire(argc > 1 ? argv[1] : "vkms");
+    if (device == NULL) {
+        return 1;
+    }
+    drmModeRes *res = device->get_resources();
+    std::vector<uint32_t> object_ids;
+    if (res->count_connectors == 0 ||
+        !device->get_lease_objects(res->connectors[0], &object_ids)) {
+        device->release();
+        return 1;
+    }
+    uint32_t lessee_id = 0;
+    int lease_fd = device->create_lease(object_ids, &lessee_id);
+    if (lease_fd < 0) {
+        device->release();
+        return 1;
+    }
+    // the leased planes are reserved, the same output cannot be leased twice
+    uint32_t second_lessee_id = 0;
+    bool leased_twice = device->create_lease(object_ids, &second_lessee_id) >= 0;
+    // the leased crtc is taken as well, without any plane and for a new lease of the output
+    std::vector<uint32_t> crtc_ids(object_ids.begin(), object_ids.begin() + 2);
+    bool crtc_leased_twice = device->create_lease(crtc_ids, &second_lessee_id) >= 0;
+    std::vector<uint32_t> second_ids;
+    bool crtc_offered_twice = device->get_lease_objects(res->connectors[0], &second_ids) &&
+                              second_ids[1] == object_ids[1];
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(run_lessee(lease_fd));
+    }
+    close(lease_fd);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    // the lease ended with the lessee, revoking it frees the planes for a new lease
+    device->revoke_lease(lessee_id);
+    lease_fd = device->create_lease(object_ids, &lessee_id);
+    bool released = lease_fd >= 0 && device->revoke_lease(lessee_id);
+    if (lease_fd >= 0) {
+        close(lease_fd);
+    }
+    device->release();
+
+    bool passed = !leased_twice && !crtc_leased_twice && !crtc_offered_twice && released &&
+                  WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    std::cout << "lease test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "src/drm_utils.h"
+#include "src/mode_cache.h"
+
+// no device needed: modes are made up and the cache lives in a temporary directory
+
+static bool check(bool passed, const char *name) {
+    if (!passed) {
+        std::cout << name << " failed" << std::endl;
+    }
+    return passed;
+}
+
+/**
+ * cea style timings, the pixel clock is what sets the exact refresh rate
+ */
+static drmModeModeInfo make_mode(uint16_t width, uint16_t height, uint32_t clock,
+                                 uint16_t htotal, uint16_t vtotal, uint32_t type = 0) {
+    drmModeModeInfo mode;
+    memset(&mode, 0, sizeof(mode));
+    mode.hdisplay = width;
+    mode.vdisplay = height;
+    mode.clock = clock;
+    mode.htotal = htotal;
+    mode.vtotal = vtotal;
+    mode.vrefresh = (uint32_t)((uint64_t)clock * 1000 / ((uint64_t)htotal * vtotal));
+    mode.type = type;
+    snprintf(mode.name, sizeof(mode.name), "%ux%u", width, height);
+    return mode;
+}
+
+static std::string ranked_names(const drmModeModeInfo *modes, const std::vector<int> &order) {
+    std::string names;
+    for (int index : order) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s%ux%u@%u", names.empty() ? "" : " ",
+                 modes[index].hdisplay, modes[index].vdisplay, modes[index].vrefresh);
+        names += name;
+    }
+    return names;
+}
+
+static bool test_rank_modes() {
+    const drmModeModeInfo modes[] = {
+        make_mode(3840, 2160, 594000, 4400, 2250, DRM_MODE_TYPE_PREFERRED),  // 60
+        make_mode(1920, 1080, 148500, 2200, 1125),                           // 60
+        make_mode(1920, 1080, 148500, 2640, 1125),                           // 50
+        make_mode(1920, 1080, 74250, 2750, 1125),                            // 24
+        make_mode(1920, 1080, 74176, 2750, 1125),                            // 23.976
+        make_mode(1280, 720, 74250, 1650, 750),                              // 60
+    };
+    const int count = sizeof(modes) / sizeof(modes[0]);
+    bool passed = true;
+    std::vector<int> order;
+
+    // 25 fps divides 50 evenly, 1080p fits without upscaling
+    drm_rank_modes(modes, count, 1920, 1080, 25, &order);
+    passed &= check(ranked_names(modes, order) ==
+                        "1920x1080@50 1920x1080@60 3840x2160@60 1920x1080@24 1920x1080@23 "
+                        "1280x720@60",
+                    "rank 1080p25");
+
+    // film goes to the 24 hz modes, 24 and 23.976 are both taken as judder free
+    drm_rank_modes(modes, count, 1920, 1080, 24000.0 / 1001, &order);
+    passed &= check(order.size() == count && order[0] + order[1] == 3 + 4, "rank 1080p23.976");
+
+    // unknown rate: the smallest fitting mode, the fastest first
+    drm_rank_modes(modes, count, 1920, 1080, 0, &order);
+    passed &= check(order.size() == count && order[0] == 1, "rank 1080p unknown rate");
+
+    // nothing fits: the biggest mode scales down least
+    drm_rank_modes(modes, count, 4096, 2160, 60, &order);
+    passed &= check(order.size() == count && order[0] == 0, "rank no fit");
+
+    // interlaced modes are never offered
+    drmModeModeInfo interlaced[] = {modes[1], modes[2]};
+    interlaced[0].flags |= DRM_MODE_FLAG_INTERLACE;
+    drm_rank_modes(interlaced, 2, 1920, 1080, 60, &order);
+    passed &= check(order.size() == 1 && order[0] == 1, "rank interlaced");
+    return passed;
+}
+
+static bool test_mode_cache(const std::string &directory) {
+    const drmModeModeInfo mode_60 = make_mode(1920, 1080, 148500, 2200, 1125);
+    const drmModeModeInfo mode_50 = make_mode(1920, 1080, 148500, 2640, 1125);
+    const std::string path = directory + "/modes";
+    bool passed = true;
+    bool accepted = false;
+
+    // a missing file is an empty cache that is written on the first record
+    ModeCache cache;
+    passed &= check(cache.load(path.c_str()), "load missing file");
+    passed &= check(!cache.lookup("edid-1", mode_60, &accepted), "lookup empty cache");
+    cache.record("edid-1", mode_60, false);
+    cache.record("edid-1", mode_50, true);
+    passed &= check(access(path.c_str(), F_OK) == 0, "record writes the file");
+
+    // the records survive into the next session, per display and per timing
+    ModeCache reloaded;
+    passed &= check(reloaded.load(path.c_str()), "load written file");
+    passed &= check(reloaded.lookup("edid-1", mode_60, &accepted) && !accepted, "lookup rejected");
+    passed &= check(reloaded.lookup("edid-1", mode_50, &accepted) && accepted, "lookup accepted");
+    passed &= check(!reloaded.lookup("edid-2", mode_50, &accepted), "lookup other display");
+
+    // a later result replaces the earlier one
+    reloaded.record("edid-1", mode_60, true);
+    ModeCache updated;
+    updated.load(path.c_str());
+    passed &= check(updated.lookup("edid-1", mode_60, &accepted) && accepted, "record update");
+
+    // a cache that cannot be read is kept in memory and the file below it is left alone,
+    // root opens files whatever their mode, so make the path go through a regular file
+    const std::string unreadable = path + "/modes";
+    ModeCache memory_only;
+    passed &= check(!memory_only.load(unreadable.c_str()), "load unreadable file");
+    memory_only.record("edid-1", mode_60, false);
+    passed &= check(memory_only.lookup("edid-1", mode_60, &accepted) && !accepted,
+                    "lookup memory only");
+    ModeCache untouched;
+    untouched.load(path.c_str());
+    passed &= check(untouched.lookup("edid-1", mode_60, &accepted) && accepted,
+                    "unreadable cache leaves the file alone");
+
+    unlink(path.c_str());
+    return passed;
+}
+
+int main() {
+    char directory[] = "/tmp/drm_mode_cache_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        std::cout << "mkdtemp failed" << std::endl;
+        return 1;
+    }
+    bool passed = test_rank_modes();
+    passed &= test_mode_cache(directory);
+    rmdir(directory);
+    std::cout << "mode cache test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
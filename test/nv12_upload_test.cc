@@ -0,0 +1,61 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "src/nv12_upload.h"
+
+// no device needed: the kernel picked for each layout is checked against the generic copy
+
+static void fill_random(std::vector<uint8_t> *data) {
+    for (uint8_t &value : *data) {
+        value = rand();
+    }
+}
+
+static bool test_upload(uint32_t width, uint32_t height, int32_t stride, uint32_t pitch) {
+    std::vector<uint8_t> src(stride * height * 3 / 2);
+    fill_random(&src);
+    const uint8_t *src_uv = src.data() + stride * height;
+    std::vector<uint8_t> expected(pitch * height * 3 / 2);
+    std::vector<uint8_t> uploaded(pitch * height * 3 / 2);
+    nv12_upload_generic(src.data(), stride, src_uv, stride, expected.data(), pitch,
+                        expected.data() + pitch * height, pitch, width, height);
+    nv12_upload_fn upload = select_nv12_upload(width, height, stride, stride, pitch, pitch);
+    upload(src.data(), stride, src_uv, stride, uploaded.data(), pitch,
+           uploaded.data() + pitch * height, pitch, width, height);
+
+    // padding bytes are never written, compare the visible part of each row only
+    bool passed = upload != nv12_upload_generic;
+    for (uint32_t i = 0; i < height * 3 / 2; i++) {
+        passed &= std::equal(expected.begin() + i * pitch, expected.begin() + i * pitch + width,
+                             uploaded.begin() + i * pitch);
+    }
+    if (!passed) {
+        std::cout << "nv12 upload " << width << "x" << height << " stride " << stride
+                  << " pitch " << pitch << " differs from the generic copy" << std::endl;
+    }
+    return passed;
+}
+
+static bool test_uploads() {
+    bool passed = true;
+    for (uint32_t width : {1920u, 3840u}) {
+        uint32_t height = width * 9 / 16;
+        uint32_t aligned = width == 1920 ? 2048 : 4096;
+        for (uint32_t stride : {width, aligned}) {
+            for (uint32_t pitch : {width, aligned}) {
+                passed &= test_upload(width, height, stride, pitch);
+            }
+        }
+    }
+    return passed;
+}
+
+int main() {
+    srand(1);
+    bool passed = test_uploads();
+    std::cout << "nv12 upload test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+
+#include <iostream>
+#include <vector>
+
+#include "src/pixel_convert.h"
+
+// no device needed: the vector kernels are checked against a plain per pixel reference.
+// widths are not a multiple of the vector size so the scalar tails run as well
+static const int32_t kWidth = 70;
+static const int32_t kHeight = 10;
+
+static void fill_random(std::vector<uint8_t> *data) {
+    for (uint8_t &value : *data) {
+        value = rand();
+    }
+}
+
+static bool check(bool passed, const char *name) {
+    if (!passed) {
+        std::cout << name << " differs from the reference" << std::endl;
+    }
+    return passed;
+}
+
+static bool test_i420() {
+    std::vector<uint8_t> src_y(kWidth * kHeight);
+    std::vector<uint8_t> src_u(kWidth / 2 * kHeight / 2);
+    std::vector<uint8_t> src_v(kWidth / 2 * kHeight / 2);
+    fill_random(&src_y);
+    fill_random(&src_u);
+    fill_random(&src_v);
+    std::vector<uint8_t> dst_y(kWidth * kHeight);
+    std::vector<uint8_t> dst_uv(kWidth * kHeight / 2);
+    convert_i420_to_nv12(src_y.data(), kWidth, src_u.data(), kWidth / 2, src_v.data(),
+                         kWidth / 2, dst_y.data(), kWidth, dst_uv.data(), kWidth, kWidth,
+                         kHeight);
+
+    bool passed = dst_y == src_y;
+    for (int32_t i = 0; i < kWidth / 2 * kHeight / 2; i++) {
+        passed &= dst_uv[2 * i] == src_u[i] && dst_uv[2 * i + 1] == src_v[i];
+    }
+    return check(passed, "i420 to nv12");
+}
+
+static bool test_yuyv() {
+    int32_t src_stride = kWidth * 2 + 4;
+    std::vector<uint8_t> src(src_stride * kHeight);
+    fill_random(&src);
+    std::vector<uint8_t> dst_y(kWidth * kHeight);
+    std::vector<uint8_t> dst_uv(kWidth * kHeight / 2);
+    convert_yuyv_to_nv12(src.data(), src_stride, dst_y.data(), kWidth, dst_uv.data(), kWidth,
+                         kWidth, kHeight);
+
+    bool passed = true;
+    for (int32_t y = 0; y < kHeight; y++) {
+        for (int32_t x = 0; x < kWidth; x++) {
+            passed &= dst_y[y * kWidth + x] == src[y * src_stride + 2 * x];
+        }
+    }
+    for (int32_t y = 0; y < kHeight / 2; y++) {
+        for (int32_t x = 0; x < kWidth; x++) {
+            const uint8_t *row0 = &src[2 * y * src_stride];
+            const uint8_t *row1 = row0 + src_stride;
+            passed &= dst_uv[y * kWidth + x] == ((row0[2 * x + 1] + row1[2 * x + 1] + 1) >> 1);
+        }
+    }
+    return check(passed, "yuyv to nv12");
+}
+
+static bool test_rgba(color_matrix matrix) {
+    // 8 bit fixed point, limited range
+    const int bt601[9] = {66, 129, 25, -38, -74, 112, 112, -94, -18};
+    const int bt709[9] = {47, 157, 16, -26, -87, 112, 112, -102, -10};
+    const int *m = matrix == color_matrix::BT709 ? bt709 : bt601;
+
+    int32_t src_stride = kWidth * 4 + 8;
+    std::vector<uint8_t> src(src_stride * kHeight);
+    fill_random(&src);
+    // the extremes of every channel
+    for (int32_t i = 0; i < 8; i++) {
+        src[4 * i] = src[4 * i + 1] = src[4 * i + 2] = i % 2 ? 255 : 0;
+    }
+    std::vector<uint8_t> dst_y(kWidth * kHeight);
+    std::vector<uint8_t> dst_uv(kWidth * kHeight / 2);
+    convert_rgba_to_nv12(src.data(), src_stride, dst_y.data(), kWidth, dst_uv.data(), kWidth,
+                         kWidth, kHeight, matrix);
+
+    bool passed = true;
+    for (int32_t y = 0; y < kHeight; y++) {
+        for (int32_t x = 0; x < kWidth; x++) {
+            const uint8_t *p = &src[y * src_stride + 4 * x];
+            int expected = ((m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + 128) >> 8) + 16;
+            passed &= dst_y[y * kWidth + x] == expected;
+        }
+    }
+    for (int32_t y = 0; y < kHeight / 2; y++) {
+        for (int32_t x = 0; x < kWidth / 2; x++) {
+            int rgb[3];
+            for (int32_t c = 0; c < 3; c++) {
+                const uint8_t *p = &src[2 * y * src_stride + 8 * x + c];
+                rgb[c] = (p[0] + p[4] + p[src_stride] + p[src_stride + 4] + 2) >> 2;
+            }
+            int u = ((m[3] * rgb[0] + m[4] * rgb[1] + m[5] * rgb[2] + 128) >> 8) + 128;
+            int v = ((m[6] * rgb[0] + m[7] * rgb[1] + m[8] * rgb[2] + 128) >> 8) + 128;
+            passed &= dst_uv[y * kWidth + 2 * x] == u && dst_uv[y * kWidth + 2 * x + 1] == v;
+        }
+    }
+    return check(passed, matrix == color_matrix::BT709 ? "rgba to nv12 bt709"
+                                                       : "rgba to nv12 bt601");
+}
+
+static bool test_blend() {
+    nv12a_image image;
+    image.width = kWidth;
+    image.height = kHeight;
+    image.y.resize(kWidth * kHeight);
+    image.y_alpha.resize(kWidth * kHeight);
+    image.uv.resize(kWidth * kHeight / 2);
+    image.uv_alpha.resize(kWidth * kHeight / 2);
+    fill_random(&image.y);
+    fill_random(&image.y_alpha);
+    fill_random(&image.uv);
+    fill_random(&image.uv_alpha);
+    image.y_alpha[0] = 0;
+    image.y_alpha[1] = 255;
+
+    // blend a part inside the image onto a smaller destination
+    const int32_t src_x = 2, src_y = 2;
+    const int32_t width = kWidth - 4, height = kHeight - 4;
+    std::vector<uint8_t> dst_y(kWidth * kHeight);
+    std::vector<uint8_t> dst_uv(kWidth * kHeight / 2);
+    fill_random(&dst_y);
+    fill_random(&dst_uv);
+    std::vector<uint8_t> background_y = dst_y;
+    std::vector<uint8_t> background_uv = dst_uv;
+    blend_nv12a_to_nv12(image, src_x, src_y, width, height, dst_y.data(), kWidth, dst_uv.data(),
+                        kWidth);
+
+    bool passed = true;
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            int32_t offset = (src_y + y) * kWidth + src_x + x;
+            uint32_t t = image.y[offset] * image.y_alpha[offset] +
+                         background_y[y * kWidth + x] * (255 - image.y_alpha[offset]) + 128;
+            passed &= dst_y[y * kWidth + x] == ((t + (t >> 8)) >> 8);
+        }
+    }
+    for (int32_t y = 0; y < height / 2; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            int32_t offset = (src_y / 2 + y) * kWidth + src_x + x;
+            uint32_t t = image.uv[offset] * image.uv_alpha[offset] +
+                         background_uv[y * kWidth + x] * (255 - image.uv_alpha[offset]) + 128;
+            passed &= dst_uv[y * kWidth + x] == ((t + (t >> 8)) >> 8);
+        }
+    }
+    // nothing right of the part is touched
+    passed &= dst_y[width] == background_y[width];
+    return check(passed, "nv12a blend");
+}
+
+int main() {
+    srand(1);
+    bool passed = test_i420();
+    passed &= test_yuyv();
+    passed &= test_rgba(color_matrix::BT601);
+    passed &= test_rgba(color_matrix::BT709);
+    passed &= test_blend();
+    std::cout << "pixel convert test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+#include <drm_mode.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "src/pixel_rotate.h"
+
+// no device needed: the tiled rotation is checked against a plain per pixel reference
+
+static void fill_random(std::vector<uint8_t> *data) {
+    for (uint8_t &value : *data) {
+        value = rand();
+    }
+}
+
+/**
+ * where pixel x,y of a width x height plane lands, reflection first, then a counter
+ * clockwise rotation, the way a plane with the rotation property shows it
+ */
+static void reference_rotate_point(int32_t width, int32_t height, uint64_t rotation, int32_t *x,
+                                   int32_t *y) {
+    int32_t px = (rotation & DRM_MODE_REFLECT_X) ? width - 1 - *x : *x;
+    int32_t py = (rotation & DRM_MODE_REFLECT_Y) ? height - 1 - *y : *y;
+    if (rotation & DRM_MODE_ROTATE_90) {
+        *x = py;
+        *y = width - 1 - px;
+    } else if (rotation & DRM_MODE_ROTATE_180) {
+        *x = width - 1 - px;
+        *y = height - 1 - py;
+    } else if (rotation & DRM_MODE_ROTATE_270) {
+        *x = height - 1 - py;
+        *y = px;
+    } else {
+        *x = px;
+        *y = py;
+    }
+}
+
+static bool test_rotate(int32_t width, int32_t height, uint64_t rotation) {
+    int32_t src_y_stride = width + 6;
+    int32_t src_uv_stride = width + 10;
+    std::vector<uint8_t> src_y(src_y_stride * height);
+    std::vector<uint8_t> src_uv(src_uv_stride * height / 2);
+    fill_random(&src_y);
+    fill_random(&src_uv);
+
+    bool swapped = rotation_swaps_axes(rotation);
+    int32_t dst_width = swapped ? height : width;
+    int32_t dst_height = swapped ? width : height;
+    int32_t dst_y_pitch = dst_width + 4;
+    int32_t dst_uv_pitch = dst_width + 8;
+    std::vector<uint8_t> dst_y(dst_y_pitch * dst_height);
+    std::vector<uint8_t> dst_uv(dst_uv_pitch * dst_height / 2);
+    rotate_nv12(src_y.data(), src_y_stride, src_uv.data(), src_uv_stride, dst_y.data(),
+                dst_y_pitch, dst_uv.data(), dst_uv_pitch, width, height, rotation);
+
+    bool passed = true;
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            int32_t dst_x = x, dst_y_row = y;
+            reference_rotate_point(width, height, rotation, &dst_x, &dst_y_row);
+            passed &= dst_y[dst_y_row * dst_y_pitch + dst_x] == src_y[y * src_y_stride + x];
+        }
+    }
+    // a UV pair moves as one pixel of the half size chroma plane
+    for (int32_t y = 0; y < height / 2; y++) {
+        for (int32_t x = 0; x < width / 2; x++) {
+            int32_t dst_x = x, dst_y_row = y;
+            reference_rotate_point(width / 2, height / 2, rotation, &dst_x, &dst_y_row);
+            const uint8_t *dst = &dst_uv[dst_y_row * dst_uv_pitch + 2 * dst_x];
+            const uint8_t *src = &src_uv[y * src_uv_stride + 2 * x];
+            passed &= dst[0] == src[0] && dst[1] == src[1];
+        }
+    }
+
+    // a rectangle lands on the bounding box of its rotated corners
+    int32_t rect_x = width / 5, rect_y = height / 3;
+    int32_t rect_width = width / 2, rect_height = height / 2;
+    int32_t x0 = rect_x, y0 = rect_y;
+    int32_t x1 = rect_x + rect_width - 1, y1 = rect_y + rect_height - 1;
+    reference_rotate_point(width, height, rotation, &x0, &y0);
+    reference_rotate_point(width, height, rotation, &x1, &y1);
+    rotate_rect(width, height, rotation, &rect_x, &rect_y, &rect_width, &rect_height);
+    passed &= rect_x == std::min(x0, x1) && rect_y == std::min(y0, y1) &&
+              rect_width == abs(x1 - x0) + 1 && rect_height == abs(y1 - y0) + 1;
+    return passed;
+}
+
+static bool test_rotations() {
+    // 20x14 stays inside one tile row, 130x66 crosses blocks and leaves partial tiles
+    const int32_t sizes[][2] = {{20, 14}, {130, 66}, {2, 2}};
+    const uint64_t rotations[] = {DRM_MODE_ROTATE_0, DRM_MODE_ROTATE_90, DRM_MODE_ROTATE_180,
+                                  DRM_MODE_ROTATE_270};
+    const uint64_t reflections[] = {0, DRM_MODE_REFLECT_X, DRM_MODE_REFLECT_Y,
+                                    DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y};
+    bool passed = true;
+    for (const int32_t *size : sizes) {
+        for (uint64_t rotation : rotations) {
+            for (uint64_t reflection : reflections) {
+                if (!test_rotate(size[0], size[1], rotation | reflection)) {
+                    std::cout << "rotation 0x" << std::hex << (rotation | reflection) << std::dec
+                              << " of " << size[0] << "x" << size[1] << " is wrong" << std::endl;
+                    passed = false;
+                }
+            }
+        }
+    }
+    return passed;
+}
+
+int main() {
+    srand(1);
+    bool passed = test_rotations();
+    std::cout << "pixel test " << (passed ? "passed" : "failed") << std::endl;
+    return passed ? 0 : 1;
+}